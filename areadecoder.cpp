@@ -0,0 +1,132 @@
+#include "areadecoder.h"
+
+#include <FL/Fl.H>
+
+#include <map>
+#include <utility>
+
+// a decoded area, handed to the main thread
+struct AreaDecoder::message {
+  // see live_decoders(), the decoder may be gone when the message arrives
+  unsigned int decoder;
+  unsigned int generation;
+  image_data image;
+  image_area area;
+};
+
+// decoders by id, only used on the main thread
+static std::map<unsigned int, AreaDecoder *> &live_decoders() {
+  static std::map<unsigned int, AreaDecoder *> decoders;
+  return decoders;
+}
+
+AreaDecoder::AreaDecoder(done_callback done)
+    : mDone(std::move(done)), mGeneration(0), mRunning(false), mStop(false) {
+  static unsigned int next_id = 0;
+  mId = ++next_id;
+  live_decoders()[mId] = this;
+  mWorker = std::thread(&AreaDecoder::run, this);
+}
+
+AreaDecoder::~AreaDecoder() {
+  // messages still queued are dropped by onAwake()
+  live_decoders().erase(mId);
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStop = true;
+    mPending.reset();
+    ++mGeneration;
+  }
+  mWake.notify_one();
+  mWorker.join();
+}
+
+void AreaDecoder::decode(const DcmDataSet *dataset, const DcmDataSet *meta,
+                         Frame &&frame, const image_area &area, int width,
+                         int height) {
+  std::unique_ptr<job> request(new job);
+  request->dataset = dataset;
+  request->meta = meta;
+  request->frame = std::move(frame);
+  request->area = area;
+  request->width = width;
+  request->height = height;
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    request->generation = ++mGeneration;
+    mPending = std::move(request);
+  }
+  mWake.notify_one();
+}
+
+void AreaDecoder::cancel() {
+  std::lock_guard<std::mutex> lock(mMutex);
+  ++mGeneration;
+  mPending.reset();
+}
+
+void AreaDecoder::wait() {
+  std::unique_lock<std::mutex> lock(mMutex);
+  mIdle.wait(lock, [this] { return !mRunning && !mPending; });
+}
+
+bool AreaDecoder::cancelled(unsigned int generation) const {
+  return generation != mGeneration;
+}
+
+void AreaDecoder::run() {
+  for (;;) {
+    std::unique_ptr<job> request;
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mWake.wait(lock, [this] { return mStop || mPending; });
+      if (mStop)
+        return;
+      request = std::move(mPending);
+      mRunning = true;
+    }
+    image_area area = request->area;
+    image_data image =
+        decodeFrameArea(request->dataset, request->meta, request->frame, area,
+                        request->width, request->height);
+    // the frame may point into the FrameSource
+    request->frame = Frame();
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mRunning = false;
+    }
+    mIdle.notify_all();
+    if (cancelled(request->generation))
+      continue;
+    message *msg = new message;
+    msg->decoder = mId;
+    msg->generation = request->generation;
+    msg->image = std::move(image);
+    msg->area = area;
+    post(msg);
+  }
+}
+
+void AreaDecoder::post(message *msg) {
+  // fails if the message queue is full, retried until a newer request
+  // makes the result useless
+  while (Fl::awake(&AreaDecoder::onAwake, msg) != 0) {
+    if (cancelled(msg->generation)) {
+      delete msg;
+      return;
+    }
+    std::this_thread::yield();
+  }
+}
+
+void AreaDecoder::onAwake(void *data) {
+  std::unique_ptr<message> msg(static_cast<message *>(data));
+  const auto found = live_decoders().find(msg->decoder);
+  if (found == live_decoders().end())
+    return;
+  AreaDecoder *decoder = found->second;
+  if (decoder->cancelled(msg->generation))
+    return;
+  if (decoder->mDone)
+    decoder->mDone(std::move(msg->image), msg->area);
+}
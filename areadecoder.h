@@ -0,0 +1,78 @@
+#ifndef AREADECODER_H
+#define AREADECODER_H
+
+extern "C" {
+#include <dicom/dicom.h>
+}
+
+#include "framesource.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Decodes areas of frames with decodeFrameArea() on a worker thread, so that
+// zooming and panning do not wait for the decoder. Only the latest request
+// is kept. Its result is handed to the callback on the main thread through
+// Fl::awake(), results of older requests are dropped. Like a Loader it is
+// created and destroyed on the main thread.
+class AreaDecoder {
+public:
+  // the decoded area, empty on failure, see decodeFrameArea()
+  typedef std::function<void(image_data, const image_area &)> done_callback;
+
+  explicit AreaDecoder(done_callback done);
+  AreaDecoder(const AreaDecoder &) = delete;
+  AreaDecoder &operator=(const AreaDecoder &) = delete;
+  AreaDecoder(AreaDecoder &&) = delete;
+  AreaDecoder &operator=(AreaDecoder &&) = delete;
+  ~AreaDecoder();
+
+public:
+  // the datasets and the memory frame points to have to stay valid until
+  // the result is handed out or wait() returns
+  void decode(const DcmDataSet *dataset, const DcmDataSet *meta,
+              Frame &&frame, const image_area &area, int width, int height);
+  // drops the pending request and the result of the running one
+  void cancel();
+  // until the worker uses no dataset or frame any more, e.g. before they
+  // are released
+  void wait();
+
+private:
+  struct job {
+    const DcmDataSet *dataset;
+    const DcmDataSet *meta;
+    Frame frame;
+    image_area area;
+    int width;
+    int height;
+    unsigned int generation;
+  };
+  struct message;
+
+  void run();
+  bool cancelled(unsigned int generation) const;
+  void post(message *msg);
+  static void onAwake(void *data);
+
+private:
+  // identifies the decoder in its messages
+  unsigned int mId;
+  done_callback mDone;
+  // bumped by every request and cancel, older results are dropped
+  std::atomic<unsigned int> mGeneration;
+  std::mutex mMutex;
+  std::condition_variable mWake;
+  // signalled when the worker finishes a job
+  std::condition_variable mIdle;
+  std::unique_ptr<job> mPending;
+  bool mRunning;
+  bool mStop;
+  std::thread mWorker;
+};
+
+#endif // AREADECODER_H
@@ -0,0 +1,449 @@
+// pdv_batch: converts DICOM files to PGM/PPM or raw samples without a
+// display, e.g. to pre-render a study on a server. Files are converted in
+// parallel, one file per worker.
+
+#include "clahe.h"
+#include "compression.h"
+#include "dicomhelpers.h"
+#include "display.h"
+#include "framesource.h"
+#include "mappedio.h"
+#include "series.h"
+#include "threadpool.h"
+
+extern "C" {
+#include <dicom/dicom.h>
+}
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+enum class output_format { pnm, raw };
+enum class voi_mode { equalize, clahe, full, dicom };
+
+struct options {
+  std::vector<std::string> inputs;
+  std::string output{"."};
+  output_format format{output_format::pnm};
+  voi_mode voi{voi_mode::equalize};
+  clahe_options clahe;
+  unsigned int jobs{0};
+  bool recursive{false};
+  bool allFrames{false};
+  // also print the decoder statistics
+  bool verbose{false};
+  // see decodeFrame()
+  int width{0};
+  int height{0};
+};
+
+struct input_file {
+  std::string path;
+  // output file name without extension
+  std::string name;
+  int64_t size;
+};
+
+// seconds spent in each stage, summed over the workers
+struct stage_times {
+  double parse{0.0};
+  double read{0.0};
+  double decode{0.0};
+  double convert{0.0};
+  double write{0.0};
+};
+
+struct batch_stats {
+  size_t converted{0};
+  size_t failed{0};
+  size_t frames{0};
+  uint64_t inputBytes{0};
+  uint64_t outputBytes{0};
+  stage_times times;
+};
+
+// seconds since start, start is moved to now
+class stopwatch {
+public:
+  stopwatch() : mStart(std::chrono::steady_clock::now()) {}
+  double lap() {
+    const std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+    const double seconds = std::chrono::duration<double>(now - mStart).count();
+    mStart = now;
+    return seconds;
+  }
+
+private:
+  std::chrono::steady_clock::time_point mStart;
+};
+
+struct file_closer {
+  void operator()(FILE *f) const { fclose(f); }
+};
+typedef std::unique_ptr<FILE, file_closer> file_ptr;
+} // namespace
+
+static void usage() {
+  fprintf(stderr,
+          "usage: pdv_batch [options] file|directory...\n"
+          "  -o dir       output directory (default .)\n"
+          "  -f pnm|raw   PGM/PPM display samples or raw decoded samples\n"
+          "  -v equalize|clahe|full|dicom\n"
+          "               grey mapping of PGM output: histogram "
+          "equalization,\n"
+          "               adaptive equalization, full sample range or the\n"
+          "               first DICOM window\n"
+          "  -c XxY,clip  CLAHE tiles and clip limit (default 8x8,2)\n"
+          "  -j n         worker threads (default hardware concurrency)\n"
+          "  -s WxH       decode only the JPEG 2000 resolution covering WxH\n"
+          "  -a           all frames instead of the first one\n"
+          "  -r           recurse into directories\n"
+          "  -V           also print JPEG 2000 decoder statistics\n");
+}
+
+static bool parse_options(int argc, char **argv, options &opt) {
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "-o" && hasValue) {
+      opt.output = argv[++i];
+    } else if (arg == "-f" && hasValue) {
+      const std::string value = argv[++i];
+      if (value == "pnm")
+        opt.format = output_format::pnm;
+      else if (value == "raw")
+        opt.format = output_format::raw;
+      else
+        return false;
+    } else if (arg == "-v" && hasValue) {
+      const std::string value = argv[++i];
+      if (value == "equalize")
+        opt.voi = voi_mode::equalize;
+      else if (value == "clahe")
+        opt.voi = voi_mode::clahe;
+      else if (value == "full")
+        opt.voi = voi_mode::full;
+      else if (value == "dicom")
+        opt.voi = voi_mode::dicom;
+      else
+        return false;
+    } else if (arg == "-c" && hasValue) {
+      if (sscanf(argv[++i], "%dx%d,%lf", &opt.clahe.tilesX, &opt.clahe.tilesY,
+                 &opt.clahe.clipLimit) != 3 ||
+          opt.clahe.tilesX < 1 || opt.clahe.tilesY < 1 ||
+          opt.clahe.clipLimit < 0)
+        return false;
+    } else if (arg == "-j" && hasValue) {
+      const int jobs = atoi(argv[++i]);
+      if (jobs < 1)
+        return false;
+      opt.jobs = jobs;
+    } else if (arg == "-s" && hasValue) {
+      if (sscanf(argv[++i], "%dx%d", &opt.width, &opt.height) != 2)
+        return false;
+    } else if (arg == "-a") {
+      opt.allFrames = true;
+    } else if (arg == "-r") {
+      opt.recursive = true;
+    } else if (arg == "-V") {
+      opt.verbose = true;
+    } else if (!arg.empty() && arg[0] == '-') {
+      return false;
+    } else {
+      opt.inputs.push_back(arg);
+    }
+  }
+  return !opt.inputs.empty();
+}
+
+// files of a directory are named after their path below it
+static std::vector<input_file> collect_inputs(const options &opt) {
+  std::vector<input_file> inputs;
+  for (const std::string &input : opt.inputs) {
+    struct stat info;
+    if (stat(input.c_str(), &info) != 0) {
+      fprintf(stderr, "cannot find %s\n", input.c_str());
+      continue;
+    }
+    std::vector<file_stat> files;
+    size_t prefix = 0;
+    if (S_ISDIR(info.st_mode)) {
+      listFiles(input, opt.recursive, files);
+      std::sort(files.begin(), files.end(),
+                [](const file_stat &a, const file_stat &b) {
+                  return a.path < b.path;
+                });
+      prefix = input.size() + 1;
+    } else {
+      files.push_back({input, static_cast<int64_t>(info.st_mtime),
+                       static_cast<int64_t>(info.st_size)});
+      const size_t slash = input.rfind('/');
+      prefix = slash == std::string::npos ? 0 : slash + 1;
+    }
+    for (const file_stat &f : files) {
+      std::string name = f.path.substr(prefix);
+      std::replace(name.begin(), name.end(), '/', '_');
+      inputs.push_back({f.path, name, f.size});
+    }
+  }
+  return inputs;
+}
+
+// raw files of YBR_FULL_422 hold Y Y Cb Cr for every pair of pixels
+static const char *colour_name(const image_data &image) {
+  switch (image.colour) {
+  case colour_space::rgb:
+    break;
+  case colour_space::ybr_full:
+    return "_ybr";
+  case colour_space::ybr_full_422:
+    return "_ybr422";
+  }
+  return "";
+}
+
+static const char *format_name(sample_format format) {
+  switch (format) {
+  case sample_format::u8:
+    return "u8";
+  case sample_format::s8:
+    return "s8";
+  case sample_format::u16:
+    return "u16";
+  case sample_format::s16:
+    return "s16";
+  case sample_format::u32:
+    return "u32";
+  case sample_format::s32:
+    return "s32";
+  }
+  return "";
+}
+
+static window_level dicom_window(const DcmDataSet *dataset,
+                                 const image_data &image) {
+  const std::vector<std::string> centers = getStrings(dataset, 0x00281050);
+  const std::vector<std::string> widths = getStrings(dataset, 0x00281051);
+  if (centers.empty() || widths.empty() || atof(widths[0].c_str()) <= 0)
+    return fullRange(image);
+  window_level window;
+  window.center = atof(centers[0].c_str());
+  window.width = atof(widths[0].c_str());
+  return window;
+}
+
+static bool write_file(const std::string &path, const char *header,
+                       const void *data, size_t size, uint64_t &written) {
+  file_ptr f(fopen(path.c_str(), "wb"));
+  if (!f) {
+    fprintf(stderr, "cannot write %s\n", path.c_str());
+    return false;
+  }
+  const size_t headerSize = strlen(header);
+  if (fwrite(header, 1, headerSize, f.get()) != headerSize ||
+      fwrite(data, 1, size, f.get()) != size) {
+    fprintf(stderr, "cannot write %s\n", path.c_str());
+    return false;
+  }
+  written += headerSize + size;
+  return true;
+}
+
+static bool convert_file(const input_file &input, const options &opt,
+                         batch_stats &stats) {
+  stopwatch watch;
+  dicom_file dicom(input.path);
+  stats.times.parse += watch.lap();
+  if (!dicom.dataset) {
+    fprintf(stderr, "cannot read %s\n", input.path.c_str());
+    return false;
+  }
+  FrameSource frames(dicom.dataset, dicom.meta, dicom.io, dicom.filehandle,
+                     dicom.path);
+  stats.times.parse += watch.lap();
+  if (frames.count() == 0) {
+    fprintf(stderr, "%s has no frames %s\n", input.path.c_str(),
+            frames.error().c_str());
+    return false;
+  }
+
+  const uint32_t count = opt.allFrames ? frames.count() : 1;
+  for (uint32_t i = 0; i < count; i++) {
+    Frame frame = frames.frame(i);
+    stats.times.read += watch.lap();
+    // straight to the decoder, a batch does not look at a frame twice
+    decoded_frame decoded =
+        decodeFrame(dicom.dataset, dicom.meta, std::move(frame),
+                    frames.count(), opt.width, opt.height);
+    stats.times.decode += watch.lap();
+    const image_data &image = decoded.image;
+    if (image.pixels.empty() && !decoded.streamed.pixels) {
+      fprintf(stderr, "cannot decode frame %u of %s\n", i + 1,
+              input.path.c_str());
+      return false;
+    }
+
+    std::string path = opt.output + "/" + input.name;
+    if (opt.allFrames) {
+      char suffix[16];
+      snprintf(suffix, sizeof(suffix), "_%04u", i + 1);
+      path += suffix;
+    }
+    char header[64] = "";
+    const void *data = nullptr;
+    size_t size = 0;
+    std::unique_ptr<uint8_t[]> display;
+    if (opt.format == output_format::raw && !image.pixels.empty()) {
+      // the layout goes into the name, the file holds nothing but samples
+      char layout[64];
+      snprintf(layout, sizeof(layout), "_%dx%dx%d_%s%s%s.raw", image.width,
+               image.height, image.components,
+               format_name(image.pixels.format()),
+               image.components > 1 && image.pixels.planar() ? "_planar"
+                                                                : "",
+               colour_name(image));
+      path += layout;
+      data = image.pixels.data();
+      size = image.pixels.bytes();
+    } else if (!image.pixels.empty()) {
+      const int components = displayComponents(image);
+      if (components == 0) {
+        fprintf(stderr, "%s cannot be displayed\n", input.path.c_str());
+        return false;
+      }
+      size = static_cast<size_t>(image.width) * image.height * components;
+      display.reset(new uint8_t[size]);
+      bool converted = false;
+      if (components == 1 && opt.voi == voi_mode::full)
+        converted = toDisplay(image, fullRange(image), display.get());
+      else if (components == 1 && opt.voi == voi_mode::clahe)
+        converted = claheToDisplay(image, opt.clahe, display.get());
+      else if (components == 1 && opt.voi == voi_mode::dicom)
+        converted =
+            toDisplay(image, dicom_window(dicom.dataset, image), display.get());
+      else
+        converted = toDisplay(image, display.get());
+      if (!converted)
+        return false;
+      snprintf(header, sizeof(header), "P%c\n%d %d\n255\n",
+               components == 1 ? '5' : '6', image.width, image.height);
+      path += components == 1 ? ".pgm" : ".ppm";
+      data = display.get();
+    } else if (opt.format == output_format::raw) {
+      fprintf(stderr,
+              "frame %u of %s is too large for raw output, only display "
+              "samples are decoded\n",
+              i + 1, input.path.c_str());
+      return false;
+    } else {
+      // too large to hold at full precision, only display samples exist
+      const display_data &streamed = decoded.streamed;
+      size = static_cast<size_t>(streamed.width) * streamed.height *
+             streamed.components;
+      snprintf(header, sizeof(header), "P%c\n%d %d\n255\n",
+               streamed.components == 1 ? '5' : '6', streamed.width,
+               streamed.height);
+      path += streamed.components == 1 ? ".pgm" : ".ppm";
+      data = streamed.pixels.get();
+    }
+    stats.times.convert += watch.lap();
+    if (!write_file(path, header, data, size, stats.outputBytes))
+      return false;
+    stats.times.write += watch.lap();
+    stats.frames++;
+  }
+  return true;
+}
+
+static void print_decoder_stats(const char *name, const decoder_stats &s) {
+  printf("%s: %llu codestreams, %.1f MB, %.3f s, %.1f Msamples/s\n", name,
+         static_cast<unsigned long long>(s.codestreams), s.bytes / 1048576.0,
+         s.seconds, s.seconds > 0 ? s.samples / s.seconds / 1e6 : 0.0);
+}
+
+static void print_stats(const batch_stats &stats, double seconds) {
+  const double mb = 1024.0 * 1024.0;
+  const stage_times &t = stats.times;
+  const double total = t.parse + t.read + t.decode + t.convert + t.write;
+  auto share = [total](double stage) {
+    return total > 0 ? 100.0 * stage / total : 0.0;
+  };
+  printf("files: %zu converted, %zu failed, %zu frames\n", stats.converted,
+         stats.failed, stats.frames);
+  printf("time: %.3f s, %.1f files/s, %.1f frames/s, %.1f MB/s read, "
+         "%.1f MB/s written\n",
+         seconds, seconds > 0 ? stats.converted / seconds : 0.0,
+         seconds > 0 ? stats.frames / seconds : 0.0,
+         seconds > 0 ? stats.inputBytes / mb / seconds : 0.0,
+         seconds > 0 ? stats.outputBytes / mb / seconds : 0.0);
+  printf("stages (thread seconds): parse %.3f (%.0f%%), read %.3f (%.0f%%), "
+         "decode %.3f (%.0f%%), convert %.3f (%.0f%%), write %.3f (%.0f%%)\n",
+         t.parse, share(t.parse), t.read, share(t.read), t.decode,
+         share(t.decode), t.convert, share(t.convert), t.write,
+         share(t.write));
+}
+
+int main(int argc, char **argv) {
+  options opt;
+  if (!parse_options(argc, argv, opt)) {
+    usage();
+    return 2;
+  }
+  const unsigned int jobs = opt.jobs > 0 ? opt.jobs : hardwareThreads();
+  const std::vector<input_file> inputs = collect_inputs(opt);
+  if (inputs.empty()) {
+    fprintf(stderr, "no input files\n");
+    return 1;
+  }
+  mkdir(opt.output.c_str(), 0755);
+  // the workers already keep the cores busy with whole files
+  setDecoderThreads(std::max(1u, hardwareThreads() / jobs));
+  opt.clahe.threads = std::max(1u, hardwareThreads() / jobs);
+
+  batch_stats stats;
+  std::mutex statsMutex;
+  stopwatch wall;
+  {
+    ThreadPool pool(jobs);
+    std::vector<std::future<void>> done;
+    for (const input_file &input : inputs) {
+      done.push_back(pool.submit([&opt, &stats, &statsMutex, &input] {
+        batch_stats file;
+        const bool converted = convert_file(input, opt, file);
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats.converted += converted ? 1 : 0;
+        stats.failed += converted ? 0 : 1;
+        stats.frames += file.frames;
+        stats.inputBytes += input.size;
+        stats.outputBytes += file.outputBytes;
+        stats.times.parse += file.times.parse;
+        stats.times.read += file.times.read;
+        stats.times.decode += file.times.decode;
+        stats.times.convert += file.times.convert;
+        stats.times.write += file.times.write;
+      }));
+    }
+    for (std::future<void> &d : done) {
+      d.wait();
+    }
+  }
+  print_stats(stats, wall.lap());
+  if (opt.verbose) {
+    print_decoder_stats("JPEG 2000", decoderStats(false));
+    print_decoder_stats("HTJ2K", decoderStats(true));
+  }
+  return stats.failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,788 @@
+// pdv_bench: benchmarks of the hot paths on synthetic DICOM files written
+// to a temporary directory. Every benchmark runs once to warm up and then
+// the given number of repetitions; one result per line is printed as JSON
+// or CSV.
+
+#include "clahe.h"
+#include "compression.h"
+#include "dicomhelpers.h"
+#include "display.h"
+#include "framesource.h"
+#include "imagehelpers.h"
+#include "kernels.h"
+#include "mappedio.h"
+#include "resample.h"
+#include "threadpool.h"
+
+extern "C" {
+#include <dicom/dicom.h>
+}
+#include <openjpeg-2.5/openjpeg.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const uint32_t pixel_data_tag = 0x7FE00010;
+
+namespace {
+enum class output_format { json, csv };
+
+struct options {
+  int size{512};
+  int repetitions{10};
+  unsigned int threads{1};
+  output_format format{output_format::json};
+  std::string filter;
+  std::string directory;
+  bool keep{false};
+  // also print the decoder statistics to stderr
+  bool verbose{false};
+};
+
+// a synthetic file and what is needed to benchmark it
+struct sample_file {
+  std::string name;
+  std::string path;
+  // of the first dataset element after the file meta group
+  int64_t datasetOffset;
+  uint64_t size;
+  uint32_t frames;
+};
+
+// little endian explicit VR
+class dicom_writer {
+public:
+  void element(uint32_t tag, const char *vr, const std::string &value) {
+    std::string padded = value;
+    if (padded.size() % 2)
+      padded += strcmp(vr, "UI") == 0 || strcmp(vr, "OB") == 0 ? '\0' : ' ';
+    header(tag, vr, padded.size());
+    mData += padded;
+  }
+  void us(uint32_t tag, uint16_t value) {
+    element(tag, "US", std::string(reinterpret_cast<char *>(&value), 2));
+  }
+  void ul(uint32_t tag, uint32_t value) {
+    element(tag, "UL", std::string(reinterpret_cast<char *>(&value), 4));
+  }
+  // header of an element with undefined length
+  void undefined(uint32_t tag, const char *vr) {
+    header(tag, vr, 0xFFFFFFFF);
+  }
+  void item(const std::string &value) {
+    tag(0xFFFEE000);
+    length(value.size());
+    mData += value;
+  }
+  void delimiter(uint32_t tag) {
+    this->tag(tag);
+    length(0);
+  }
+  const std::string &data() const { return mData; }
+
+private:
+  void tag(uint32_t t) {
+    const uint16_t group = t >> 16;
+    const uint16_t element = t & 0xFFFF;
+    mData.append(reinterpret_cast<const char *>(&group), 2);
+    mData.append(reinterpret_cast<const char *>(&element), 2);
+  }
+  void length(uint32_t l) {
+    mData.append(reinterpret_cast<const char *>(&l), 4);
+  }
+  void header(uint32_t t, const char *vr, uint32_t l) {
+    tag(t);
+    mData.append(vr, 2);
+    static const char *long_vrs[] = {"OB", "OD", "OF", "OL", "OV", "OW",
+                                     "SQ", "SV", "UC", "UN", "UR", "UT",
+                                     "UV"};
+    bool isLong = false;
+    for (const char *l : long_vrs) {
+      isLong = isLong || strcmp(l, vr) == 0;
+    }
+    if (isLong) {
+      mData.append(2, '\0');
+      length(l);
+    } else {
+      const uint16_t l16 = l;
+      mData.append(reinterpret_cast<const char *>(&l16), 2);
+    }
+  }
+
+private:
+  std::string mData;
+};
+
+struct write_buffer {
+  std::vector<char> data;
+  size_t pos;
+};
+
+struct result {
+  std::string name;
+  std::vector<double> seconds;
+  // processed per repetition, for the throughput
+  double bytes;
+};
+} // namespace
+
+// ### synthetic images ###
+
+// smooth background, a few discs and some noise, so that it compresses
+// roughly like a CT slice
+static std::vector<uint16_t> phantom(int size, int bits, uint32_t seed) {
+  std::vector<uint16_t> pixels(static_cast<size_t>(size) * size);
+  const int maxval = (1 << bits) - 1;
+  uint32_t state = seed * 2654435761u + 1;
+  for (int y = 0; y < size; y++) {
+    for (int x = 0; x < size; x++) {
+      const double dx = x - size / 2.0;
+      const double dy = y - size / 2.0;
+      const double r = std::sqrt(dx * dx + dy * dy) / size;
+      double value = r < 0.45 ? 0.3 + 0.2 * std::cos(r * 20) : 0.0;
+      for (int disc = 0; disc < 5; disc++) {
+        const double cx = size * (0.3 + 0.1 * disc);
+        const double cy = size * (0.5 + 0.05 * ((disc + seed) % 3));
+        if ((x - cx) * (x - cx) + (y - cy) * (y - cy) < size * size / 400.0)
+          value += 0.3;
+      }
+      state = state * 1664525u + 1013904223u;
+      value += ((state >> 16) & 0xFF) / 255.0 * 0.02;
+      pixels[static_cast<size_t>(y) * size + x] =
+          static_cast<uint16_t>(std::min(value, 1.0) * maxval);
+    }
+  }
+  return pixels;
+}
+
+static OPJ_SIZE_T write_stream(void *buffer, OPJ_SIZE_T bytes, void *user) {
+  write_buffer *out = static_cast<write_buffer *>(user);
+  if (out->pos + bytes > out->data.size())
+    out->data.resize(out->pos + bytes);
+  memcpy(out->data.data() + out->pos, buffer, bytes);
+  out->pos += bytes;
+  return bytes;
+}
+
+static OPJ_OFF_T skip_stream(OPJ_OFF_T bytes, void *user) {
+  write_buffer *out = static_cast<write_buffer *>(user);
+  out->pos += bytes;
+  if (out->pos > out->data.size())
+    out->data.resize(out->pos);
+  return bytes;
+}
+
+static OPJ_BOOL seek_stream(OPJ_OFF_T offset, void *user) {
+  write_buffer *out = static_cast<write_buffer *>(user);
+  out->pos = offset;
+  if (out->pos > out->data.size())
+    out->data.resize(out->pos);
+  return OPJ_TRUE;
+}
+
+// lossless raw codestream of a grey image, in tiles of tile x tile pixels
+// if tile is not 0
+static std::string encode_j2k(const std::vector<uint16_t> &pixels, int size,
+                              int bits, int tile = 0) {
+  opj_cparameters_t params;
+  opj_set_default_encoder_parameters(&params);
+  params.tcp_numlayers = 1;
+  params.tcp_rates[0] = 0;
+  params.cp_disto_alloc = 1;
+  params.numresolution = 6;
+  params.irreversible = 0;
+  if (tile) {
+    params.tile_size_on = OPJ_TRUE;
+    params.cp_tdx = tile;
+    params.cp_tdy = tile;
+  }
+
+  opj_image_cmptparm_t component;
+  memset(&component, 0, sizeof(component));
+  component.dx = 1;
+  component.dy = 1;
+  component.w = size;
+  component.h = size;
+  component.prec = bits;
+  component.sgnd = 0;
+  opj_image_t *image = opj_image_create(1, &component, OPJ_CLRSPC_GRAY);
+  if (!image)
+    return {};
+  image->x0 = 0;
+  image->y0 = 0;
+  image->x1 = size;
+  image->y1 = size;
+  std::copy(pixels.begin(), pixels.end(), image->comps[0].data);
+
+  write_buffer out{{}, 0};
+  opj_stream_t *stream = opj_stream_create(1 << 20, /*input stream*/ OPJ_FALSE);
+  opj_stream_set_write_function(stream, write_stream);
+  opj_stream_set_skip_function(stream, skip_stream);
+  opj_stream_set_seek_function(stream, seek_stream);
+  opj_stream_set_user_data(stream, &out, nullptr);
+  opj_codec_t *codec = opj_create_compress(OPJ_CODEC_J2K);
+  const bool encoded = opj_setup_encoder(codec, &params, image) &&
+                       opj_start_compress(codec, image, stream) &&
+                       opj_encode(codec, stream) &&
+                       opj_end_compress(codec, stream);
+  opj_destroy_codec(codec);
+  opj_stream_destroy(stream);
+  opj_image_destroy(image);
+  if (!encoded) {
+    fprintf(stderr, "cannot encode the JPEG 2000 test image\n");
+    return {};
+  }
+  return std::string(out.data.data(), out.data.size());
+}
+
+// encapsulated pixel data without an offset table has an empty basic offset
+// table item
+static bool write_file(const options &opt, const std::string &name,
+                       const std::string &transferSyntax, int bits,
+                       uint32_t frames, bool encapsulated, bool offsetTable,
+                       sample_file &file) {
+  const int size = opt.size;
+  dicom_writer meta;
+  meta.element(0x00020001, "OB", std::string("\0\1", 2));
+  meta.element(0x00020002, "UI", "1.2.840.10008.5.1.4.1.1.7");
+  meta.element(0x00020003, "UI", "1.2.826.0.1.3680043.2.1125.1." + name);
+  meta.element(0x00020010, "UI", transferSyntax);
+  meta.element(0x00020012, "UI", "1.2.826.0.1.3680043.2.1125.2");
+  dicom_writer group;
+  group.ul(0x00020000, meta.data().size());
+
+  dicom_writer ds;
+  ds.element(0x00080016, "UI", "1.2.840.10008.5.1.4.1.1.7");
+  ds.element(0x00080018, "UI", "1.2.826.0.1.3680043.2.1125.1." + name);
+  ds.element(0x00080060, "CS", "OT");
+  // a sequence, so that reading the header goes through readSequence()
+  ds.undefined(0x00081140, "SQ");
+  {
+    dicom_writer item;
+    item.element(0x00081150, "UI", "1.2.840.10008.5.1.4.1.1.7");
+    item.element(0x00081155, "UI", "1.2.826.0.1.3680043.2.1125.3");
+    ds.item(item.data());
+  }
+  ds.delimiter(0xFFFEE0DD);
+  ds.element(0x00100010, "PN", "Bench^Synthetic");
+  ds.element(0x0020000D, "UI", "1.2.826.0.1.3680043.2.1125.4");
+  ds.element(0x0020000E, "UI", "1.2.826.0.1.3680043.2.1125.5");
+  ds.element(0x00200013, "IS", "1");
+  ds.us(0x00280002, 1);
+  ds.element(0x00280004, "CS", "MONOCHROME2");
+  ds.element(0x00280008, "IS", std::to_string(frames));
+  ds.us(0x00280010, size);
+  ds.us(0x00280011, size);
+  ds.us(0x00280100, bits <= 8 ? 8 : 16);
+  ds.us(0x00280101, bits);
+  ds.us(0x00280102, bits - 1);
+  ds.us(0x00280103, 0);
+  ds.element(0x00281050, "DS", std::to_string(1 << (bits - 1)));
+  ds.element(0x00281051, "DS", std::to_string(1 << bits));
+
+  std::string pixelData;
+  std::vector<std::string> codestreams;
+  for (uint32_t f = 0; f < frames; f++) {
+    const std::vector<uint16_t> pixels = phantom(size, bits, f);
+    if (encapsulated) {
+      codestreams.push_back(encode_j2k(pixels, size, bits));
+      if (codestreams.back().empty())
+        return false;
+    } else if (bits <= 8) {
+      for (uint16_t p : pixels) {
+        pixelData += static_cast<char>(p);
+      }
+    } else {
+      pixelData.append(reinterpret_cast<const char *>(pixels.data()),
+                       pixels.size() * 2);
+    }
+  }
+  if (encapsulated) {
+    std::string offsets;
+    uint32_t offset = 0;
+    for (const std::string &c : codestreams) {
+      if (offsetTable)
+        offsets.append(reinterpret_cast<const char *>(&offset), 4);
+      // item header and the even padded codestream
+      offset += 8 + c.size() + c.size() % 2;
+    }
+    ds.undefined(pixel_data_tag, "OB");
+    ds.item(offsets);
+    for (std::string c : codestreams) {
+      if (c.size() % 2)
+        c += '\0';
+      ds.item(c);
+    }
+    ds.delimiter(0xFFFEE0DD);
+  } else {
+    ds.element(pixel_data_tag, bits <= 8 ? "OB" : "OW", pixelData);
+  }
+
+  file.name = name;
+  file.path = opt.directory + "/" + name + ".dcm";
+  file.frames = frames;
+  file.datasetOffset = 132 + group.data().size() + meta.data().size();
+  FILE *f = fopen(file.path.c_str(), "wb");
+  if (!f) {
+    fprintf(stderr, "cannot write %s\n", file.path.c_str());
+    return false;
+  }
+  const std::string preamble(128, '\0');
+  fwrite(preamble.data(), 1, preamble.size(), f);
+  fwrite("DICM", 1, 4, f);
+  fwrite(group.data().data(), 1, group.data().size(), f);
+  fwrite(meta.data().data(), 1, meta.data().size(), f);
+  const bool written =
+      fwrite(ds.data().data(), 1, ds.data().size(), f) == ds.data().size();
+  fclose(f);
+  file.size = file.datasetOffset + ds.data().size();
+  return written;
+}
+
+// ### measuring ###
+
+static void print_result(const options &opt, const result &r) {
+  std::vector<double> s = r.seconds;
+  std::sort(s.begin(), s.end());
+  const double median = s.size() % 2 ? s[s.size() / 2]
+                                      : (s[s.size() / 2 - 1] +
+                                         s[s.size() / 2]) / 2;
+  double mean = 0.0;
+  for (double v : s) {
+    mean += v;
+  }
+  mean /= s.size();
+  double variance = 0.0;
+  for (double v : s) {
+    variance += (v - mean) * (v - mean);
+  }
+  const double stddev = std::sqrt(variance / s.size());
+  const double mbs = median > 0 ? r.bytes / median / 1048576.0 : 0.0;
+  if (opt.format == output_format::json) {
+    printf("{\"name\":\"%s\",\"repetitions\":%zu,\"min_ms\":%.4f,"
+           "\"median_ms\":%.4f,\"mean_ms\":%.4f,\"stddev_ms\":%.4f,"
+           "\"mb_per_s\":%.2f}\n",
+           r.name.c_str(), s.size(), s.front() * 1e3, median * 1e3,
+           mean * 1e3, stddev * 1e3, mbs);
+  } else {
+    printf("%s,%zu,%.4f,%.4f,%.4f,%.4f,%.2f\n", r.name.c_str(), s.size(),
+           s.front() * 1e3, median * 1e3, mean * 1e3, stddev * 1e3, mbs);
+  }
+  fflush(stdout);
+}
+
+// volatile, so that the compiler keeps the work of the benchmarks
+static volatile uint64_t sink;
+
+static void run(const options &opt, const std::string &name, double bytes,
+                const std::function<void()> &work) {
+  if (!opt.filter.empty() && name.find(opt.filter) == std::string::npos)
+    return;
+  work();
+  result r;
+  r.name = name;
+  r.bytes = bytes;
+  for (int i = 0; i < opt.repetitions; i++) {
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    work();
+    r.seconds.push_back(std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start)
+                            .count());
+  }
+  print_result(opt, r);
+}
+
+// ### benchmarks ###
+
+static void bench_parse(const options &opt, const sample_file &file) {
+  run(opt, "parse/" + file.name, file.datasetOffset, [&] {
+    dicom_file dicom(file.path);
+    sink += dicom.dataset != nullptr;
+  });
+
+  // the header elements one by one, up to the pixel data
+  run(opt, "read_elements/" + file.name, 0, [&] {
+    DcmError *error = nullptr;
+    DcmIO *io = openMappedFile(&error, file.path.c_str());
+    if (!io) {
+      dcm_error_destroy(error);
+      return;
+    }
+    dcm_io_seek(&error, io, file.datasetOffset, SEEK_SET);
+    for (uint32_t tag = readTag(io); tag != 0 && tag != pixel_data_tag;
+         tag = readTag(io)) {
+      DcmElement *element = readDataElement(io, tag, true);
+      if (!element)
+        break;
+      dcm_element_destroy(element);
+      sink += 1;
+    }
+    dcm_io_close(io);
+  });
+
+  // the same without decoding any value
+  run(opt, "seek_pixel_data/" + file.name, 0, [&] {
+    DcmError *error = nullptr;
+    DcmIO *io = openMappedFile(&error, file.path.c_str());
+    if (!io) {
+      dcm_error_destroy(error);
+      return;
+    }
+    dcm_io_seek(&error, io, file.datasetOffset, SEEK_SET);
+    element_header header;
+    sink += seekToElement(io, true, pixel_data_tag, header);
+    dcm_io_close(io);
+  });
+}
+
+static void bench_frames(const options &opt, const sample_file &file) {
+  dicom_file dicom(file.path);
+  if (!dicom.dataset)
+    return;
+  // a new FrameSource every time, indexing the pixel data is part of it
+  run(opt, "frames/" + file.name, file.size - file.datasetOffset, [&] {
+    FrameSource frames(dicom.dataset, dicom.meta, dicom.io, dicom.filehandle,
+                       dicom.path);
+    for (uint32_t i = 0; i < frames.count(); i++) {
+      const Frame frame = frames.frame(i);
+      sink += frame.size();
+    }
+  });
+}
+
+static void bench_decode(const options &opt, const sample_file &file) {
+  dicom_file dicom(file.path);
+  if (!dicom.dataset)
+    return;
+  FrameSource frames(dicom.dataset, dicom.meta, dicom.io, dicom.filehandle,
+                     dicom.path);
+  const Frame frame = frames.frame(0);
+  if (frame.empty())
+    return;
+  const double pixelBytes = 2.0 * opt.size * opt.size;
+  run(opt, "decode_j2k/full", pixelBytes, [&] {
+    const image_data image = decompressOpenJPEG(frame.data(), frame.size());
+    sink += image.pixels.bytes();
+  });
+  // the resolution level that still covers a quarter sized display
+  run(opt, "decode_j2k/reduced", pixelBytes, [&] {
+    const image_data image = decompressOpenJPEG(
+        frame.data(), frame.size(), opt.size / 4, opt.size / 4);
+    sink += image.pixels.bytes();
+  });
+  // the centre quarter at full resolution, as the viewer decodes it when
+  // zoomed in, through the codec registry
+  run(opt, "decode_j2k/area", pixelBytes / 4, [&] {
+    image_area area;
+    area.x0 = opt.size / 4;
+    area.y0 = opt.size / 4;
+    area.x1 = area.x0 + opt.size / 2;
+    area.y1 = area.y0 + opt.size / 2;
+    const image_data image =
+        decodeFrameArea(dicom.dataset, dicom.meta, frame, area, 0, 0);
+    sink += image.pixels.bytes();
+  });
+  std::vector<codestream> codestreams;
+  for (int i = 0; i < 8; i++) {
+    codestreams.push_back({frame.data(), frame.size()});
+  }
+  run(opt, "decode_j2k/8_frames", 8 * pixelBytes, [&] {
+    const std::vector<image_data> images = decompressOpenJPEG(codestreams);
+    sink += images.size();
+  });
+}
+
+// an area decode of a codestream larger than the stream chunk of
+// compression.cpp makes OpenJPEG skip over the tiles outside the area in
+// several calls, which looped forever while skip() did not return the bytes
+// it skipped. The first decode runs on its own thread and fails the
+// benchmark if it does not return in time.
+static bool bench_tiled_area(const options &opt) {
+  const std::string name = "decode_j2k/tiled_area";
+  if (!opt.filter.empty() && name.find(opt.filter) == std::string::npos)
+    return true;
+  const int size = std::max(opt.size, 2048);
+  struct decode_state {
+    std::string codestream;
+    std::mutex mutex;
+    std::condition_variable done;
+    bool returned{false};
+    bool decoded{false};
+  };
+  // shared with the decoding thread, which is left behind if it hangs
+  std::shared_ptr<decode_state> state = std::make_shared<decode_state>();
+  state->codestream = encode_j2k(phantom(size, 12, 0), size, 12, 256);
+  if (state->codestream.size() <= (1u << 20)) {
+    fprintf(stderr, "%s: the codestream has only %zu bytes\n", name.c_str(),
+            state->codestream.size());
+    return false;
+  }
+  // a corner, so that most of the tiles are skipped
+  image_area area;
+  area.x0 = size - 300;
+  area.y0 = size - 300;
+  area.x1 = size - 100;
+  area.y1 = size - 100;
+  std::thread([state, area] {
+    image_area decoded = area;
+    const image_data image = decompressOpenJPEGArea(
+        state->codestream.data(), state->codestream.size(), decoded);
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->returned = true;
+    state->decoded = !image.pixels.empty();
+    state->done.notify_one();
+  }).detach();
+  {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    if (!state->done.wait_for(lock, std::chrono::seconds(60),
+                              [&] { return state->returned; })) {
+      fprintf(stderr, "%s: the decode did not return within 60 s\n",
+              name.c_str());
+      return false;
+    }
+    if (!state->decoded) {
+      fprintf(stderr, "%s: the decode failed\n", name.c_str());
+      return false;
+    }
+  }
+  run(opt, name, 2.0 * 200 * 200, [&] {
+    image_area decoded = area;
+    const image_data image = decompressOpenJPEGArea(
+        state->codestream.data(), state->codestream.size(), decoded);
+    sink += image.pixels.bytes();
+  });
+  return true;
+}
+
+static void bench_display(const options &opt) {
+  const int size = opt.size;
+  const size_t pixels = static_cast<size_t>(size) * size;
+  const std::vector<uint16_t> samples = phantom(size, 12, 0);
+
+  std::vector<uint16_t> buf;
+  run(opt, "normalize_to_bits_used/u16", pixels * 2, [&] {
+    buf = samples;
+    normalizeToBitsUsed(buf, 12);
+    sink += buf[pixels / 2];
+  });
+  run(opt, "histeq/u16", pixels * 2, [&] {
+    buf = samples;
+    histeq(buf);
+    sink += buf[pixels / 2];
+  });
+
+  image_data grey16;
+  grey16.components = 1;
+  grey16.width = size;
+  grey16.height = size;
+  grey16.bpp = 12;
+  grey16.pixels = PixelBuffer(sample_format::u16, pixels);
+  std::copy(samples.begin(), samples.end(),
+            grey16.pixels.samples<uint16_t>());
+  image_data grey8 = grey16;
+  grey8.bpp = 8;
+  grey8.pixels = PixelBuffer(sample_format::u8, pixels);
+  image_data rgb8 = grey8;
+  rgb8.components = 3;
+  rgb8.pixels = PixelBuffer(sample_format::u8, pixels, 3);
+  for (size_t i = 0; i < pixels; i++) {
+    grey8.pixels.samples<uint8_t>()[i] = samples[i] >> 4;
+    for (int c = 0; c < 3; c++) {
+      rgb8.pixels.samples<uint8_t>()[3 * i + c] = samples[i] >> (2 + c);
+    }
+  }
+
+  // toDisplay() is what convert() does before wrapping the samples into an
+  // Fl_RGB_Image
+  std::vector<uint8_t> out(pixels * 3);
+  run(opt, "to_display/equalize_u16", pixels * 2, [&] {
+    sink += toDisplay(grey16, out.data());
+  });
+  window_level window;
+  window.center = 2048;
+  window.width = 1024;
+  run(opt, "to_display/window_u16", pixels * 2, [&] {
+    sink += toDisplay(grey16, window, out.data());
+  });
+  clahe_options clahe;
+  run(opt, "to_display/clahe_u16", pixels * 2, [&] {
+    sink += claheToDisplay(grey16, clahe, out.data());
+  });
+  clahe.threads = 1;
+  run(opt, "to_display/clahe_u16_1_thread", pixels * 2, [&] {
+    sink += claheToDisplay(grey16, clahe, out.data());
+  });
+  run(opt, "to_display/grey_u8", pixels,
+      [&] { sink += toDisplay(grey8, out.data()); });
+  run(opt, "to_display/rgb_u8", pixels * 3,
+      [&] { sink += toDisplay(rgb8, out.data()); });
+
+  // fitting to a display of 0.7 times the size, what render() does
+  const int fit = size * 7 / 10;
+  resample_options scaling;
+  scaling.filter = resample_filter::nearest;
+  run(opt, "resample/nearest_u16", pixels * 2, [&] {
+    sink += resample(grey16, fit, fit, scaling).pixels.bytes();
+  });
+  scaling.filter = resample_filter::bilinear;
+  run(opt, "resample/bilinear_u16", pixels * 2, [&] {
+    sink += resample(grey16, fit, fit, scaling).pixels.bytes();
+  });
+  scaling.filter = resample_filter::lanczos;
+  run(opt, "resample/lanczos_u16", pixels * 2, [&] {
+    sink += resample(grey16, fit, fit, scaling).pixels.bytes();
+  });
+  run(opt, "resample/lanczos_rgb_u8", pixels * 3, [&] {
+    sink += resample(rgb8, fit, fit, scaling).pixels.bytes();
+  });
+  // a new frame: the levels are built, then scaled from
+  run(opt, "resample/pyramid_lanczos_u16_quarter", pixels * 2, [&] {
+    ImagePyramid pyramid(grey16);
+    sink += pyramid.scaled(fit / 4, fit / 4, scaling).pixels.bytes();
+  });
+  // a resize of a frame whose levels exist
+  ImagePyramid pyramid(grey16);
+  pyramid.level(fit / 4, fit / 4);
+  run(opt, "resample/from_pyramid_lanczos_u16_quarter", pixels * 2, [&] {
+    sink += pyramid.scaled(fit / 4, fit / 4, scaling).pixels.bytes();
+  });
+}
+
+// stderr keeps the json or csv on stdout intact
+static void print_decoder_stats(const char *name, const decoder_stats &s) {
+  fprintf(stderr, "%s: %llu codestreams, %.1f MB, %.3f s, %.1f Msamples/s\n",
+          name, static_cast<unsigned long long>(s.codestreams),
+          s.bytes / 1048576.0, s.seconds,
+          s.seconds > 0 ? s.samples / s.seconds / 1e6 : 0.0);
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: pdv_bench [options]\n"
+          "  -n reps      repetitions of every benchmark (default 10)\n"
+          "  -s size      rows and columns of the test images (default 512)\n"
+          "  -t threads   JPEG 2000 decoder threads (default 1)\n"
+          "  -f json|csv  output format (default json, one line each)\n"
+          "  -b name      only benchmarks whose name contains name\n"
+          "  -d dir       where the test files are written (default a "
+          "temporary directory)\n"
+          "  -k           keep the test files\n"
+          "  -v           print JPEG 2000 decoder statistics to stderr\n");
+}
+
+static bool parse_options(int argc, char **argv, options &opt) {
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "-n" && hasValue) {
+      opt.repetitions = std::max(1, atoi(argv[++i]));
+    } else if (arg == "-s" && hasValue) {
+      opt.size = std::max(16, atoi(argv[++i]));
+    } else if (arg == "-t" && hasValue) {
+      opt.threads = std::max(1, atoi(argv[++i]));
+    } else if (arg == "-f" && hasValue) {
+      const std::string value = argv[++i];
+      if (value == "json")
+        opt.format = output_format::json;
+      else if (value == "csv")
+        opt.format = output_format::csv;
+      else
+        return false;
+    } else if (arg == "-b" && hasValue) {
+      opt.filter = argv[++i];
+    } else if (arg == "-d" && hasValue) {
+      opt.directory = argv[++i];
+    } else if (arg == "-k") {
+      opt.keep = true;
+    } else if (arg == "-v") {
+      opt.verbose = true;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  options opt;
+  if (!parse_options(argc, argv, opt)) {
+    usage();
+    return 2;
+  }
+  if (opt.directory.empty()) {
+    char directory[] = "/tmp/pdv_bench.XXXXXX";
+    if (!mkdtemp(directory)) {
+      fprintf(stderr, "cannot create a temporary directory\n");
+      return 1;
+    }
+    opt.directory = directory;
+  } else {
+    mkdir(opt.directory.c_str(), 0755);
+  }
+  // one decoder thread by default, so that results do not depend on the
+  // load of the machine
+  setDecoderThreads(opt.threads);
+
+  const std::string explicitLE = "1.2.840.10008.1.2.1";
+  const std::string j2kLossless = "1.2.840.10008.1.2.4.90";
+  std::vector<sample_file> files(6);
+  const bool written =
+      write_file(opt, "native_u8", explicitLE, 8, 1, false, false,
+                 files[0]) &&
+      write_file(opt, "native_u16", explicitLE, 12, 1, false, false,
+                 files[1]) &&
+      write_file(opt, "native_u16_16_frames", explicitLE, 12, 16, false,
+                 false, files[2]) &&
+      write_file(opt, "j2k", j2kLossless, 12, 1, true, true, files[3]) &&
+      write_file(opt, "j2k_8_frames_offsets", j2kLossless, 12, 8, true, true,
+                 files[4]) &&
+      write_file(opt, "j2k_8_frames_no_offsets", j2kLossless, 12, 8, true,
+                 false, files[5]);
+  if (!written)
+    return 1;
+
+  if (opt.format == output_format::json)
+    printf("{\"size\":%d,\"repetitions\":%d,\"decoder_threads\":%u,"
+           "\"hardware_threads\":%u,\"simd\":\"%s\"}\n",
+           opt.size, opt.repetitions, opt.threads, hardwareThreads(),
+           simdLevel());
+  else
+    printf("name,repetitions,min_ms,median_ms,mean_ms,stddev_ms,mb_per_s\n");
+
+  for (const sample_file &file : files) {
+    bench_parse(opt, file);
+  }
+  for (const sample_file &file : files) {
+    bench_frames(opt, file);
+  }
+  bench_decode(opt, files[3]);
+  const bool tiledArea = bench_tiled_area(opt);
+  bench_display(opt);
+  if (opt.verbose) {
+    print_decoder_stats("JPEG 2000", decoderStats(false));
+    print_decoder_stats("HTJ2K", decoderStats(true));
+  }
+
+  if (!opt.keep) {
+    for (const sample_file &file : files) {
+      unlink(file.path.c_str());
+    }
+    rmdir(opt.directory.c_str());
+  }
+  return tiledArea ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+#include "cine.h"
+
+#include "dicomhelpers.h"
+#include "framecache.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <utility>
+
+// when the dataset does not say
+static const double default_interval = 1.0 / 30;
+static const uint64_t no_sequence = ~0ull;
+
+CinePlayer::CinePlayer(const DcmDataSet *dataset, const DcmDataSet *meta,
+                       FrameSource &frames, int width, int height,
+                       size_t ring)
+    : mDataSet(dataset), mMeta(meta), mFrames(frames),
+      mCount(std::max<uint32_t>(frames.count(), 1)), mWidth(width),
+      mHeight(height), mSopUid(getString(dataset, 0x00080018)),
+      mReduction(wantedReduction(getNumber(dataset, 0x00280011),
+                                 getNumber(dataset, 0x00280010), width,
+                                 height)),
+      mInterval(frameInterval(dataset)),
+      mStart(std::chrono::steady_clock::now()),
+      mRing(std::max<size_t>(ring, 1)), mBase(0), mNext(0), mDecodeTime(0.0),
+      mStop(false) {
+  for (slot &s : mRing) {
+    s.sequence = no_sequence;
+    s.ready = false;
+  }
+  const unsigned int workers =
+      std::min<size_t>(hardwareThreads(), mRing.size());
+  mCodecThreads = std::max(1u, decoderThreads() / workers);
+  for (unsigned int i = 0; i < workers; i++) {
+    mWorkers.emplace_back(&CinePlayer::work, this);
+  }
+}
+
+CinePlayer::~CinePlayer() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStop = true;
+  }
+  mWake.notify_all();
+  for (std::thread &worker : mWorkers) {
+    worker.join();
+  }
+}
+
+double CinePlayer::frameInterval(const DcmDataSet *dataset) {
+  // Frame Time is in ms
+  const std::vector<std::string> frameTime = getStrings(dataset, 0x00181063);
+  if (!frameTime.empty() && atof(frameTime.front().c_str()) > 0)
+    return atof(frameTime.front().c_str()) / 1000.0;
+  const int64_t cineRate = getNumber(dataset, 0x00180040, 0);
+  if (cineRate > 0)
+    return 1.0 / cineRate;
+  const int64_t displayRate = getNumber(dataset, 0x00082144, 0);
+  if (displayRate > 0)
+    return 1.0 / displayRate;
+  return default_interval;
+}
+
+double CinePlayer::elapsed() const {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       mStart)
+      .count();
+}
+
+uint64_t CinePlayer::due() const {
+  return static_cast<uint64_t>(elapsed() / mInterval);
+}
+
+bool CinePlayer::take(uint64_t sequence, decoded_frame &frame) {
+  std::unique_lock<std::mutex> lock(mMutex);
+  // frames that were not taken in time are given up
+  while (mBase < sequence) {
+    slot &s = mRing[mBase % mRing.size()];
+    if (s.sequence == mBase) {
+      s.sequence = no_sequence;
+      s.ready = false;
+      s.frame = decoded_frame();
+    }
+    mStats.dropped++;
+    mBase++;
+  }
+  mNext = std::max(mNext, mBase);
+  slot &s = mRing[sequence % mRing.size()];
+  if (sequence < mBase || s.sequence != sequence || !s.ready)
+    return false;
+  frame = std::move(s.frame);
+  s.sequence = no_sequence;
+  s.ready = false;
+  mBase = sequence + 1;
+  mNext = std::max(mNext, mBase);
+  mStats.shown++;
+  lock.unlock();
+  mWake.notify_all();
+  return true;
+}
+
+cine_stats CinePlayer::stats() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  cine_stats stats = mStats;
+  const double seconds = elapsed();
+  stats.fps = seconds > 0 ? stats.shown / seconds : 0.0;
+  return stats;
+}
+
+void CinePlayer::work() {
+  setThreadDecoderThreads(mCodecThreads);
+  for (;;) {
+    uint64_t sequence = 0;
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mWake.wait(lock, [this] {
+        return mStop || mNext < mBase + mRing.size();
+      });
+      if (mStop)
+        return;
+      // when decoding cannot keep up, start with a frame that is not due
+      // before it is done rather than one that is late anyway
+      const uint64_t ready =
+          due() + static_cast<uint64_t>(mDecodeTime / mInterval + 1);
+      mNext = std::max(mNext, std::min(ready, mBase + mRing.size() - 1));
+      sequence = mNext++;
+      slot &s = mRing[sequence % mRing.size()];
+      s.sequence = sequence;
+      s.ready = false;
+      s.frame = decoded_frame();
+    }
+
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    // looping playback decodes every frame once while the cache holds them
+    decoded_frame decoded;
+    if (!frameCache().find(mFrames.file(), mSopUid, index(sequence),
+                           mReduction, decoded.image)) {
+      Frame frame;
+      {
+        std::lock_guard<std::mutex> lock(mReadMutex);
+        frame = mFrames.frame(index(sequence));
+      }
+      decoded = decodeFrame(mDataSet, mMeta, std::move(frame), mCount, mWidth,
+                            mHeight);
+      if (!decoded.image.pixels.empty())
+        frameCache().insert(mFrames.file(), mSopUid, index(sequence),
+                            decoded.image);
+    }
+
+    const double seconds = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mDecodeTime = mDecodeTime == 0.0 ? seconds
+                                     : 0.8 * mDecodeTime + 0.2 * seconds;
+    // the slot is reused if the frame came too late
+    slot &s = mRing[sequence % mRing.size()];
+    if (s.sequence == sequence) {
+      s.frame = std::move(decoded);
+      s.ready = true;
+    }
+  }
+}
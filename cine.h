@@ -0,0 +1,99 @@
+#ifndef CINE_H
+#define CINE_H
+
+extern "C" {
+#include <dicom/dicom.h>
+}
+
+#include "framesource.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct cine_stats {
+  // frames handed to the display
+  uint64_t shown{0};
+  // frames whose time passed before they were decoded
+  uint64_t dropped{0};
+  // shown frames per second since playback started
+  double fps{0.0};
+};
+
+// Plays the frames of a FrameSource in a loop. Worker threads decode ahead
+// into a bounded ring, the ui takes the frame that is due with take().
+// Frames are numbered by an ever increasing sequence, frame sequence % count
+// is shown. The FrameSource has to outlive the player and must not be used
+// by anyone else while it plays.
+class CinePlayer {
+public:
+  // see decodeFrame() for width and height
+  CinePlayer(const DcmDataSet *dataset, const DcmDataSet *meta,
+             FrameSource &frames, int width, int height, size_t ring = 8);
+  CinePlayer(const CinePlayer &) = delete;
+  CinePlayer &operator=(const CinePlayer &) = delete;
+  CinePlayer(CinePlayer &&) = delete;
+  CinePlayer &operator=(CinePlayer &&) = delete;
+  ~CinePlayer();
+
+public:
+  // seconds between frames from Frame Time (0018,1063), Cine Rate
+  // (0018,0040) or Recommended Display Frame Rate (0008,2144)
+  static double frameInterval(const DcmDataSet *dataset);
+
+  // sequence of the frame due at the current time
+  uint64_t due() const;
+  // hands out frame sequence if it is decoded, frames before it that were
+  // not taken count as dropped
+  bool take(uint64_t sequence, decoded_frame &frame);
+  uint32_t index(uint64_t sequence) const { return sequence % mCount; }
+  double interval() const { return mInterval; }
+  cine_stats stats() const;
+
+private:
+  struct slot {
+    uint64_t sequence;
+    bool ready;
+    decoded_frame frame;
+  };
+
+  void work();
+  double elapsed() const;
+
+private:
+  const DcmDataSet *mDataSet;
+  const DcmDataSet *mMeta;
+  FrameSource &mFrames;
+  const uint32_t mCount;
+  const int mWidth;
+  const int mHeight;
+  // frames are looked up in frameCache() by these
+  const std::string mSopUid;
+  const int mReduction;
+  const double mInterval;
+  std::chrono::steady_clock::time_point mStart;
+
+  mutable std::mutex mMutex;
+  std::condition_variable mWake;
+  // slot of sequence s is s % size
+  std::vector<slot> mRing;
+  // oldest sequence still wanted
+  uint64_t mBase;
+  // next sequence to decode
+  uint64_t mNext;
+  // moving average of the seconds a frame takes to read and decode
+  double mDecodeTime;
+  cine_stats mStats;
+  bool mStop;
+  // frames are read one at a time, decoded in parallel
+  std::mutex mReadMutex;
+  // decoder threads of each worker, together they use decoderThreads()
+  unsigned int mCodecThreads;
+  std::vector<std::thread> mWorkers;
+};
+
+#endif // CINE_H
@@ -0,0 +1,209 @@
+#include "clahe.h"
+#include "display.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+// tile histograms are at most this fine, 12 bits cover CT
+static const uint32_t max_bins = 4096;
+// fixed point of the interpolation weights
+static const int weight_bits = 8;
+static const int weight_one = 1 << weight_bits;
+// fixed point of the clip limit
+static const int clip_bits = 8;
+
+namespace {
+// the two tiles a row or column of pixels blends, weight is the share of
+// the second one
+struct blend {
+  int first;
+  int second;
+  int weight;
+};
+} // namespace
+
+// the sample with its sign bit flipped, so that unsigned order is kept
+template <typename T> static uint32_t table_index(T value) {
+  typedef typename std::make_unsigned<T>::type U;
+  const U flip = std::is_signed<T>::value ? U(1) << (sizeof(T) * 8 - 1) : 0;
+  return static_cast<U>(value ^ flip);
+}
+
+// spreads the table indices low..high of the image evenly over the bins
+struct bin_map {
+  uint32_t low;
+  // bins / range in 32 bit fixed point
+  uint64_t scale;
+
+  uint32_t operator()(uint32_t index) const {
+    return static_cast<uint32_t>((index - low) * scale >> 32);
+  }
+};
+
+// Tile centres are at (i + 0.5) * size, pixels before the first and after
+// the last centre only use that tile.
+static std::vector<blend> blends(int length, int tiles, int size) {
+  std::vector<blend> result(length);
+  for (int p = 0; p < length; p++) {
+    // in half pixels from the first centre
+    const int offset = 2 * p + 1 - size;
+    const int tile = offset > 0 ? offset / (2 * size) : 0;
+    blend &b = result[p];
+    if (offset <= 0 || tile >= tiles - 1) {
+      b.first = offset <= 0 ? 0 : tiles - 1;
+      b.second = b.first;
+      b.weight = 0;
+    } else {
+      b.first = tile;
+      b.second = tile + 1;
+      b.weight = (offset % (2 * size) * weight_one + size) / (2 * size);
+    }
+  }
+  return result;
+}
+
+// clipped histogram of a tile and its cumulative distribution as 8 bit map
+static void tile_map(uint32_t *hist, uint32_t bins, uint32_t pixels,
+                     uint32_t clip, bool invert, uint8_t *map) {
+  if (clip > 0) {
+    const uint32_t limit = std::max<uint32_t>(
+        1, static_cast<uint32_t>(static_cast<uint64_t>(clip) * pixels /
+                                 bins >> clip_bits));
+    uint32_t excess = 0;
+    for (uint32_t b = 0; b < bins; b++) {
+      if (hist[b] > limit) {
+        excess += hist[b] - limit;
+        hist[b] = limit;
+      }
+    }
+    const uint32_t add = excess / bins;
+    uint32_t rest = excess % bins;
+    for (uint32_t b = 0; b < bins; b++) {
+      hist[b] += add;
+    }
+    if (rest > 0) {
+      const uint32_t step = bins / rest;
+      for (uint32_t b = 0; rest > 0; b += step, rest--) {
+        hist[b]++;
+      }
+    }
+  }
+  uint64_t cdf = 0;
+  for (uint32_t b = 0; b < bins; b++) {
+    cdf += hist[b];
+    const uint8_t value = static_cast<uint8_t>(cdf * 255 / pixels);
+    map[b] = invert ? 255 - value : value;
+  }
+}
+
+template <typename T>
+static void clahe(const image_data &image, const clahe_options &options,
+                  uint8_t *out) {
+  const int width = image.width;
+  const int height = image.height;
+  const size_t count = static_cast<size_t>(width) * height;
+  const T *in = image.pixels.samples<T>();
+  if (count == 0)
+    return;
+
+  // the range of the samples is spread over the bins
+  uint32_t low = table_index(in[0]);
+  uint32_t high = low;
+  for (size_t i = 1; i < count; i++) {
+    low = std::min(low, table_index(in[i]));
+    high = std::max(high, table_index(in[i]));
+  }
+  const uint64_t range = static_cast<uint64_t>(high) - low + 1;
+  const uint32_t bins =
+      static_cast<uint32_t>(std::min<uint64_t>(range, max_bins));
+  const bin_map binOf = {low, (static_cast<uint64_t>(bins) << 32) / range};
+  // a limit of bins times the mean never clips anything
+  const double clipLimit =
+      std::min(std::max(options.clipLimit, 0.0), static_cast<double>(bins));
+  const uint32_t clip =
+      static_cast<uint32_t>(clipLimit * (1 << clip_bits) + 0.5);
+
+  // the last tiles may be smaller, never empty
+  const int tileWidth =
+      (width + std::max(options.tilesX, 1) - 1) / std::max(options.tilesX, 1);
+  const int tileHeight =
+      (height + std::max(options.tilesY, 1) - 1) / std::max(options.tilesY, 1);
+  const int tilesX = (width + tileWidth - 1) / tileWidth;
+  const int tilesY = (height + tileHeight - 1) / tileHeight;
+
+  std::vector<uint8_t> maps(static_cast<size_t>(tilesX) * tilesY * bins);
+  parallelFor(tilesX * tilesY, options.threads, [&](size_t begin, size_t end) {
+    std::vector<uint32_t> hist(bins);
+    for (size_t t = begin; t < end; t++) {
+      const int x0 = t % tilesX * tileWidth;
+      const int y0 = t / tilesX * tileHeight;
+      const int x1 = std::min(x0 + tileWidth, width);
+      const int y1 = std::min(y0 + tileHeight, height);
+      std::fill(hist.begin(), hist.end(), 0);
+      for (int y = y0; y < y1; y++) {
+        const T *row = in + static_cast<size_t>(y) * width;
+        for (int x = x0; x < x1; x++) {
+          hist[binOf(table_index(row[x]))]++;
+        }
+      }
+      tile_map(hist.data(), bins, (x1 - x0) * (y1 - y0), clip, image.invert,
+               maps.data() + t * bins);
+    }
+  });
+
+  // every pixel blends the maps of the four nearest tile centres
+  const std::vector<blend> columns = blends(width, tilesX, tileWidth);
+  const std::vector<blend> rows = blends(height, tilesY, tileHeight);
+  parallelFor(height, options.threads, [&](size_t begin, size_t end) {
+    for (size_t y = begin; y < end; y++) {
+      const blend &by = rows[y];
+      const uint8_t *top = maps.data() + by.first * tilesX * bins;
+      const uint8_t *bottom = maps.data() + by.second * tilesX * bins;
+      const T *row = in + y * width;
+      uint8_t *dst = out + y * width;
+      for (int x = 0; x < width; x++) {
+        const blend &bx = columns[x];
+        const uint32_t b = binOf(table_index(row[x]));
+        const uint32_t left = bx.first * bins + b;
+        const uint32_t right = bx.second * bins + b;
+        const uint32_t upper = top[left] * (weight_one - bx.weight) +
+                               top[right] * bx.weight;
+        const uint32_t lower = bottom[left] * (weight_one - bx.weight) +
+                               bottom[right] * bx.weight;
+        dst[x] = (upper * (weight_one - by.weight) + lower * by.weight +
+                  (1u << (2 * weight_bits - 1))) >>
+                 (2 * weight_bits);
+      }
+    }
+  });
+}
+
+bool claheToDisplay(const image_data &image, const clahe_options &options,
+                    uint8_t *out) {
+  if (displayComponents(image) != 1)
+    return false;
+  switch (image.pixels.format()) {
+  case sample_format::u8:
+    clahe<uint8_t>(image, options, out);
+    break;
+  case sample_format::s8:
+    clahe<int8_t>(image, options, out);
+    break;
+  case sample_format::u16:
+    clahe<uint16_t>(image, options, out);
+    break;
+  case sample_format::s16:
+    clahe<int16_t>(image, options, out);
+    break;
+  case sample_format::u32:
+    clahe<uint32_t>(image, options, out);
+    break;
+  case sample_format::s32:
+    clahe<int32_t>(image, options, out);
+    break;
+  }
+  return true;
+}
@@ -0,0 +1,26 @@
+#ifndef CLAHE_H
+#define CLAHE_H
+
+#include "compression.h"
+
+#include <cstdint>
+
+// contrast limited adaptive histogram equalization (Zuiderveld, Graphics
+// Gems IV): every tile of the image is equalized on its own with a clipped
+// histogram, pixels blend the mappings of the four nearest tiles
+struct clahe_options {
+  // tiles across and down
+  int tilesX{8};
+  int tilesY{8};
+  // no bin of a tile histogram holds more than clipLimit times the mean
+  // count, the excess is spread over all bins; 0 turns clipping off
+  double clipLimit{2.0};
+  // 0 uses every hardware thread
+  unsigned int threads{0};
+};
+
+// grey images only, out holds width * height bytes
+bool claheToDisplay(const image_data &image, const clahe_options &options,
+                    uint8_t *out);
+
+#endif // CLAHE_H
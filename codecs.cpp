@@ -0,0 +1,565 @@
+#include "codecs.h"
+#include "kernels.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+static const size_t rle_header = 64;
+static const uint32_t rle_max_segments = 15;
+// code lengths up to this many bits are decoded by a single lookup
+static const int huffman_lookup_bits = 9;
+
+namespace {
+struct huffman_table {
+  bool defined{false};
+  // value | length << 8 of the codes up to huffman_lookup_bits long, 0 for
+  // longer codes
+  uint16_t lookup[1 << huffman_lookup_bits];
+  int32_t maxcode[18];
+  int32_t mincode[17];
+  int32_t valptr[17];
+  uint8_t values[256];
+};
+
+// entropy coded data with the stuffed zero bytes removed, reads zeros once a
+// marker is reached
+struct bit_reader {
+  const unsigned char *data;
+  size_t size;
+  size_t pos;
+  // next bits in the most significant end
+  uint64_t bits;
+  int count;
+  bool marker;
+
+  void fill() {
+    while (count <= 56) {
+      unsigned int byte = 0;
+      if (!marker && pos < size) {
+        byte = data[pos];
+        if (byte != 0xFF) {
+          pos++;
+        } else if (pos + 1 < size && data[pos + 1] == 0x00) {
+          pos += 2;
+        } else {
+          marker = true;
+          byte = 0;
+        }
+      }
+      bits |= static_cast<uint64_t>(byte) << (56 - count);
+      count += 8;
+    }
+  }
+  uint32_t peek(int n) const { return static_cast<uint32_t>(bits >> (64 - n)); }
+  void consume(int n) {
+    bits <<= n;
+    count -= n;
+  }
+  // drops the buffered bits and skips the next RSTn marker
+  void restart() {
+    bits = 0;
+    count = 0;
+    marker = false;
+    while (pos + 1 < size && !(data[pos] == 0xFF && data[pos + 1] >= 0xD0 &&
+                               data[pos + 1] <= 0xD7))
+      pos++;
+    pos = std::min(pos + 2, size);
+  }
+};
+
+struct scan {
+  int count;
+  int component[4];
+  const huffman_table *table[4];
+  int predictor;
+  int pointTransform;
+};
+} // namespace
+
+static std::mutex registry_mutex;
+
+static uint32_t little_endian32(const char *p) {
+  const unsigned char *b = reinterpret_cast<const unsigned char *>(p);
+  return b[0] | b[1] << 8 | b[2] << 16 | static_cast<uint32_t>(b[3]) << 24;
+}
+
+static uint32_t big_endian16(const unsigned char *p) {
+  return p[0] << 8 | p[1];
+}
+
+// PackBits of one byte plane, every step-th byte of dst is written
+static bool unpack_segment(const char *src, size_t size, char *dst,
+                           size_t count, size_t step) {
+  size_t in = 0;
+  size_t out = 0;
+  while (out < count && in < size) {
+    const int header = static_cast<signed char>(src[in++]);
+    if (header >= 0) {
+      const size_t run =
+          std::min<size_t>({static_cast<size_t>(header) + 1, count - out,
+                            size - in});
+      if (step == 1) {
+        memcpy(dst + out, src + in, run);
+      } else {
+        for (size_t i = 0; i < run; i++) {
+          dst[(out + i) * step] = src[in + i];
+        }
+      }
+      in += header + 1;
+      out += run;
+    } else if (header != -128) {
+      if (in >= size)
+        break;
+      const size_t run = std::min<size_t>(1 - header, count - out);
+      const char value = src[in++];
+      if (step == 1) {
+        memset(dst + out, value, run);
+      } else {
+        for (size_t i = 0; i < run; i++) {
+          dst[(out + i) * step] = value;
+        }
+      }
+      out += run;
+    }
+  }
+  for (; out < count; out++) {
+    dst[out * step] = 0;
+  }
+  return in <= size && out == count;
+}
+
+image_data decodeRLE(const pixel_layout &layout, const char *buf,
+                     size_t size) {
+  const int bytes = layout.bitsAllocated / 8;
+  if (layout.bitsAllocated != 8 && layout.bitsAllocated != 16 &&
+      layout.bitsAllocated != 32) {
+    fprintf(stderr, "unsupported bits allocated %d\n", layout.bitsAllocated);
+    return {};
+  }
+  if (size < rle_header) {
+    fprintf(stderr, "RLE header is too short\n");
+    return {};
+  }
+  const uint32_t segments = little_endian32(buf);
+  if (segments > rle_max_segments ||
+      segments != static_cast<uint32_t>(layout.components * bytes)) {
+    fprintf(stderr, "RLE frame has %u segments\n", segments);
+    return {};
+  }
+
+  const size_t pixels = static_cast<size_t>(layout.rows) * layout.columns;
+  // segments are byte planes of the components, most significant first.
+  // 16 bit planes are unpacked into two contiguous planes and merged with
+  // SIMD, the others straight into the little endian samples.
+  PixelBuffer pixelBuffer(formatFor(layout.bitsAllocated, layout.sgnd),
+                          pixels, layout.components, /*planar*/ true);
+  char *dst = static_cast<char *>(pixelBuffer.data());
+  // kept per thread, so frame after frame does not fault in new pages
+  thread_local std::vector<char> planes;
+  if (bytes == 2 && planes.size() < 2 * pixels)
+    planes.resize(2 * pixels);
+  for (uint32_t s = 0; s < segments; s++) {
+    const size_t begin = little_endian32(buf + 4 + 4 * s);
+    const size_t end =
+        s + 1 < segments ? little_endian32(buf + 8 + 4 * s) : size;
+    if (begin < rle_header || begin > end || end > size) {
+      fprintf(stderr, "RLE segment %u is out of the frame\n", s);
+      return {};
+    }
+    const int component = s / bytes;
+    const int byte = bytes - 1 - s % bytes;
+    char *plane = bytes == 2 ? planes.data() + byte * pixels
+                             : dst + component * pixels * bytes + byte;
+    const size_t step = bytes == 2 ? 1 : bytes;
+    if (!unpack_segment(buf + begin, end - begin, plane, pixels, step))
+      fprintf(stderr, "RLE segment %u is too short\n", s);
+    if (bytes == 2 && byte == 0)
+      mergeBytes16(reinterpret_cast<const uint8_t *>(planes.data()),
+                   reinterpret_cast<const uint8_t *>(planes.data() + pixels),
+                   pixels, pixelBuffer.component<uint16_t>(component));
+  }
+
+  image_data image;
+  image.components = layout.components;
+  image.width = layout.columns;
+  image.height = layout.rows;
+  image.bpp = layout.bitsAllocated;
+  image.pixels = pixelBuffer;
+  return image;
+}
+
+static bool build_table(const unsigned char *counts,
+                        const unsigned char *values, size_t total,
+                        huffman_table &table) {
+  if (total > sizeof(table.values))
+    return false;
+  memcpy(table.values, values, total);
+  memset(table.lookup, 0, sizeof(table.lookup));
+  int32_t code = 0;
+  int32_t k = 0;
+  for (int length = 1; length <= 16; length++) {
+    const int n = counts[length - 1];
+    table.valptr[length] = k;
+    table.mincode[length] = code;
+    table.maxcode[length] = n ? code + n - 1 : -1;
+    for (int i = 0; i < n; i++, code++, k++) {
+      if (length > huffman_lookup_bits)
+        continue;
+      const int shift = huffman_lookup_bits - length;
+      for (int fill = 0; fill < 1 << shift; fill++) {
+        table.lookup[code << shift | fill] =
+            static_cast<uint16_t>(length << 8 | table.values[k]);
+      }
+    }
+    code <<= 1;
+  }
+  table.maxcode[17] = INT_MAX;
+  table.defined = true;
+  return k == static_cast<int32_t>(total);
+}
+
+static int decode_symbol(bit_reader &reader, const huffman_table &table) {
+  const uint16_t entry = table.lookup[reader.peek(huffman_lookup_bits)];
+  if (entry) {
+    reader.consume(entry >> 8);
+    return entry & 0xFF;
+  }
+  for (int length = huffman_lookup_bits + 1; length <= 16; length++) {
+    const int32_t code = reader.peek(length);
+    if (code <= table.maxcode[length]) {
+      reader.consume(length);
+      return table.values[table.valptr[length] + code - table.mincode[length]];
+    }
+  }
+  return -1;
+}
+
+// returns the position after the entropy coded data, 0 on failure
+template <typename T>
+static size_t decode_scan(const unsigned char *data, size_t size, size_t pos,
+                          const scan &sc, T *out, int width, int height,
+                          int components, int precision,
+                          unsigned int restartInterval) {
+  bit_reader reader{data, size, pos, 0, 0, false};
+  const int pt = sc.pointTransform;
+  const int32_t initial = 1 << (precision - pt - 1);
+  const size_t stride = static_cast<size_t>(width) * components;
+  unsigned int mcus = 0;
+  // the first line of the image or of a restart interval is predicted from
+  // the left only, its first sample from initial
+  int firstRow = 0;
+  int firstColumn = 0;
+  for (int y = 0; y < height; y++) {
+    T *row = out + y * stride;
+    const T *above = row - stride;
+    for (int x = 0; x < width; x++) {
+      if (restartInterval && mcus == restartInterval) {
+        reader.restart();
+        mcus = 0;
+        firstRow = y;
+        firstColumn = x;
+      }
+      mcus++;
+      for (int j = 0; j < sc.count; j++) {
+        const int c = sc.component[j];
+        // a code and its difference take at most 32 bits
+        if (reader.count < 32)
+          reader.fill();
+        const int ssss = decode_symbol(reader, *sc.table[j]);
+        if (ssss < 0 || ssss > 16) {
+          fprintf(stderr, "corrupt lossless JPEG data at row %d\n", y);
+          return 0;
+        }
+        int32_t diff = 0;
+        if (ssss == 16) {
+          diff = 32768;
+        } else if (ssss > 0) {
+          const int32_t v = reader.peek(ssss);
+          reader.consume(ssss);
+          diff = v < 1 << (ssss - 1) ? v - (1 << ssss) + 1 : v;
+        }
+
+        T *sample = row + x * components + c;
+        int32_t predicted;
+        if (y == firstRow && x == firstColumn) {
+          predicted = initial;
+        } else if (y == firstRow) {
+          predicted = sample[-components] >> pt;
+        } else if (x == 0) {
+          predicted = above[c] >> pt;
+        } else {
+          const int32_t ra = sample[-components] >> pt;
+          const int32_t rb = above[x * components + c] >> pt;
+          const int32_t rc = above[(x - 1) * components + c] >> pt;
+          switch (sc.predictor) {
+          case 1:
+            predicted = ra;
+            break;
+          case 2:
+            predicted = rb;
+            break;
+          case 3:
+            predicted = rc;
+            break;
+          case 4:
+            predicted = ra + rb - rc;
+            break;
+          case 5:
+            predicted = ra + ((rb - rc) >> 1);
+            break;
+          case 6:
+            predicted = rb + ((ra - rc) >> 1);
+            break;
+          default:
+            predicted = (ra + rb) >> 1;
+            break;
+          }
+        }
+        // modulo 2^16
+        *sample = static_cast<T>(((predicted + diff) & 0xFFFF) << pt);
+      }
+    }
+  }
+  return reader.marker ? reader.pos : size;
+}
+
+template <typename T>
+static void sign_extend(PixelBuffer &pixels, int precision) {
+  const int shift = static_cast<int>(sizeof(T) * 8) - precision;
+  T *samples = pixels.samples<T>();
+  const size_t count = pixels.pixels() * pixels.components();
+  for (size_t i = 0; i < count; i++) {
+    // shifted unsigned, so that 32 bit samples do not overflow
+    samples[i] = static_cast<T>(static_cast<uint32_t>(samples[i]) << shift) >>
+                 shift;
+  }
+}
+
+image_data decodeJPEGLossless(const pixel_layout &layout, const char *buf,
+                              size_t size) {
+  const unsigned char *data = reinterpret_cast<const unsigned char *>(buf);
+  if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+    fprintf(stderr, "not a JPEG stream\n");
+    return {};
+  }
+  huffman_table tables[4];
+  std::vector<int> ids;
+  int precision = 0;
+  int width = 0;
+  int height = 0;
+  unsigned int restartInterval = 0;
+  bool scanned = false;
+  PixelBuffer pixels;
+
+  size_t pos = 2;
+  while (pos + 1 < size) {
+    if (data[pos] != 0xFF) {
+      pos++;
+      continue;
+    }
+    const unsigned char marker = data[pos + 1];
+    pos += 2;
+    if (marker == 0xFF) {
+      // fill byte
+      pos--;
+      continue;
+    }
+    if (marker == 0xD9)
+      break;
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+      continue;
+    if (pos + 2 > size || pos + big_endian16(data + pos) > size) {
+      fprintf(stderr, "JPEG marker segment is out of the frame\n");
+      return {};
+    }
+    const size_t length = big_endian16(data + pos);
+    const unsigned char *segment = data + pos + 2;
+    const size_t segmentLength = length >= 2 ? length - 2 : 0;
+    pos += length;
+
+    if (marker == 0xC3) {
+      if (segmentLength < 6 || segmentLength < 6 + 3u * segment[5]) {
+        fprintf(stderr, "JPEG frame header is too short\n");
+        return {};
+      }
+      precision = segment[0];
+      height = big_endian16(segment + 1);
+      width = big_endian16(segment + 3);
+      const int count = segment[5];
+      for (int c = 0; c < count; c++) {
+        ids.push_back(segment[6 + 3 * c]);
+        if (segment[7 + 3 * c] != 0x11) {
+          fprintf(stderr, "subsampled lossless JPEG is not supported\n");
+          return {};
+        }
+      }
+      if (precision < 2 || precision > 16 ||
+          precision > layout.bitsAllocated || width != layout.columns ||
+          height != layout.rows || count != layout.components) {
+        fprintf(stderr, "JPEG frame header does not match the dataset\n");
+        return {};
+      }
+      pixels = PixelBuffer(formatFor(layout.bitsAllocated, layout.sgnd),
+                           static_cast<size_t>(width) * height, count);
+      memset(pixels.data(), 0, pixels.bytes());
+    } else if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+               marker != 0xC8 && marker != 0xCC) {
+      fprintf(stderr, "only lossless Huffman JPEG (Process 14) is supported\n");
+      return {};
+    } else if (marker == 0xC4) {
+      size_t i = 0;
+      while (i + 17 <= segmentLength) {
+        const int index = segment[i] & 0x03;
+        const unsigned char *counts = segment + i + 1;
+        size_t total = 0;
+        for (int l = 0; l < 16; l++) {
+          total += counts[l];
+        }
+        if (i + 17 + total > segmentLength ||
+            !build_table(counts, segment + i + 17, total, tables[index])) {
+          fprintf(stderr, "corrupt JPEG Huffman table\n");
+          return {};
+        }
+        i += 17 + total;
+      }
+    } else if (marker == 0xDD) {
+      if (segmentLength >= 2)
+        restartInterval = big_endian16(segment);
+    } else if (marker == 0xDA) {
+      if (pixels.empty() || segmentLength < 1 ||
+          segmentLength < 4 + 2u * segment[0] || segment[0] > 4) {
+        fprintf(stderr, "JPEG scan without frame\n");
+        return {};
+      }
+      scan sc;
+      sc.count = segment[0];
+      for (int j = 0; j < sc.count; j++) {
+        auto it = std::find(ids.begin(), ids.end(), segment[1 + 2 * j]);
+        const huffman_table &table = tables[(segment[2 + 2 * j] >> 4) & 0x03];
+        if (it == ids.end() || !table.defined) {
+          fprintf(stderr, "JPEG scan of an unknown component\n");
+          return {};
+        }
+        sc.component[j] = it - ids.begin();
+        sc.table[j] = &table;
+      }
+      sc.predictor = segment[1 + 2 * sc.count];
+      sc.pointTransform = segment[3 + 2 * sc.count] & 0x0F;
+      if (sc.predictor < 1 || sc.predictor > 7 ||
+          sc.pointTransform >= precision) {
+        fprintf(stderr, "unsupported lossless JPEG scan\n");
+        return {};
+      }
+      // at most 16 bits of precision, also in 32 bit samples
+      switch (pixels.format()) {
+      case sample_format::u8:
+      case sample_format::s8:
+        pos = decode_scan(data, size, pos, sc, pixels.samples<uint8_t>(),
+                          width, height, ids.size(), precision,
+                          restartInterval);
+        break;
+      case sample_format::u16:
+      case sample_format::s16:
+        pos = decode_scan(data, size, pos, sc, pixels.samples<uint16_t>(),
+                          width, height, ids.size(), precision,
+                          restartInterval);
+        break;
+      case sample_format::u32:
+      case sample_format::s32:
+        pos = decode_scan(data, size, pos, sc, pixels.samples<uint32_t>(),
+                          width, height, ids.size(), precision,
+                          restartInterval);
+        break;
+      }
+      if (pos == 0)
+        return {};
+      scanned = true;
+    }
+  }
+  if (!scanned) {
+    fprintf(stderr, "JPEG stream without scan\n");
+    return {};
+  }
+  if (layout.sgnd && precision < layout.bitsAllocated) {
+    if (pixels.format() == sample_format::s8)
+      sign_extend<int8_t>(pixels, precision);
+    else if (pixels.format() == sample_format::s16)
+      sign_extend<int16_t>(pixels, precision);
+    else if (pixels.format() == sample_format::s32)
+      sign_extend<int32_t>(pixels, precision);
+  }
+
+  image_data image;
+  image.components = ids.size();
+  image.width = width;
+  image.height = height;
+  image.bpp = precision;
+  image.pixels = pixels;
+  return image;
+}
+
+static std::map<std::string, codec> &registry() {
+  static std::map<std::string, codec> codecs = [] {
+    std::map<std::string, codec> builtin;
+    codec jpeg2000;
+    jpeg2000.name = "JPEG 2000";
+    jpeg2000.decode = [](const pixel_layout &, const char *buf, size_t size,
+                         int width, int height) {
+      return decompressOpenJPEG(buf, size, width, height);
+    };
+    jpeg2000.stream = [](const char *buf, size_t size, int width,
+                         int height) {
+      return decompressOpenJPEGTiled(buf, size, width, height);
+    };
+    jpeg2000.area = [](const pixel_layout &, const char *buf, size_t size,
+                       image_area &area, int width, int height) {
+      return decompressOpenJPEGArea(buf, size, area, width, height);
+    };
+    builtin["1.2.840.10008.1.2.4.90"] = jpeg2000;
+    builtin["1.2.840.10008.1.2.4.91"] = jpeg2000;
+    jpeg2000.name = "HTJ2K";
+    builtin["1.2.840.10008.1.2.4.201"] = jpeg2000;
+    builtin["1.2.840.10008.1.2.4.202"] = jpeg2000;
+    builtin["1.2.840.10008.1.2.4.203"] = jpeg2000;
+
+    codec rle;
+    rle.name = "RLE Lossless";
+    rle.decode = [](const pixel_layout &layout, const char *buf, size_t size,
+                    int, int) { return decodeRLE(layout, buf, size); };
+    builtin["1.2.840.10008.1.2.5"] = rle;
+
+    codec lossless;
+    lossless.name = "JPEG Lossless";
+    lossless.decode = [](const pixel_layout &layout, const char *buf,
+                         size_t size, int, int) {
+      return decodeJPEGLossless(layout, buf, size);
+    };
+    builtin["1.2.840.10008.1.2.4.57"] = lossless;
+    lossless.name = "JPEG Lossless SV1";
+    builtin["1.2.840.10008.1.2.4.70"] = lossless;
+    return builtin;
+  }();
+  return codecs;
+}
+
+void registerCodec(const std::string &transferSyntax, codec c) {
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  registry()[transferSyntax] = std::move(c);
+}
+
+bool findCodec(const std::string &transferSyntax, codec &c) {
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  const std::map<std::string, codec> &codecs = registry();
+  auto it = codecs.find(transferSyntax);
+  if (it == codecs.end())
+    return false;
+  c = it->second;
+  return true;
+}
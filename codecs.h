@@ -0,0 +1,57 @@
+#ifndef CODECS_H
+#define CODECS_H
+
+#include "compression.h"
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+// what the dataset says about the samples of a frame
+struct pixel_layout {
+  int rows{};
+  int columns{};
+  int components{};
+  int bitsAllocated{};
+  int bitsStored{};
+  int highBit{};
+  bool sgnd{};
+  bool planar{};
+  bool monochrome1{};
+  colour_space colour{colour_space::rgb};
+};
+
+// Decoders of the frames of an encapsulated transfer syntax. decode returns
+// the samples in their native width (see formatFor()), width and height are
+// the size of the display as for decompressOpenJPEG(), codecs without
+// resolution levels decode at full resolution. stream is optional, it
+// decodes frames too large to hold at full precision to display samples.
+// area is optional too, it decodes a part of a frame like
+// decompressOpenJPEGArea().
+struct codec {
+  std::string name;
+  std::function<image_data(const pixel_layout &layout, const char *buf,
+                           size_t size, int width, int height)>
+      decode;
+  std::function<display_data(const char *buf, size_t size, int width,
+                             int height)>
+      stream;
+  std::function<image_data(const pixel_layout &layout, const char *buf,
+                           size_t size, image_area &area, int width,
+                           int height)>
+      area;
+};
+
+// replaces the codec of the transfer syntax, the built-in ones are JPEG 2000,
+// HTJ2K, RLE Lossless and JPEG Lossless (Process 14)
+void registerCodec(const std::string &transferSyntax, codec c);
+// false if no codec decodes the transfer syntax
+bool findCodec(const std::string &transferSyntax, codec &c);
+
+// PS3.5 Annex G
+image_data decodeRLE(const pixel_layout &layout, const char *buf, size_t size);
+// lossless Huffman coded JPEG (ITU T.81 Process 14), any predictor
+image_data decodeJPEGLossless(const pixel_layout &layout, const char *buf,
+                              size_t size);
+
+#endif // CODECS_H
@@ -1,20 +1,105 @@
 #include "compression.h"
+#include "threadpool.h"
 
 #include <openjpeg-2.5/openjpeg.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <vector>
 
+// 0 means hardware concurrency
+static std::atomic<unsigned int> decoder_threads(0);
+// 0 means no cap, see setThreadDecoderThreads()
+static thread_local unsigned int thread_decoder_threads = 0;
+// [0] classic, [1] high throughput codestreams
+static std::mutex stats_mutex;
+static decoder_stats stats[2];
+
 struct read_pointer {
   const char *buf;
   size_t size;
   size_t cur;
 };
 
+namespace {
+struct stream_deleter {
+  void operator()(opj_stream_t *stream) const { opj_stream_destroy(stream); }
+};
+struct codec_deleter {
+  void operator()(opj_codec_t *codec) const { opj_destroy_codec(codec); }
+};
+struct image_deleter {
+  void operator()(opj_image_t *image) const { opj_image_destroy(image); }
+};
+typedef std::unique_ptr<opj_stream_t, stream_deleter> stream_ptr;
+typedef std::unique_ptr<opj_codec_t, codec_deleter> codec_ptr;
+typedef std::unique_ptr<opj_image_t, image_deleter> image_ptr;
+
+// What a decoding thread keeps from one codestream to the next. OpenJPEG
+// cannot reset a codec for another codestream, so the codec and the stream
+// are created per codestream, but the parameters and the scratch memory are
+// set up once.
+struct decoder_context {
+  decoder_context() {
+    memset(&params, 0, sizeof(params));
+    opj_set_default_decoder_parameters(&params);
+  }
+
+  opj_dparameters_t params;
+  read_pointer state;
+  // a decoded tile of decompressOpenJPEGTiled()
+  std::vector<OPJ_BYTE> tile;
+};
+
+// a codestream with its header read, released in reverse order
+struct open_codestream {
+  stream_ptr stream;
+  codec_ptr codec;
+  image_ptr image;
+};
+} // namespace
+
+// the first box of a JP2 file, a raw codestream starts with SOC and SIZ
+static const unsigned char jp2_signature[12] = {
+    0x00, 0x00, 0x00, 0x0C, 0x6A, 0x50, 0x20, 0x20, 0x0D, 0x0A, 0x87, 0x0A};
+static const unsigned char j2k_signature[4] = {0xFF, 0x4F, 0xFF, 0x51};
+// the default chunk of OpenJPEG's file streams
+static const size_t stream_chunk = 1 << 20;
+static const uint16_t cap_marker = 0xFF50;
+static const uint16_t sot_marker = 0xFF90;
+// Pcap bit of Part 15
+static const uint32_t part15_capability = 0x00020000;
+
+decoder_context &context();
+bool detect_format(const char *buf, size_t size, OPJ_CODEC_FORMAT &format);
 opj_stream_t *setup_stream(read_pointer &state);
-opj_codec_t *setup_codec(OPJ_CODEC_FORMAT format, opj_dparameters_t &params);
+opj_codec_t *setup_codec(OPJ_CODEC_FORMAT format, opj_dparameters_t &params,
+                         int threads);
+bool read_header(const char *buf, size_t size, int threads,
+                 open_codestream &cs);
+uint32_t big_endian(const char *p, int bytes);
+bool high_throughput(const char *buf, size_t size);
+void add_stats(const char *buf, size_t size, uint64_t samples,
+               std::chrono::steady_clock::time_point start);
+image_data decompress(const char *buf, size_t size, int threads, int width,
+                      int height, image_area *area);
+PixelBuffer to_pixels(const opj_image_t *image);
+template <typename T>
+void copy_planes(const opj_image_t *image, PixelBuffer &pixels);
+template <typename T>
+void tile_to_display(const OPJ_BYTE *src, OPJ_UINT32 width, OPJ_UINT32 height,
+                     const opj_image_comp_t &comp, unsigned char *dst,
+                     size_t stride, int step);
+OPJ_UINT32 resolution_factor(opj_codec_t *codec, OPJ_UINT32 full_width,
+                             OPJ_UINT32 full_height, int width, int height);
+OPJ_UINT32 ceildivpow2(OPJ_UINT32 value, OPJ_UINT32 pow);
 
 void msg(const char *msg, void *client_data);
 OPJ_SIZE_T read(void *p_buffer, OPJ_SIZE_T p_nb_bytes, void *p_user_data);
@@ -24,9 +109,32 @@ OPJ_OFF_T skip(OPJ_OFF_T p_nb_bytes, void *p_user_data);
 void dump_img(opj_image_t *image, const char *fname);
 void dump_tile(OPJ_BYTE *data, OPJ_UINT32 size, const char *fname);
 
+decoder_context &context() {
+  thread_local decoder_context ctx;
+  return ctx;
+}
+
+bool detect_format(const char *buf, size_t size, OPJ_CODEC_FORMAT &format) {
+  if (size >= sizeof(j2k_signature) &&
+      memcmp(buf, j2k_signature, sizeof(j2k_signature)) == 0) {
+    format = OPJ_CODEC_J2K;
+    return true;
+  }
+  if (size >= sizeof(jp2_signature) &&
+      memcmp(buf, jp2_signature, sizeof(jp2_signature)) == 0) {
+    format = OPJ_CODEC_JP2;
+    return true;
+  }
+  return false;
+}
+
 opj_stream_t *setup_stream(read_pointer &state) {
-  opj_stream_t *stream =
-      opj_stream_create(state.size, /*input stream*/ OPJ_TRUE);
+  // the stream buffers what it reads, it needs no copy of the whole
+  // codestream
+  opj_stream_t *stream = opj_stream_create(std::min(state.size, stream_chunk),
+                                           /*input stream*/ OPJ_TRUE);
+  if (!stream)
+    return nullptr;
   opj_stream_set_read_function(stream, read);
   opj_stream_set_seek_function(stream, seek);
   opj_stream_set_skip_function(stream, skip);
@@ -36,37 +144,35 @@ opj_stream_t *setup_stream(read_pointer &state) {
   return stream;
 }
 
-opj_codec_t *setup_codec(OPJ_CODEC_FORMAT format, opj_dparameters_t &params) {
-  memset(&params, 0, sizeof(opj_dparameters_t));
-  opj_set_default_decoder_parameters(&params);
-  opj_codec_t *codec = opj_create_decompress(format);
+opj_codec_t *setup_codec(OPJ_CODEC_FORMAT format, opj_dparameters_t &params,
+                         int threads) {
+  codec_ptr codec(opj_create_decompress(format));
   if (!codec) {
     fprintf(stderr, "codec failure\n");
     return nullptr;
   }
-  opj_set_error_handler(codec, msg, nullptr);
-  opj_set_warning_handler(codec, msg, nullptr);
-  if (opj_setup_decoder(codec, &params) != OPJ_TRUE) {
+  opj_set_error_handler(codec.get(), msg, nullptr);
+  opj_set_warning_handler(codec.get(), msg, nullptr);
+  if (opj_setup_decoder(codec.get(), &params) != OPJ_TRUE) {
     fprintf(stderr, "decoder failure\n");
     return nullptr;
   }
-  if (opj_codec_set_threads(codec, 1) != OPJ_TRUE) {
+  // a single thread decodes on the calling thread instead of a pool
+  if (opj_codec_set_threads(codec.get(), threads > 1 ? threads : 0) !=
+      OPJ_TRUE) {
     fprintf(stderr, "thread failure\n");
     return nullptr;
   }
-  return codec;
+  return codec.release();
 }
 
 void msg(const char *msg, void * /*unused*/) { fprintf(stderr, "%s \n", msg); }
 
 OPJ_SIZE_T read(void *p_buffer, OPJ_SIZE_T p_nb_bytes, void *p_user_data) {
-  fprintf(stderr, "requesting %lu bytes\n", p_nb_bytes);
-
   read_pointer *state = reinterpret_cast<read_pointer *>(p_user_data);
   p_nb_bytes =
       std::min(p_nb_bytes, static_cast<OPJ_SIZE_T>(state->size - state->cur));
   if (p_nb_bytes > 0) {
-    fprintf(stderr, "delivering %lu bytes\n", p_nb_bytes);
     std::copy(state->buf + state->cur, state->buf + state->cur + p_nb_bytes,
               reinterpret_cast<unsigned char *>(p_buffer));
     state->cur = state->cur + p_nb_bytes;
@@ -76,24 +182,24 @@ OPJ_SIZE_T read(void *p_buffer, OPJ_SIZE_T p_nb_bytes, void *p_user_data) {
 }
 
 OPJ_BOOL seek(OPJ_OFF_T p_nb_bytes, void *p_user_data) {
-  fprintf(stderr, "seek to %li\n", p_nb_bytes);
   read_pointer *state = reinterpret_cast<read_pointer *>(p_user_data);
-  if ((0 <= p_nb_bytes) && (p_nb_bytes < state->size)) {
+  if (0 <= p_nb_bytes && static_cast<size_t>(p_nb_bytes) <= state->size) {
     state->cur = p_nb_bytes;
     return OPJ_TRUE;
   }
   return OPJ_FALSE;
 }
 
+// OpenJPEG loops until the bytes returned add up to what it asked for, so
+// this returns what was actually skipped, -1 at the end of the codestream
 OPJ_OFF_T skip(OPJ_OFF_T p_nb_bytes, void *p_user_data) {
-  fprintf(stderr, "skip %li\n", p_nb_bytes);
   read_pointer *state = reinterpret_cast<read_pointer *>(p_user_data);
-  if ((0 <= state->cur + p_nb_bytes) &&
-      (state->cur + p_nb_bytes < state->size)) {
-    state->cur += p_nb_bytes;
-    return OPJ_TRUE;
-  }
-  return OPJ_FALSE;
+  const OPJ_OFF_T left = static_cast<OPJ_OFF_T>(state->size - state->cur);
+  if (p_nb_bytes < 0 || left <= 0)
+    return -1;
+  const OPJ_OFF_T skipped = std::min(p_nb_bytes, left);
+  state->cur += skipped;
+  return skipped;
 }
 
 void dump_img(opj_image_t *image, const char *fname) {
@@ -114,37 +220,267 @@ void dump_tile(OPJ_BYTE *data, OPJ_UINT32 size, const char *fname) {
   fclose(fout);
 }
 
-image_data decompressOpenJPEG(const std::vector<char> &buf) {
+unsigned int decoderThreads() {
+  const unsigned int global = decoder_threads;
+  const unsigned int threads = global == 0 ? hardwareThreads() : global;
+  if (thread_decoder_threads == 0)
+    return threads;
+  return std::min(threads, thread_decoder_threads);
+}
 
-  read_pointer state;
-  state.buf = buf.data();
-  state.cur = 0;
-  state.size = buf.size();
-  opj_stream_t *stream = setup_stream(state);
-  opj_dparameters_t params;
-  opj_codec_t *codec = setup_codec(OPJ_CODEC_J2K, params);
-  if (!codec) {
-    return {};
+void setDecoderThreads(unsigned int threads) { decoder_threads = threads; }
+
+void setThreadDecoderThreads(unsigned int threads) {
+  thread_decoder_threads = threads;
+}
+
+OPJ_UINT32 resolution_factor(opj_codec_t *codec, OPJ_UINT32 full_width,
+                             OPJ_UINT32 full_height, int width, int height) {
+  if (width <= 0 || height <= 0)
+    return 0;
+  opj_codestream_info_v2_t *info = opj_get_cstr_info(codec);
+  if (!info)
+    return 0;
+  // every component has to support the reduction
+  OPJ_UINT32 resolutions = OPJ_J2K_MAXRLVLS;
+  for (OPJ_UINT32 i = 0; i < info->nbcomps; i++) {
+    resolutions = std::min(
+        resolutions, info->m_default_tile_info.tccp_info[i].numresolutions);
+  }
+  opj_destroy_cstr_info(&info);
+
+  OPJ_UINT32 factor = 0;
+  while (factor + 1 < resolutions) {
+    const OPJ_UINT32 next = factor + 1;
+    const OPJ_UINT32 reduced_width = (full_width + (1u << next) - 1) >> next;
+    const OPJ_UINT32 reduced_height = (full_height + (1u << next) - 1) >> next;
+    if (reduced_width < static_cast<OPJ_UINT32>(width) ||
+        reduced_height < static_cast<OPJ_UINT32>(height))
+      break;
+    factor = next;
   }
+  return factor;
+}
+
+image_data decompressOpenJPEG(const char *buf, size_t size, int width,
+                              int height) {
+  return decompress(buf, size, decoderThreads(), width, height, nullptr);
+}
+
+image_data decompressOpenJPEGArea(const char *buf, size_t size,
+                                  image_area &area, int width, int height) {
+  return decompress(buf, size, decoderThreads(), width, height, &area);
+}
+
+std::vector<image_data> decompressOpenJPEG(const std::vector<codestream> &bufs,
+                                           int width, int height) {
+  static ThreadPool pool(hardwareThreads());
+  std::vector<image_data> images(bufs.size());
+  if (bufs.empty())
+    return images;
+
+  // fewer frames than threads: the rest of the threads go to the codecs
+  const unsigned int threads = decoderThreads();
+  const unsigned int workers =
+      std::min(threads, static_cast<unsigned int>(bufs.size()));
+  const int codecThreads = std::max(1u, threads / workers);
+  std::vector<std::future<void>> results;
+  for (unsigned int worker = 0; worker < workers; worker++) {
+    results.push_back(pool.submit([&bufs, &images, worker, workers,
+                                   codecThreads, width, height]() {
+      for (size_t i = worker; i < bufs.size(); i += workers) {
+        images[i] = decompress(bufs[i].buf, bufs[i].size, codecThreads, width,
+                               height, nullptr);
+      }
+    }));
+  }
+  for (auto &result : results) {
+    result.get();
+  }
+  return images;
+}
+
+bool read_header(const char *buf, size_t size, int threads,
+                 open_codestream &cs) {
+  OPJ_CODEC_FORMAT format = OPJ_CODEC_UNKNOWN;
+  if (!detect_format(buf, size, format)) {
+    fprintf(stderr, "neither a JPEG 2000 codestream nor a JP2 file\n");
+    return false;
+  }
+  decoder_context &ctx = context();
+  ctx.state.buf = buf;
+  ctx.state.cur = 0;
+  ctx.state.size = size;
+  cs.stream.reset(setup_stream(ctx.state));
+  cs.codec.reset(setup_codec(format, ctx.params, threads));
+  if (!cs.stream || !cs.codec)
+    return false;
   opj_image_t *image = nullptr;
-  if (opj_read_header(stream, codec, &image) != OPJ_TRUE) {
-    fprintf(stderr, "read failure with current codec\n");
-    opj_stream_destroy(stream);
-    opj_destroy_codec(codec);
-    stream = nullptr;
-    codec = nullptr;
-    image = nullptr;
-    state.buf = buf.data();
-    state.cur = 0;
-    state.size = buf.size();
-    stream = setup_stream(state);
-    codec = setup_codec(OPJ_CODEC_JP2, params);
-    if (opj_read_header(stream, codec, &image) != OPJ_TRUE) {
-      fprintf(stderr, "read failure with current codec, no more tries\n");
+  const bool read =
+      opj_read_header(cs.stream.get(), cs.codec.get(), &image) == OPJ_TRUE;
+  cs.image.reset(image);
+  if (!read) {
+    fprintf(stderr, "read header failure\n");
+    return false;
+  }
+  return true;
+}
+
+uint32_t big_endian(const char *p, int bytes) {
+  uint32_t value = 0;
+  for (int i = 0; i < bytes; i++) {
+    value = value << 8 | static_cast<unsigned char>(p[i]);
+  }
+  return value;
+}
+
+// looks for a CAP marker with the Part 15 capability in the main header
+bool high_throughput(const char *buf, size_t size) {
+  OPJ_CODEC_FORMAT format = OPJ_CODEC_UNKNOWN;
+  if (!detect_format(buf, size, format))
+    return false;
+  size_t pos = 0;
+  if (format == OPJ_CODEC_JP2) {
+    // the codestream is the content of the jp2c box
+    while (pos + 8 <= size && memcmp(buf + pos + 4, "jp2c", 4) != 0) {
+      const uint64_t length = big_endian(buf + pos, 4);
+      if (length < 8)
+        return false;
+      pos += length;
+    }
+    pos += 8;
+  }
+  // after SOC
+  pos += 2;
+  while (pos + 4 <= size) {
+    const uint32_t marker = big_endian(buf + pos, 2);
+    const uint32_t length = big_endian(buf + pos + 2, 2);
+    if (marker == sot_marker || length < 2)
+      return false;
+    if (marker == cap_marker && length >= 6 && pos + 8 <= size)
+      return (big_endian(buf + pos + 4, 4) & part15_capability) != 0;
+    pos += 2 + length;
+  }
+  return false;
+}
+
+void add_stats(const char *buf, size_t size, uint64_t samples,
+               std::chrono::steady_clock::time_point start) {
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  const bool ht = high_throughput(buf, size);
+  std::lock_guard<std::mutex> lock(stats_mutex);
+  decoder_stats &s = stats[ht ? 1 : 0];
+  s.codestreams++;
+  s.bytes += size;
+  s.samples += samples;
+  s.seconds += seconds;
+}
+
+jpeg2000_kind jpeg2000Kind(const std::string &transferSyntax) {
+  if (transferSyntax == "1.2.840.10008.1.2.4.90" ||
+      transferSyntax == "1.2.840.10008.1.2.4.91")
+    return jpeg2000_kind::classic;
+  if (transferSyntax == "1.2.840.10008.1.2.4.201" ||
+      transferSyntax == "1.2.840.10008.1.2.4.202" ||
+      transferSyntax == "1.2.840.10008.1.2.4.203")
+    return jpeg2000_kind::high_throughput;
+  return jpeg2000_kind::none;
+}
+
+decoder_stats decoderStats(bool highThroughput) {
+  std::lock_guard<std::mutex> lock(stats_mutex);
+  return stats[highThroughput ? 1 : 0];
+}
+
+template <typename T>
+void copy_planes(const opj_image_t *image, PixelBuffer &pixels) {
+  for (OPJ_UINT32 c = 0; c < image->numcomps; c++) {
+    const OPJ_INT32 *data = image->comps[c].data;
+    std::copy(data, data + pixels.pixels(), pixels.component<T>(c));
+  }
+}
+
+// the decoder delivers 32 bit planes, keep only the width that is needed
+PixelBuffer to_pixels(const opj_image_t *image) {
+  const sample_format format =
+      formatFor(image->comps[0].prec, image->comps[0].sgnd != 0);
+  PixelBuffer pixels(format,
+                     static_cast<size_t>(image->comps[0].w) *
+                         image->comps[0].h,
+                     image->numcomps, /*planar*/ true);
+  switch (format) {
+  case sample_format::u8:
+    copy_planes<uint8_t>(image, pixels);
+    break;
+  case sample_format::s8:
+    copy_planes<int8_t>(image, pixels);
+    break;
+  case sample_format::u16:
+    copy_planes<uint16_t>(image, pixels);
+    break;
+  case sample_format::s16:
+    copy_planes<int16_t>(image, pixels);
+    break;
+  case sample_format::u32:
+    copy_planes<uint32_t>(image, pixels);
+    break;
+  case sample_format::s32:
+    copy_planes<int32_t>(image, pixels);
+    break;
+  }
+  return pixels;
+}
+
+image_data decompress(const char *buf, size_t size, int threads, int width,
+                      int height, image_area *area) {
+  const std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  open_codestream cs;
+  if (!read_header(buf, size, threads, cs))
+    return {};
+  opj_codec_t *codec = cs.codec.get();
+  opj_stream_t *stream = cs.stream.get();
+  opj_image_t *image = cs.image.get();
+  const int full_width = image->x1 - image->x0;
+  const int full_height = image->y1 - image->y0;
+  if (area) {
+    area->x0 = std::max(area->x0, 0);
+    area->y0 = std::max(area->y0, 0);
+    area->x1 = std::min(area->x1, full_width);
+    area->y1 = std::min(area->y1, full_height);
+    if (area->x1 <= area->x0 || area->y1 <= area->y0) {
+      fprintf(stderr, "area outside of the image\n");
       return {};
     }
   }
-  if (opj_set_decode_area(codec, image, 0, 0, 0, 0) != OPJ_TRUE) {
+  const OPJ_UINT32 factor = resolution_factor(
+      codec, area ? area->x1 - area->x0 : full_width,
+      area ? area->y1 - area->y0 : full_height, width, height);
+  if (factor > 0 &&
+      opj_set_decoded_resolution_factor(codec, factor) != OPJ_TRUE) {
+    fprintf(stderr, "resolution factor failure\n");
+    return {};
+  }
+  OPJ_INT32 x0 = 0;
+  OPJ_INT32 y0 = 0;
+  OPJ_INT32 x1 = 0;
+  OPJ_INT32 y1 = 0;
+  if (area) {
+    // whole pixels of the reduced resolution, so that the caller knows
+    // where the decoded samples are
+    const int unit = 1 << factor;
+    area->x0 = area->x0 / unit * unit;
+    area->y0 = area->y0 / unit * unit;
+    area->x1 = std::min((area->x1 + unit - 1) / unit * unit, full_width);
+    area->y1 = std::min((area->y1 + unit - 1) / unit * unit, full_height);
+    x0 = image->x0 + area->x0;
+    y0 = image->y0 + area->y0;
+    x1 = image->x0 + area->x1;
+    y1 = image->y0 + area->y1;
+  }
+  if (opj_set_decode_area(codec, image, x0, y0, x1, y1) != OPJ_TRUE) {
     fprintf(stderr, "area failure\n");
     return {};
   }
@@ -153,44 +489,164 @@ image_data decompressOpenJPEG(const std::vector<char> &buf) {
     return {};
   }
 
-  fprintf(stderr, "comps %d, color %d\n", image->numcomps, image->color_space);
   if (opj_end_decompress(codec, stream) != OPJ_TRUE) {
     fprintf(stderr, "end failure\n");
     return {};
   }
   image_data img;
-
-  switch (image->numcomps) {
-  case 1: {
-    const unsigned int size = image->comps[0].w * image->comps[0].h;
-    img.width = image->comps[0].w;
-    img.height = image->comps[0].h;
-    img.bpp = image->comps[0].prec;
-    img.component0.resize(size);
-    std::copy(image->comps[0].data, image->comps[0].data + size,
-              img.component0.data());
-  } break;
-  case 3: {
-    int size = image->comps[0].w * image->comps[0].h;
-    img.width = image->comps[0].w;
-    img.height = image->comps[0].h;
-    img.bpp = image->comps[0].prec;
-    img.component0.resize(size);
-    img.component1.resize(size);
-    img.component2.resize(size);
-    std::copy(image->comps[0].data, image->comps[0].data + size,
-              img.component0.data());
-    std::copy(image->comps[1].data, image->comps[1].data + size,
-              img.component1.data());
-    std::copy(image->comps[2].data, image->comps[2].data + size,
-              img.component2.data());
-  } break;
-  default:
+  if (image->numcomps != 1 && image->numcomps != 3) {
     return {};
   }
+  for (OPJ_UINT32 c = 1; c < image->numcomps; c++) {
+    if (image->comps[c].w != image->comps[0].w ||
+        image->comps[c].h != image->comps[0].h) {
+      fprintf(stderr, "subsampled components are not supported\n");
+      return {};
+    }
+  }
+  img.width = image->comps[0].w;
+  img.height = image->comps[0].h;
+  img.bpp = image->comps[0].prec;
+  img.pixels = to_pixels(image);
   img.components = image->numcomps;
-  opj_stream_destroy(stream);
-  opj_destroy_codec(codec);
-  opj_image_destroy(image);
+  img.reduction = factor;
+  add_stats(buf, size, img.pixels.pixels() * img.components, start);
+  return img;
+}
+
+OPJ_UINT32 ceildivpow2(OPJ_UINT32 value, OPJ_UINT32 pow) {
+  return static_cast<OPJ_UINT32>(
+      (static_cast<OPJ_UINT64>(value) + (1u << pow) - 1) >> pow);
+}
+
+template <typename T>
+void tile_to_display(const OPJ_BYTE *src, OPJ_UINT32 width, OPJ_UINT32 height,
+                     const opj_image_comp_t &comp, unsigned char *dst,
+                     size_t stride, int step) {
+  // linear mapping of the whole sample range, a histogram would need the
+  // whole image
+  // 64 bit, so 32 bit samples and their offset cannot overflow
+  const int shift = static_cast<int>(comp.prec) - 8;
+  const int64_t offset =
+      comp.sgnd ? static_cast<int64_t>(1u << (comp.prec - 1)) : 0;
+  const T *samples = reinterpret_cast<const T *>(src);
+  for (OPJ_UINT32 y = 0; y < height; y++) {
+    unsigned char *out = dst + y * stride;
+    for (OPJ_UINT32 x = 0; x < width; x++) {
+      int64_t value = static_cast<int64_t>(*samples++) + offset;
+      value = shift >= 0 ? value >> shift : value * (1 << -shift);
+      *out = static_cast<unsigned char>(
+          std::min<int64_t>(std::max<int64_t>(value, 0), 255));
+      out += step;
+    }
+  }
+}
+
+display_data decompressOpenJPEGTiled(const char *buf, size_t size, int width,
+                                     int height) {
+  const std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  open_codestream cs;
+  if (!read_header(buf, size, decoderThreads(), cs))
+    return {};
+  opj_codec_t *codec = cs.codec.get();
+  opj_stream_t *stream = cs.stream.get();
+  const opj_image_t *image = cs.image.get();
+
+  const OPJ_UINT32 numcomps = image->numcomps;
+  if (numcomps != 1 && numcomps != 3) {
+    return {};
+  }
+  for (OPJ_UINT32 c = 0; c < numcomps; c++) {
+    if (image->comps[c].dx != 1 || image->comps[c].dy != 1 ||
+        image->comps[c].prec > 32) {
+      fprintf(stderr, "subsampled components are not supported\n");
+      return {};
+    }
+  }
+  const OPJ_UINT32 factor =
+      resolution_factor(codec, image->x1 - image->x0, image->y1 - image->y0,
+                        width, height);
+  if (factor > 0 &&
+      opj_set_decoded_resolution_factor(codec, factor) != OPJ_TRUE) {
+    fprintf(stderr, "resolution factor failure\n");
+    return {};
+  }
+
+  const OPJ_UINT32 x0 = ceildivpow2(image->x0, factor);
+  const OPJ_UINT32 y0 = ceildivpow2(image->y0, factor);
+  display_data img;
+  img.components = numcomps;
+  img.width = ceildivpow2(image->x1, factor) - x0;
+  img.height = ceildivpow2(image->y1, factor) - y0;
+  img.reduction = factor;
+  const size_t stride = static_cast<size_t>(img.width) * numcomps;
+  img.pixels.reset(new unsigned char[stride * img.height]);
+
+  // only one decoded tile at a time is held in its native sample size
+  std::vector<OPJ_BYTE> &tile = context().tile;
+  OPJ_BOOL go_on = OPJ_TRUE;
+  while (go_on) {
+    OPJ_UINT32 tile_index = 0;
+    OPJ_UINT32 data_size = 0;
+    OPJ_INT32 tx0 = 0, ty0 = 0, tx1 = 0, ty1 = 0;
+    OPJ_UINT32 tile_comps = 0;
+    if (opj_read_tile_header(codec, stream, &tile_index, &data_size, &tx0,
+                             &ty0, &tx1, &ty1, &tile_comps,
+                             &go_on) != OPJ_TRUE) {
+      fprintf(stderr, "tile header failure\n");
+      return {};
+    }
+    if (!go_on)
+      break;
+    tile.resize(data_size);
+    if (opj_decode_tile_data(codec, tile_index, tile.data(), data_size,
+                             stream) != OPJ_TRUE) {
+      fprintf(stderr, "tile %u decode failure\n", tile_index);
+      return {};
+    }
+
+    const OPJ_UINT32 left = ceildivpow2(tx0, factor);
+    const OPJ_UINT32 top = ceildivpow2(ty0, factor);
+    const OPJ_UINT32 tile_width = ceildivpow2(tx1, factor) - left;
+    const OPJ_UINT32 tile_height = ceildivpow2(ty1, factor) - top;
+    unsigned char *dst =
+        img.pixels.get() + (top - y0) * stride + (left - x0) * numcomps;
+    const OPJ_BYTE *src = tile.data();
+    for (OPJ_UINT32 c = 0; c < numcomps; c++) {
+      const opj_image_comp_t &comp = image->comps[c];
+      const size_t samples = static_cast<size_t>(tile_width) * tile_height;
+      if (comp.prec <= 8) {
+        if (comp.sgnd)
+          tile_to_display<OPJ_INT8>(src, tile_width, tile_height, comp,
+                                    dst + c, stride, numcomps);
+        else
+          tile_to_display<OPJ_UINT8>(src, tile_width, tile_height, comp,
+                                     dst + c, stride, numcomps);
+        src += samples;
+      } else if (comp.prec <= 16) {
+        if (comp.sgnd)
+          tile_to_display<OPJ_INT16>(src, tile_width, tile_height, comp,
+                                     dst + c, stride, numcomps);
+        else
+          tile_to_display<OPJ_UINT16>(src, tile_width, tile_height, comp,
+                                      dst + c, stride, numcomps);
+        src += samples * 2;
+      } else {
+        if (comp.sgnd)
+          tile_to_display<OPJ_INT32>(src, tile_width, tile_height, comp,
+                                     dst + c, stride, numcomps);
+        else
+          tile_to_display<OPJ_UINT32>(src, tile_width, tile_height, comp,
+                                      dst + c, stride, numcomps);
+        src += samples * 4;
+      }
+    }
+  }
+
+  if (opj_end_decompress(codec, stream) != OPJ_TRUE) {
+    fprintf(stderr, "end failure\n");
+  }
+  add_stats(buf, size, stride * img.height, start);
   return img;
 }
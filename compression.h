@@ -1,19 +1,107 @@
 #ifndef COMPRESSION_H
 #define COMPRESSION_H
 
+#include "pixelbuffer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
 
+// of 3 component images (PS3.3 C.7.6.3.1.2), decoders of JPEG 2000 undo
+// YBR_ICT and YBR_RCT themselves
+enum class colour_space { rgb, ybr_full, ybr_full_422 };
+
 struct image_data {
   int components{};
   int width{};
   int height{};
   int bpp{};
+  // number of wavelet resolution levels discarded, 0 is full resolution
+  int reduction{};
+  // modality lut: stored value * slope + intercept
+  double slope{1.0};
+  double intercept{0.0};
+  // MONOCHROME1, the lowest value is displayed white
+  bool invert{};
+  // YBR_FULL_422 pixels keep 2 samples: Y Y Cb Cr for every pair of pixels
+  colour_space colour{colour_space::rgb};
+
+  PixelBuffer pixels;
+};
+
+// a rectangle of a frame in full resolution pixels, x1 and y1 excluded
+struct image_area {
+  int x0{};
+  int y0{};
+  int x1{};
+  int y1{};
+};
+
+// 8 bit samples ready to be displayed, grey or interleaved rgb
+struct display_data {
+  int components{};
+  int width{};
+  int height{};
+  int reduction{};
 
-  std::vector<int> component0;
-  std::vector<int> component1;
-  std::vector<int> component2;
+  std::unique_ptr<unsigned char[]> pixels;
 };
 
-image_data decompressOpenJPEG(const std::vector<char> &buf);
+enum class jpeg2000_kind { none, classic, high_throughput };
+
+// JPEG 2000 Image Compression (1.2.840.10008.1.2.4.90/91) is classic,
+// High-Throughput JPEG 2000 (1.2.840.10008.1.2.4.201/202/203) uses the block
+// coder of Part 15. OpenJPEG decodes both.
+jpeg2000_kind jpeg2000Kind(const std::string &transferSyntax);
+
+// time spent in the JPEG 2000 decoder
+struct decoder_stats {
+  uint64_t codestreams{0};
+  // compressed
+  uint64_t bytes{0};
+  // decoded, at the decoded resolution
+  uint64_t samples{0};
+  double seconds{0.0};
+};
+
+// totals since start of the codestreams with (high throughput) and without
+// the Part 15 capability in their CAP marker
+decoder_stats decoderStats(bool highThroughput);
+
+struct codestream {
+  const char *buf;
+  size_t size;
+};
+
+// number of threads used for decoding, defaults to the hardware concurrency
+unsigned int decoderThreads();
+void setDecoderThreads(unsigned int threads);
+// caps decoderThreads() on the calling thread, for threads that decode in
+// parallel with others; 0 removes the cap
+void setThreadDecoderThreads(unsigned int threads);
+
+// width and height are the size of the area the image is displayed in, the
+// smallest resolution level still covering it is decoded. 0 means full
+// resolution.
+
+// the decoder threads work on the tiles/codeblocks of this single codestream
+image_data decompressOpenJPEG(const char *buf, size_t size, int width = 0,
+                              int height = 0);
+// decodes the codestreams (e.g. frames of a multi-frame object) in parallel,
+// the decoder threads are shared between the frames
+std::vector<image_data> decompressOpenJPEG(const std::vector<codestream> &bufs,
+                                           int width = 0, int height = 0);
+// decodes only the area (opj_set_decode_area()), at the smallest resolution
+// level at which the area still covers width x height; area is widened to
+// whole pixels of that level and clipped to the image
+image_data decompressOpenJPEGArea(const char *buf, size_t size,
+                                  image_area &area, int width = 0,
+                                  int height = 0);
+// for images too large to hold at full precision: decodes tile by tile and
+// converts every tile to display samples right away
+display_data decompressOpenJPEGTiled(const char *buf, size_t size,
+                                     int width = 0, int height = 0);
 
 #endif // COMPRESSION_H
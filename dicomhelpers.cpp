@@ -4,7 +4,6 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <list>
 #include <string>
 #include <vector>
 
@@ -59,6 +58,26 @@ std::string getString(const DcmDataSet *dataset, uint32_t tag) {
   return std::string(value);
 }
 
+std::vector<std::string> getStrings(const DcmDataSet *dataset, uint32_t tag) {
+  if (!dcm_dataset_contains(dataset, tag))
+    return {};
+  DcmError *error = nullptr;
+  DcmElement *element = dcm_dataset_get(&error, dataset, tag);
+  if (!element)
+    return {};
+  std::vector<std::string> values;
+  const uint32_t vm = dcm_element_get_vm(element);
+  for (uint32_t i = 0; i < vm; i++) {
+    const char *value = nullptr;
+    if (!dcm_element_get_value_string(&error, element, i, &value)) {
+      printf("%s\n", dcm_error_get_message(error));
+      break;
+    }
+    values.push_back(value);
+  }
+  return values;
+}
+
 int64_t getNumber(const DcmDataSet *dataset, uint32_t tag) {
   DcmError *error = nullptr;
   DcmElement *element = dcm_dataset_get(&error, dataset, tag);
@@ -74,6 +93,12 @@ int64_t getNumber(const DcmDataSet *dataset, uint32_t tag) {
   return value;
 }
 
+int64_t getNumber(const DcmDataSet *dataset, uint32_t tag, int64_t fallback) {
+  if (!dcm_dataset_contains(dataset, tag))
+    return fallback;
+  return getNumber(dataset, tag);
+}
+
 uint32_t readLength(DcmIO *io, uint32_t tag) {
   DcmError *error = nullptr;
   switch (tag) {
@@ -316,57 +341,133 @@ DcmSequence *readSequence(DcmIO *io, uint32_t tag, bool explicitVR) {
   return seq;
 }
 
-std::list<std::vector<char>> getFrames(DcmDataSet *dataset,
-                                       const DcmDataSet *meta, DcmIO *io,
-                                       DcmFilehandle *filehandle,
-                                       std::string &msg) {
+// explicit VRs with 2 reserved bytes and a 4 byte length
+static bool long_length(DcmVR vr) {
+  switch (vr) {
+  case DCM_VR_OB:
+  case DCM_VR_OD:
+  case DCM_VR_OF:
+  case DCM_VR_OL:
+  case DCM_VR_OV:
+  case DCM_VR_OW:
+  case DCM_VR_SQ:
+  case DCM_VR_SV:
+  case DCM_VR_UC:
+  case DCM_VR_UN:
+  case DCM_VR_UR:
+  case DCM_VR_UT:
+  case DCM_VR_UV:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool read_bytes(DcmIO *io, void *buf, int64_t length) {
   DcmError *error = nullptr;
-  dcm_error_clear(&error);
-
-  if (dcm_filehandle_prepare_read_frame(&error, filehandle)) {
-    int64_t framecnt = atol(getString(dataset, 0x00280008).c_str());
-    if (framecnt <= 0)
-      framecnt = 1;
-    std::list<std::vector<char>> frames;
-    for (unsigned int idx = 1; idx <= framecnt; idx++) {
-      DcmFrame *frame = dcm_filehandle_read_frame(&error, filehandle, idx);
-      uint32_t length = dcm_frame_get_length(frame);
-      const char *value = dcm_frame_get_value(frame);
-      std::vector<char> pixels(length);
-      std::copy(value, value + length, pixels.data());
-      frames.push_back(pixels);
-    }
-    return frames;
+  if (length != dcm_io_read(&error, io, static_cast<char *>(buf), length)) {
+    if (error)
+      printf("%s\n", dcm_error_get_message(error));
+    return false;
   }
+  return true;
+}
 
-  if (error) {
-    printf("%s\n", dcm_error_get_message(error));
-    if (dcm_error_get_code(error) == DCM_ERROR_CODE_PARSE) {
-      msg = std::string(dcm_error_get_message(error));
-      return {};
-    }
+static bool skip_bytes(DcmIO *io, int64_t length) {
+  if (length == 0)
+    return true;
+  DcmError *error = nullptr;
+  if (dcm_io_seek(&error, io, length, SEEK_CUR) < 0) {
+    if (error)
+      printf("%s\n", dcm_error_get_message(error));
+    return false;
   }
-  const std::string txSyntax = getString(meta, 0x00020010);
-  bool explicitVR = txSyntax != std::string("1.2.840.10008.1.2");
+  return true;
+}
 
-  uint32_t tag = readTag(io);
-  DcmElement *element = readDataElement(io, tag, explicitVR);
-  while (tag != 0x7FE00010) {
-    tag = readTag(io);
-    element = readDataElement(io, tag, explicitVR);
+bool readElementHeader(DcmIO *io, bool explicitVR, element_header &header) {
+  uint16_t group_elem[2];
+  if (!read_bytes(io, group_elem, 4))
+    return false;
+  header.tag = (static_cast<uint32_t>(group_elem[0]) << 16) | group_elem[1];
+  header.vr = DCM_VR_ERROR;
+  // items and delimiters have no VR
+  if (group_elem[0] == 0xFFFE)
+    return read_bytes(io, &header.length, 4);
+
+  if (!explicitVR) {
+    header.vr = dcm_vr_from_tag(header.tag);
+    if (header.vr == DCM_VR_ERROR)
+      header.vr = DCM_VR_UN;
+    return read_bytes(io, &header.length, 4);
   }
-  if (element && dcm_element_get_tag(element) == 0x7FE00010) {
-    const uint32_t length = dcm_element_get_length(element);
-    const char *value = nullptr;
-    dcm_element_get_value_binary(&error, element, (const void **)&value);
-    std::vector<char> pixels(length);
-    std::copy(value, value + length, pixels.data());
-    std::list<std::vector<char>> frames;
-    frames.push_back(pixels);
-    return frames;
+
+  char vr[3] = {0, 0, 0};
+  if (!read_bytes(io, vr, 2))
+    return false;
+  header.vr = dcm_dict_vr_from_str(vr);
+  if (header.vr == DCM_VR_ERROR)
+    return false;
+  if (long_length(header.vr)) {
+    uint16_t reserved = 0;
+    return read_bytes(io, &reserved, 2) && read_bytes(io, &header.length, 4);
+  }
+  uint16_t length = 0;
+  if (!read_bytes(io, &length, 2))
+    return false;
+  header.length = length;
+  return true;
+}
+
+static bool skip_dataset(DcmIO *io, bool explicitVR, uint32_t end_tag);
+
+// items of a sequence or fragments of encapsulated pixel data, up to and
+// including the sequence delimiter
+static bool skip_items(DcmIO *io, bool explicitVR) {
+  element_header item;
+  while (readElementHeader(io, explicitVR, item)) {
+    if (item.tag == DCM_SQ_DELIM)
+      return true;
+    if (item.tag != DCM_ITEM)
+      return false;
+    if (item.length != UNDEFINED_LENGTH) {
+      if (!skip_bytes(io, item.length))
+        return false;
+    } else if (!skip_dataset(io, explicitVR, DCM_ITEM_DELIM)) {
+      return false;
+    }
   }
+  return false;
+}
+
+// elements up to and including end_tag
+static bool skip_dataset(DcmIO *io, bool explicitVR, uint32_t end_tag) {
+  element_header header;
+  while (readElementHeader(io, explicitVR, header)) {
+    if (header.tag == end_tag)
+      return true;
+    if (!skipValue(io, explicitVR, header))
+      return false;
+  }
+  return false;
+}
 
-  return {};
+bool skipValue(DcmIO *io, bool explicitVR, const element_header &header) {
+  if (header.length != UNDEFINED_LENGTH)
+    return skip_bytes(io, header.length);
+  // PS3.5 6.2.2: the items of UN with undefined length are implicit VR
+  return skip_items(io, explicitVR && header.vr != DCM_VR_UN);
+}
+
+bool seekToElement(DcmIO *io, bool explicitVR, uint32_t tag,
+                   element_header &header) {
+  while (readElementHeader(io, explicitVR, header)) {
+    if (header.tag == tag)
+      return true;
+    if (!skipValue(io, explicitVR, header))
+      return false;
+  }
+  return false;
 }
 
 bool print_element(const DcmElement *element, void *data) {
@@ -6,7 +6,6 @@ extern "C" {
 }
 
 #include <cstdint>
-#include <list>
 #include <string>
 #include <vector>
 
@@ -19,15 +18,29 @@ uint32_t readLength(DcmIO *io, uint32_t tag);
 // ## hight level ##
 DcmElement *readDataElement(DcmIO *io, uint32_t tag, bool explicitVR);
 DcmSequence *readSequence(DcmIO *io, uint32_t tag, bool explicitVR);
+// ## skip-ahead scanning ##
+// Reads only tags, VRs and lengths and seeks past the values, nothing is
+// allocated for elements that are not needed.
+struct element_header {
+  uint32_t tag;
+  DcmVR vr;
+  uint32_t length;
+};
+// false at the end of the stream
+bool readElementHeader(DcmIO *io, bool explicitVR, element_header &header);
+// seeks past the value of the element whose header was just read
+bool skipValue(DcmIO *io, bool explicitVR, const element_header &header);
+// positions io at the value of the next top level element with tag
+bool seekToElement(DcmIO *io, bool explicitVR, uint32_t tag,
+                   element_header &header);
 
 // #### dataset access ####
 std::string getString(const DcmDataSet *dataset, uint32_t tag);
+// every value of a multi-valued string element
+std::vector<std::string> getStrings(const DcmDataSet *dataset, uint32_t tag);
 int64_t getNumber(const DcmDataSet *dataset, uint32_t tag);
-
-std::list<std::vector<char>> getFrames(DcmDataSet *dataset,
-                                       const DcmDataSet *meta, DcmIO *io,
-                                       DcmFilehandle *filehandle,
-                                       std::string &msg);
+// for optional tags, returns fallback without complaining if tag is missing
+int64_t getNumber(const DcmDataSet *dataset, uint32_t tag, int64_t fallback);
 
 // callback function that can be used for dcm_dataset_foreach
 // useful for debugging purposes
@@ -0,0 +1,502 @@
+#include "display.h"
+#include "kernels.h"
+#include "transform.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// order preserving map of signed samples to unsigned ones
+template <typename T> static uint32_t sign_flip() {
+  return std::is_signed<T>::value ? 1u << (sizeof(T) * 8 - 1) : 0;
+}
+
+// lut index of a 32 bit sample, samples outside the bins go to the first or
+// the last one
+template <typename T>
+static uint32_t index32(T value, const lut_bins &bins) {
+  const uint32_t flipped = static_cast<uint32_t>(value) ^ sign_flip<T>();
+  if (flipped < bins.base)
+    return 0;
+  return std::min<uint32_t>((flipped - bins.base) >> bins.shift,
+                            lut_entries - 1);
+}
+
+template <typename T>
+static void histogram32(const T *in, size_t count, const lut_bins &bins,
+                        uint32_t *hist) {
+  for (size_t i = 0; i < count; i++) {
+    hist[index32(in[i], bins)]++;
+  }
+}
+
+template <typename T>
+static void applyLut32(const T *in, size_t count, const lut_bins &bins,
+                       const uint8_t *lut, uint8_t *out) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = lut[index32(in[i], bins)];
+  }
+}
+
+template <typename T>
+static lut_bins sample_bins(const T *in, size_t count) {
+  lut_bins bins;
+  if (count == 0)
+    return bins;
+  uint32_t min = static_cast<uint32_t>(in[0]) ^ sign_flip<T>();
+  uint32_t max = min;
+  for (size_t i = 1; i < count; i++) {
+    const uint32_t flipped = static_cast<uint32_t>(in[i]) ^ sign_flip<T>();
+    min = std::min(min, flipped);
+    max = std::max(max, flipped);
+  }
+  bins.base = min;
+  bins.shift = 0;
+  while (((max - min) >> bins.shift) >= lut_entries) {
+    bins.shift++;
+  }
+  return bins;
+}
+
+// stored value a lut index stands for
+static double lut_value(sample_format format, size_t index) {
+  const int bits = sampleSize(format) * 8;
+  const int shift = bits > 16 ? bits - 16 : 0;
+  const double value = static_cast<double>(static_cast<uint64_t>(index)
+                                           << shift);
+  if (isSigned(format))
+    return value - static_cast<double>(1ull << (bits - 1));
+  return value;
+}
+
+template <typename T>
+static void sample_range(const T *in, size_t count, double &low,
+                         double &high) {
+  if (count == 0)
+    return;
+  T min = in[0];
+  T max = in[0];
+  for (size_t i = 1; i < count; i++) {
+    min = std::min(min, in[i]);
+    max = std::max(max, in[i]);
+  }
+  low = min;
+  high = max;
+}
+
+lut_bins sampleBins(const image_data &image) {
+  const PixelBuffer &pixels = image.pixels;
+  switch (pixels.format()) {
+  case sample_format::u32:
+    return sample_bins(pixels.samples<uint32_t>(), pixels.pixels());
+  case sample_format::s32:
+    return sample_bins(pixels.samples<int32_t>(), pixels.pixels());
+  default:
+    return lut_bins();
+  }
+}
+
+size_t lutSize(sample_format format) {
+  return sampleSize(format) == 1 ? 256 : lut_entries;
+}
+
+std::vector<uint8_t> equalizationLut(const image_data &image,
+                                     const lut_bins &bins) {
+  const PixelBuffer &pixels = image.pixels;
+  const size_t count = pixels.pixels();
+  std::vector<uint32_t> hist(lut_entries);
+  switch (pixels.format()) {
+  case sample_format::u8:
+  case sample_format::s8: {
+    const uint8_t flip = pixels.format() == sample_format::s8 ? 0x80 : 0;
+    const uint8_t *in = pixels.samples<uint8_t>();
+    for (size_t i = 0; i < count; i++) {
+      hist[in[i] ^ flip]++;
+    }
+  } break;
+  case sample_format::u16:
+  case sample_format::s16:
+    histogram16(pixels.samples<uint16_t>(), count,
+                pixels.format() == sample_format::s16 ? 0x8000 : 0,
+                hist.data());
+    break;
+  case sample_format::u32:
+    histogram32(pixels.samples<uint32_t>(), count, bins, hist.data());
+    break;
+  case sample_format::s32:
+    histogram32(pixels.samples<int32_t>(), count, bins, hist.data());
+    break;
+  }
+  std::vector<uint8_t> lut(lut_entries + lut_padding);
+  equalizationLut(hist.data(), count, lut.data());
+  if (image.invert)
+    flip8(lut.data(), lut_entries, 0xFF, lut.data());
+  // bins above the lut size of 8 bit samples are empty anyway
+  lut.resize(lutSize(pixels.format()) + lut_padding);
+  return lut;
+}
+
+std::vector<uint8_t> windowLut(const image_data &image,
+                               const window_level &window) {
+  const sample_format format = image.pixels.format();
+  const size_t entries = lutSize(format);
+  std::vector<uint8_t> lut(entries + lut_padding);
+  // DICOM PS3.3 C.11.2.1.2.1
+  const double width = std::max(window.width, 1.0);
+  const double low = window.center - 0.5 - (width - 1) / 2;
+  const double high = window.center - 0.5 + (width - 1) / 2;
+  const double scale = 255.0 / std::max(width - 1, 1.0);
+  for (size_t i = 0; i < entries; i++) {
+    const double value = lut_value(format, i) * image.slope + image.intercept;
+    if (value <= low)
+      lut[i] = 0;
+    else if (value > high)
+      lut[i] = 255;
+    else
+      lut[i] = static_cast<uint8_t>(std::min(
+          255.0, (value - (window.center - 0.5)) * scale + 128.0));
+  }
+  if (image.invert)
+    flip8(lut.data(), entries, 0xFF, lut.data());
+  return lut;
+}
+
+void applyLut(const image_data &image, const std::vector<uint8_t> &lut,
+              uint8_t *out, const lut_bins &bins) {
+  const PixelBuffer &pixels = image.pixels;
+  const size_t count = pixels.pixels();
+  switch (pixels.format()) {
+  case sample_format::u8:
+  case sample_format::s8: {
+    const uint8_t flip = pixels.format() == sample_format::s8 ? 0x80 : 0;
+    const uint8_t *in = pixels.samples<uint8_t>();
+    for (size_t i = 0; i < count; i++) {
+      out[i] = lut[in[i] ^ flip];
+    }
+  } break;
+  case sample_format::u16:
+  case sample_format::s16:
+    applyLut16(pixels.samples<uint16_t>(), count,
+               pixels.format() == sample_format::s16 ? 0x8000 : 0,
+               lut.data(), out);
+    break;
+  case sample_format::u32:
+    applyLut32(pixels.samples<uint32_t>(), count, bins, lut.data(), out);
+    break;
+  case sample_format::s32:
+    applyLut32(pixels.samples<int32_t>(), count, bins, lut.data(), out);
+    break;
+  }
+}
+
+window_level fullRange(const image_data &image) {
+  const PixelBuffer &pixels = image.pixels;
+  const size_t count = pixels.pixels();
+  double low = 0;
+  double high = 0;
+  switch (pixels.format()) {
+  case sample_format::u8:
+    sample_range(pixels.samples<uint8_t>(), count, low, high);
+    break;
+  case sample_format::s8:
+    sample_range(pixels.samples<int8_t>(), count, low, high);
+    break;
+  case sample_format::u16:
+    sample_range(pixels.samples<uint16_t>(), count, low, high);
+    break;
+  case sample_format::s16:
+    sample_range(pixels.samples<int16_t>(), count, low, high);
+    break;
+  case sample_format::u32:
+    sample_range(pixels.samples<uint32_t>(), count, low, high);
+    break;
+  case sample_format::s32:
+    sample_range(pixels.samples<int32_t>(), count, low, high);
+    break;
+  }
+  low = low * image.slope + image.intercept;
+  high = high * image.slope + image.intercept;
+  if (low > high)
+    std::swap(low, high);
+  window_level window;
+  window.center = (low + high) / 2 + 0.5;
+  window.width = high - low + 1;
+  return window;
+}
+
+template <typename T>
+static void resample_plane(const T *in, int in_width, int in_height, T *out,
+                           int width, int height, int step) {
+  std::vector<size_t> columns(width);
+  for (int x = 0; x < width; x++) {
+    columns[x] =
+        static_cast<size_t>(static_cast<int64_t>(x) * in_width / width) *
+        step;
+  }
+  for (int y = 0; y < height; y++) {
+    const size_t in_y = static_cast<int64_t>(y) * in_height / height;
+    const T *row = in + in_y * in_width * step;
+    T *dst = out + static_cast<size_t>(y) * width * step;
+    for (int x = 0; x < width; x++) {
+      for (int c = 0; c < step; c++) {
+        dst[x * step + c] = row[columns[x] + c];
+      }
+    }
+  }
+}
+
+template <typename T>
+static void resample(const image_data &image, PixelBuffer &pixels, int width,
+                     int height) {
+  const PixelBuffer &in = image.pixels;
+  if (in.planar()) {
+    for (int c = 0; c < in.components(); c++) {
+      resample_plane(in.component<T>(c), image.width, image.height,
+                     pixels.component<T>(c), width, height, 1);
+    }
+  } else {
+    resample_plane(in.samples<T>(), image.width, image.height,
+                   pixels.samples<T>(), width, height, in.components());
+  }
+}
+
+// the chroma of the pairs is upsampled on the way, the result is YBR_FULL
+template <typename T>
+static void resample_422(const image_data &image, PixelBuffer &pixels,
+                         int width, int height) {
+  std::vector<size_t> columns(width);
+  for (int x = 0; x < width; x++) {
+    columns[x] = static_cast<int64_t>(x) * image.width / width;
+  }
+  const T *in = image.pixels.samples<T>();
+  T *out = pixels.samples<T>();
+  for (int y = 0; y < height; y++) {
+    const size_t in_y = static_cast<int64_t>(y) * image.height / height;
+    const T *row = in + in_y * image.width * 2;
+    for (int x = 0; x < width; x++) {
+      const T *group = row + (columns[x] & ~size_t(1)) * 2;
+      *out++ = group[columns[x] & 1];
+      *out++ = group[2];
+      *out++ = group[3];
+    }
+  }
+}
+
+image_data resampleNearest(const image_data &image, int width, int height) {
+  if (width <= 0 || height <= 0 || image.pixels.empty())
+    return image;
+  if (width == image.width && height == image.height &&
+      image.colour != colour_space::ybr_full_422)
+    return image;
+  image_data resampled = image;
+  resampled.width = width;
+  resampled.height = height;
+  if (image.colour == colour_space::ybr_full_422) {
+    resampled.colour = colour_space::ybr_full;
+    resampled.pixels = PixelBuffer(image.pixels.format(),
+                                   static_cast<size_t>(width) * height, 3);
+    switch (sampleSize(image.pixels.format())) {
+    case 1:
+      resample_422<uint8_t>(image, resampled.pixels, width, height);
+      break;
+    case 2:
+      resample_422<uint16_t>(image, resampled.pixels, width, height);
+      break;
+    case 4:
+      resample_422<uint32_t>(image, resampled.pixels, width, height);
+      break;
+    }
+    return resampled;
+  }
+  resampled.pixels =
+      PixelBuffer(image.pixels.format(), static_cast<size_t>(width) * height,
+                  image.pixels.components(), image.pixels.planar());
+  switch (sampleSize(image.pixels.format())) {
+  case 1:
+    resample<uint8_t>(image, resampled.pixels, width, height);
+    break;
+  case 2:
+    resample<uint16_t>(image, resampled.pixels, width, height);
+    break;
+  case 4:
+    resample<uint32_t>(image, resampled.pixels, width, height);
+    break;
+  }
+  return resampled;
+}
+
+static bool grey_to_display(const image_data &image, uint8_t *out) {
+  const PixelBuffer &pixels = image.pixels;
+  const size_t count = pixels.pixels();
+  if (sampleSize(pixels.format()) == 1) {
+    const uint8_t *in = pixels.samples<uint8_t>();
+    const bool sgnd = pixels.format() == sample_format::s8;
+    const uint8_t invert = image.invert ? 0xFF : 0;
+    if (image.bpp == 1) {
+      binarize8(in, count, 0x80, out);
+      if (invert)
+        flip8(out, count, invert, out);
+    } else if (image.bpp >= 8) {
+      flip8(in, count, (sgnd ? 0x80 : 0) ^ invert, out);
+    } else {
+      const int shift = 8 - image.bpp;
+      const uint8_t offset = sgnd ? 1 << (image.bpp - 1) : 0;
+      for (size_t i = 0; i < count; i++) {
+        out[i] = (static_cast<uint8_t>(in[i] + offset) << shift) ^ invert;
+      }
+    }
+    return true;
+  }
+  // histogram equalisation straight to 8 bits
+  const lut_bins bins = sampleBins(image);
+  applyLut(image, equalizationLut(image, bins), out, bins);
+  return true;
+}
+
+// colour samples of bpp bits to 8 bits
+template <typename T> struct colour_scale {
+  explicit colour_scale(int bpp) {
+    const int bits = std::min<int>(std::max(bpp, 1), sizeof(T) * 8);
+    shift = std::max(bits - 8, 0);
+    offset = std::is_signed<T>::value ? 1u << (bits - 1) : 0;
+    mask = bits >= 32 ? ~0u : (1u << bits) - 1;
+  }
+  uint8_t operator()(T value) const {
+    return ((static_cast<uint32_t>(value) + offset) & mask) >> shift;
+  }
+  int shift;
+  uint32_t offset;
+  uint32_t mask;
+};
+
+template <typename T, bool Ybr>
+static void interleave(const image_data &image, uint8_t *out) {
+  const PixelBuffer &pixels = image.pixels;
+  const colour_scale<T> scale(image.bpp);
+  const int step = pixels.step();
+  const T *c0 = pixels.component<T>(0);
+  const T *c1 = pixels.component<T>(1);
+  const T *c2 = pixels.component<T>(2);
+  for (size_t i = 0; i < pixels.pixels(); i++) {
+    if (Ybr) {
+      ybrToRgb(scale(*c0), scale(*c1), scale(*c2), out);
+    } else {
+      out[0] = scale(*c0);
+      out[1] = scale(*c1);
+      out[2] = scale(*c2);
+    }
+    out += 3;
+    c0 += step;
+    c1 += step;
+    c2 += step;
+  }
+}
+
+template <typename T>
+static void interleave_422(const image_data &image, uint8_t *out) {
+  const colour_scale<T> scale(image.bpp);
+  const T *in = image.pixels.samples<T>();
+  for (size_t i = 0; i + 2 <= image.pixels.pixels(); i += 2) {
+    const T *group = in + 2 * i;
+    const uint8_t cb = scale(group[2]);
+    const uint8_t cr = scale(group[3]);
+    ybrToRgb(scale(group[0]), cb, cr, out + 3 * i);
+    ybrToRgb(scale(group[1]), cb, cr, out + 3 * i + 3);
+  }
+}
+
+template <typename T>
+static void colour_to_display(const image_data &image, uint8_t *out) {
+  switch (image.colour) {
+  case colour_space::rgb:
+    interleave<T, false>(image, out);
+    break;
+  case colour_space::ybr_full:
+    interleave<T, true>(image, out);
+    break;
+  case colour_space::ybr_full_422:
+    interleave_422<T>(image, out);
+    break;
+  }
+}
+
+// 8 bit samples, by far the most common, take a single SIMD pass
+static bool rgb8_to_display(const image_data &image, uint8_t *out) {
+  const PixelBuffer &pixels = image.pixels;
+  const size_t count = pixels.pixels();
+  switch (image.colour) {
+  case colour_space::rgb:
+    if (pixels.planar())
+      interleave8(pixels.component<uint8_t>(0), pixels.component<uint8_t>(1),
+                  pixels.component<uint8_t>(2), count, out);
+    else
+      memcpy(out, pixels.data(), count * 3);
+    break;
+  case colour_space::ybr_full:
+    ybrToRgb8(pixels.component<uint8_t>(0), pixels.component<uint8_t>(1),
+              pixels.component<uint8_t>(2), count, pixels.step(), out);
+    break;
+  case colour_space::ybr_full_422:
+    ybr422ToRgb8(pixels.samples<uint8_t>(), count, out);
+    break;
+  }
+  return true;
+}
+
+static bool rgb_to_display(const image_data &image, uint8_t *out) {
+  if (image.pixels.format() == sample_format::u8 && image.bpp == 8)
+    return rgb8_to_display(image, out);
+  switch (image.pixels.format()) {
+  case sample_format::u8:
+    colour_to_display<uint8_t>(image, out);
+    break;
+  case sample_format::s8:
+    colour_to_display<int8_t>(image, out);
+    break;
+  case sample_format::u16:
+    colour_to_display<uint16_t>(image, out);
+    break;
+  case sample_format::s16:
+    colour_to_display<int16_t>(image, out);
+    break;
+  case sample_format::u32:
+    colour_to_display<uint32_t>(image, out);
+    break;
+  case sample_format::s32:
+    colour_to_display<int32_t>(image, out);
+    break;
+  }
+  return true;
+}
+
+int displayComponents(const image_data &image) {
+  if (image.pixels.empty() ||
+      image.pixels.pixels() !=
+          static_cast<size_t>(image.width) * image.height)
+    return 0;
+  if (image.components == 1 || image.components == 3)
+    return image.components;
+  return 0;
+}
+
+bool toDisplay(const image_data &image, const window_level &window,
+               uint8_t *out) {
+  if (displayComponents(image) != 1)
+    return toDisplay(image, out);
+  windowToDisplay(image, window, out);
+  return true;
+}
+
+bool toDisplay(const image_data &image, uint8_t *out) {
+  switch (displayComponents(image)) {
+  case 1:
+    return grey_to_display(image, out);
+  case 3:
+    return rgb_to_display(image, out);
+  default:
+    return false;
+  }
+}
@@ -0,0 +1,57 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include "compression.h"
+
+#include <cstdint>
+#include <vector>
+
+// DICOM linear VOI lut, in modality units
+struct window_level {
+  double center{};
+  double width{};
+};
+
+// number of 8 bit samples per displayed pixel: 1 grey, 3 rgb, 0 if the image
+// cannot be displayed
+int displayComponents(const image_data &image);
+
+// converts image to 8 bit display samples in a single pass through a lookup
+// table, out holds width * height * displayComponents() bytes
+bool toDisplay(const image_data &image, uint8_t *out);
+
+// converts a grey image through a window, colour images are converted as is
+bool toDisplay(const image_data &image, const window_level &window,
+               uint8_t *out);
+
+// Lookup tables of grey images. They are indexed by the sample with its sign
+// bit flipped and have lutSize() entries plus lut_padding. 32 bit samples
+// are binned by lut_bins, the default keeps their upper 16 bits.
+struct lut_bins {
+  // flipped sample of the first bin
+  uint32_t base{};
+  // bits of the flipped sample - base dropped
+  int shift{16};
+};
+// bins over the range of the samples, which an equalization of small range
+// 32 bit samples needs; the default for other formats
+lut_bins sampleBins(const image_data &image);
+size_t lutSize(sample_format format);
+std::vector<uint8_t> equalizationLut(const image_data &image,
+                                     const lut_bins &bins);
+// cheap to rebuild, only depends on the sample format and the window; uses
+// the default bins
+std::vector<uint8_t> windowLut(const image_data &image,
+                               const window_level &window);
+void applyLut(const image_data &image, const std::vector<uint8_t> &lut,
+              uint8_t *out, const lut_bins &bins = lut_bins());
+
+// window covering all samples of a grey image
+window_level fullRange(const image_data &image);
+
+// nearest neighbour scaling of the samples, e.g. to the size of the display
+// so that windowing only has to touch the visible pixels; YBR_FULL_422 comes
+// out as ybr_full, also at the same size
+image_data resampleNearest(const image_data &image, int width, int height);
+
+#endif // DISPLAY_H
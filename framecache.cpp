@@ -0,0 +1,123 @@
+#include "framecache.h"
+
+#include <utility>
+
+// default budget of frameCache()
+static const size_t default_budget = size_t(512) << 20;
+// OPJ_J2K_MAXRLVLS
+static const int max_reduction = 32;
+
+FrameCache::FrameCache(size_t budget)
+    : mBudget(budget), mBytes(0), mHits(0), mMisses(0), mEvictions(0) {}
+
+std::string FrameCache::key(const std::string &file,
+                            const std::string &sopUid, uint32_t frame,
+                            int reduction) {
+  // neither a path nor a UID holds a newline
+  return file + "\n" + sopUid + "/" + std::to_string(frame) + "/" +
+         std::to_string(reduction);
+}
+
+bool FrameCache::find(const std::string &file, const std::string &sopUid,
+                      uint32_t frame, int maxReduction, image_data &image) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (file.empty() || sopUid.empty() || mIndex.empty()) {
+    mMisses++;
+    return false;
+  }
+  for (int reduction = maxReduction; reduction >= 0; reduction--) {
+    auto it = mIndex.find(key(file, sopUid, frame, reduction));
+    if (it == mIndex.end())
+      continue;
+    mEntries.splice(mEntries.begin(), mEntries, it->second);
+    image = it->second->image;
+    mHits++;
+    return true;
+  }
+  mMisses++;
+  return false;
+}
+
+void FrameCache::insert(const std::string &file, const std::string &sopUid,
+                        uint32_t frame, image_data image) {
+  const size_t bytes = image.pixels.bytes();
+  if (file.empty() || sopUid.empty() || image.pixels.empty() ||
+      !image.pixels.writable())
+    return;
+
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (bytes > mBudget)
+    return;
+  const std::string k = key(file, sopUid, frame, image.reduction);
+  auto it = mIndex.find(k);
+  if (it != mIndex.end()) {
+    mBytes -= it->second->image.pixels.bytes();
+    mEntries.erase(it->second);
+    mIndex.erase(it);
+  }
+  mEntries.push_front({k, std::move(image)});
+  mIndex[k] = mEntries.begin();
+  mBytes += bytes;
+  evict();
+}
+
+void FrameCache::evict() {
+  while (mBytes > mBudget && !mEntries.empty()) {
+    const entry &last = mEntries.back();
+    mBytes -= last.image.pixels.bytes();
+    mIndex.erase(last.key);
+    mEntries.pop_back();
+    mEvictions++;
+  }
+}
+
+void FrameCache::setBudget(size_t bytes) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  mBudget = bytes;
+  evict();
+}
+
+size_t FrameCache::budget() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mBudget;
+}
+
+void FrameCache::clear() {
+  std::lock_guard<std::mutex> lock(mMutex);
+  mEntries.clear();
+  mIndex.clear();
+  mBytes = 0;
+}
+
+frame_cache_stats FrameCache::stats() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  frame_cache_stats stats;
+  stats.hits = mHits;
+  stats.misses = mMisses;
+  stats.evictions = mEvictions;
+  stats.entries = mEntries.size();
+  stats.bytes = mBytes;
+  stats.budget = mBudget;
+  return stats;
+}
+
+FrameCache &frameCache() {
+  static FrameCache cache(default_budget);
+  return cache;
+}
+
+int wantedReduction(int64_t columns, int64_t rows, int width, int height) {
+  if (width <= 0 || height <= 0 || columns <= 0 || rows <= 0)
+    return 0;
+  // same rule as the JPEG 2000 decoder, without its limit on the levels
+  int reduction = 0;
+  while (reduction + 1 < max_reduction) {
+    const int next = reduction + 1;
+    const int64_t reducedWidth = (columns + (int64_t(1) << next) - 1) >> next;
+    const int64_t reducedHeight = (rows + (int64_t(1) << next) - 1) >> next;
+    if (reducedWidth < width || reducedHeight < height)
+      break;
+    reduction = next;
+  }
+  return reduction;
+}
@@ -0,0 +1,79 @@
+#ifndef FRAMECACHE_H
+#define FRAMECACHE_H
+
+#include "compression.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+struct frame_cache_stats {
+  uint64_t hits{0};
+  uint64_t misses{0};
+  uint64_t evictions{0};
+  size_t entries{0};
+  size_t bytes{0};
+  size_t budget{0};
+};
+
+// Decoded frames keyed by file, SOP Instance UID, frame index and
+// resolution level, least recently used frames are evicted once the samples
+// exceed the byte budget. The file is part of the key because copies of an
+// instance need not hold the same pixels. The cached samples are shared with
+// the images handed out, nobody may write to them. Thread safe.
+class FrameCache {
+public:
+  explicit FrameCache(size_t budget);
+  FrameCache(const FrameCache &) = delete;
+  FrameCache &operator=(const FrameCache &) = delete;
+  FrameCache(FrameCache &&) = delete;
+  FrameCache &operator=(FrameCache &&) = delete;
+
+public:
+  // the most reduced frame with a reduction of at most maxReduction, so that
+  // it still covers the display
+  bool find(const std::string &file, const std::string &sopUid,
+            uint32_t frame, int maxReduction, image_data &image);
+  // samples wrapping memory of a file, i.e. native frames read in place, are
+  // not kept; they cost nothing to read again and a copy would defeat that
+  void insert(const std::string &file, const std::string &sopUid,
+              uint32_t frame, image_data image);
+
+  void setBudget(size_t bytes);
+  size_t budget() const;
+  void clear();
+  frame_cache_stats stats() const;
+
+private:
+  struct entry {
+    std::string key;
+    image_data image;
+  };
+
+  static std::string key(const std::string &file, const std::string &sopUid,
+                         uint32_t frame, int reduction);
+  void evict();
+
+private:
+  mutable std::mutex mMutex;
+  // most recently used first
+  std::list<entry> mEntries;
+  std::unordered_map<std::string, std::list<entry>::iterator> mIndex;
+  size_t mBudget;
+  size_t mBytes;
+  uint64_t mHits;
+  uint64_t mMisses;
+  uint64_t mEvictions;
+};
+
+// the process wide cache
+FrameCache &frameCache();
+
+// the largest wavelet reduction of a columns x rows image that still covers
+// width x height; 0 for full resolution
+int wantedReduction(int64_t columns, int64_t rows, int width, int height);
+
+#endif // FRAMECACHE_H
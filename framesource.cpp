@@ -0,0 +1,613 @@
+#include "framesource.h"
+
+#include "codecs.h"
+#include "dicomhelpers.h"
+#include "framecache.h"
+#include "kernels.h"
+#include "mappedio.h"
+#include "transform.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// single frame images above this size are decoded tile by tile
+static const int64_t streamed_pixels = 8192 * 4096;
+
+static const uint32_t pixel_data_tag = 0x7FE00010;
+static const uint32_t extended_offset_table_tag = 0x7FE00001;
+static const uint32_t item_tag = 0xFFFEE000;
+static const uint32_t undefined_length = 0xFFFFFFFF;
+
+Frame::Frame(DcmFrame *frame)
+    : mFrame(frame), mData(dcm_frame_get_value(frame)),
+      mSize(dcm_frame_get_length(frame)) {}
+
+Frame::Frame(std::vector<char> &&buffer)
+    : mBuffer(std::move(buffer)), mData(mBuffer.data()),
+      mSize(mBuffer.size()) {}
+
+Frame::Frame(const char *data, size_t size) : mData(data), mSize(size) {}
+
+Frame::Frame(Frame &&other)
+    : mFrame(other.mFrame), mBuffer(std::move(other.mBuffer)),
+      mData(other.mData), mSize(other.mSize) {
+  other.mFrame = nullptr;
+  other.mData = nullptr;
+  other.mSize = 0;
+}
+
+Frame &Frame::operator=(Frame &&other) {
+  if (this != &other) {
+    if (mFrame)
+      dcm_frame_destroy(mFrame);
+    mFrame = other.mFrame;
+    mBuffer = std::move(other.mBuffer);
+    mData = other.mData;
+    mSize = other.mSize;
+    other.mFrame = nullptr;
+    other.mData = nullptr;
+    other.mSize = 0;
+  }
+  return *this;
+}
+
+Frame::~Frame() {
+  if (mFrame)
+    dcm_frame_destroy(mFrame);
+}
+
+FrameSource::FrameSource(const DcmDataSet *dataset, const DcmDataSet *meta,
+                         DcmIO *io, DcmFilehandle *filehandle,
+                         const std::string &file, int64_t pixelDataOffset)
+    : mFile(file), mMeta(meta), mIO(io), mFilehandle(filehandle), mCount(0),
+      mUseFilehandle(false), mMapped(nullptr), mMappedSize(0),
+      mPixelDataOffset(-1) {
+  DcmError *error = nullptr;
+  int64_t framecnt = atol(getString(dataset, 0x00280008).c_str());
+  if (framecnt <= 0)
+    framecnt = 1;
+
+  // a mapped file is indexed in place, its frames are views into the mapping
+  if (!file.empty())
+    mMapping.reset(new MappedFile(file));
+  if (mMapping && !mMapping->empty()) {
+    mMapped = mMapping->data();
+    mMappedSize = mMapping->size();
+    const int64_t resume = position();
+    // a stale offset would not point at group 7FE0 right away
+    if (pixelDataOffset >= 0 && seek(pixelDataOffset) &&
+        indexPixelData(dataset, framecnt) &&
+        mPixelDataOffset == pixelDataOffset) {
+      mCount = mFrameFragments.size();
+      return;
+    }
+    mFrameFragments.clear();
+    mError.clear();
+    if (seekToDataset() && indexPixelData(dataset, framecnt)) {
+      mCount = mFrameFragments.size();
+      return;
+    }
+    mFrameFragments.clear();
+    mError.clear();
+    mMapping.reset();
+    mMapped = nullptr;
+    mMappedSize = 0;
+    mPixelDataOffset = -1;
+    seek(resume);
+  }
+
+  if (dcm_filehandle_prepare_read_frame(&error, filehandle)) {
+    mUseFilehandle = true;
+    mCount = framecnt;
+    return;
+  }
+
+  if (error) {
+    printf("%s\n", dcm_error_get_message(error));
+    if (dcm_error_get_code(error) == DCM_ERROR_CODE_PARSE) {
+      mError = std::string(dcm_error_get_message(error));
+      return;
+    }
+  }
+  // the fallback parser only reads element headers up to the pixel data and
+  // remembers where each frame is
+  if (indexPixelData(dataset, framecnt))
+    mCount = mFrameFragments.size();
+}
+
+FrameSource::~FrameSource() = default;
+
+Frame FrameSource::frame(uint32_t index) {
+  if (index >= mCount)
+    return {};
+
+  DcmError *error = nullptr;
+  if (mUseFilehandle) {
+    // libdicom frame numbers are 1 based
+    DcmFrame *frame = dcm_filehandle_read_frame(&error, mFilehandle, index + 1);
+    if (!frame) {
+      if (error) {
+        mError = std::string(dcm_error_get_message(error));
+        printf("%s\n", mError.c_str());
+      }
+      return {};
+    }
+    return Frame(frame);
+  }
+
+  const std::vector<fragment> &fragments = mFrameFragments[index];
+  if (mMapped) {
+    for (const fragment &f : fragments) {
+      if (f.offset + f.length > mMappedSize) {
+        mError = "pixel data is truncated";
+        return {};
+      }
+    }
+    // no copy unless the frame is split into several fragments
+    if (fragments.size() == 1)
+      return Frame(mMapped + fragments[0].offset, fragments[0].length);
+    size_t size = 0;
+    for (const fragment &f : fragments) {
+      size += f.length;
+    }
+    std::vector<char> buffer(size);
+    size_t offset = 0;
+    for (const fragment &f : fragments) {
+      memcpy(buffer.data() + offset, mMapped + f.offset, f.length);
+      offset += f.length;
+    }
+    return Frame(std::move(buffer));
+  }
+
+  size_t size = 0;
+  for (const fragment &f : fragments) {
+    size += f.length;
+  }
+  std::vector<char> buffer(size);
+  size_t offset = 0;
+  for (const fragment &f : fragments) {
+    if (!seek(f.offset) || !readValue(buffer.data() + offset, f.length))
+      return {};
+    offset += f.length;
+  }
+  return Frame(std::move(buffer));
+}
+
+int64_t FrameSource::position() {
+  DcmError *error = nullptr;
+  return dcm_io_seek(&error, mIO, 0, SEEK_CUR);
+}
+
+bool FrameSource::seek(int64_t offset) {
+  DcmError *error = nullptr;
+  if (dcm_io_seek(&error, mIO, offset, SEEK_SET) != offset) {
+    mError = error ? std::string(dcm_error_get_message(error))
+                   : std::string("cannot seek to pixel data");
+    return false;
+  }
+  return true;
+}
+
+bool FrameSource::readValue(char *buf, uint32_t length) {
+  DcmError *error = nullptr;
+  if (length != dcm_io_read(&error, mIO, buf, length)) {
+    if (error)
+      mError = std::string(dcm_error_get_message(error));
+    else
+      mError = "pixel data is truncated";
+    return false;
+  }
+  return true;
+}
+
+bool FrameSource::seekToDataset() {
+  // PS3.10 7.1: preamble, DICM prefix and the explicit VR little endian file
+  // meta information, starting with its group length
+  int64_t offset = 0;
+  if (mMappedSize >= 132 && memcmp(mMapped + 128, "DICM", 4) == 0)
+    offset = 132;
+  if (!seek(offset))
+    return false;
+  element_header header;
+  if (!readElementHeader(mIO, true, header) || header.tag != 0x00020000 ||
+      header.length != 4) {
+    // without a prefix there may be no file meta information at all
+    return offset == 0 && seek(0);
+  }
+  uint32_t groupLength = 0;
+  if (!readValue(reinterpret_cast<char *>(&groupLength), 4))
+    return false;
+  return seek(offset + 12 + groupLength);
+}
+
+bool FrameSource::indexPixelData(const DcmDataSet *dataset, uint32_t frames) {
+  const std::string txSyntax = getString(mMeta, 0x00020010);
+  bool explicitVR = txSyntax != std::string("1.2.840.10008.1.2");
+
+  // everything before the pixel data is skipped without being parsed, except
+  // for the Extended Offset Table
+  std::vector<uint64_t> extendedOffsets;
+  element_header header;
+  mPixelDataOffset = -1;
+  for (;;) {
+    const int64_t start = position();
+    if (!readElementHeader(mIO, explicitVR, header)) {
+      mError = "no pixel data found";
+      return false;
+    }
+    if ((header.tag >> 16) == 0x7FE0 && mPixelDataOffset < 0)
+      mPixelDataOffset = start;
+    if (header.tag == pixel_data_tag)
+      break;
+    if (header.tag == extended_offset_table_tag &&
+        header.length != undefined_length && header.length % 8 == 0) {
+      extendedOffsets.resize(header.length / 8);
+      if (!readValue(reinterpret_cast<char *>(extendedOffsets.data()),
+                     header.length))
+        return false;
+      continue;
+    }
+    if (!skipValue(mIO, explicitVR, header)) {
+      mError = "no pixel data found";
+      return false;
+    }
+  }
+
+  const int64_t value = position();
+  if (value < 0)
+    return false;
+  if (header.length != undefined_length) {
+    // native frames follow each other without padding, packed 1 bit frames
+    // only start at byte boundaries if their size is a multiple of 8
+    const int64_t frameBits =
+        getNumber(dataset, 0x00280010) * getNumber(dataset, 0x00280011) *
+        getNumber(dataset, 0x00280002, 1) * getNumber(dataset, 0x00280100);
+    const int64_t frameBytes = frameBits / 8;
+    if (frames > 1 && frameBytes > 0 && frameBits % 8 == 0 &&
+        frames * frameBytes <= static_cast<int64_t>(header.length)) {
+      for (uint32_t i = 0; i < frames; i++) {
+        mFrameFragments.push_back(
+            {{value + i * frameBytes, static_cast<uint32_t>(frameBytes)}});
+      }
+    } else {
+      mFrameFragments.push_back({{value, header.length}});
+    }
+    return true;
+  }
+
+  // encapsulated: the Basic Offset Table item, then one item per fragment
+  element_header item;
+  if (!readElementHeader(mIO, explicitVR, item) || item.tag != item_tag ||
+      item.length == undefined_length) {
+    mError = "invalid encapsulated pixel data";
+    return false;
+  }
+  std::vector<uint64_t> offsets;
+  if (item.length > 0 && item.length % 4 == 0) {
+    std::vector<uint32_t> basicOffsets(item.length / 4);
+    if (!readValue(reinterpret_cast<char *>(basicOffsets.data()),
+                   item.length))
+      return false;
+    offsets.assign(basicOffsets.begin(), basicOffsets.end());
+  } else if (!skipValue(mIO, explicitVR, item)) {
+    return false;
+  }
+  // PS3.5 A.4: the Basic Offset Table is empty if there is an extended one
+  if (!extendedOffsets.empty())
+    offsets = extendedOffsets;
+
+  // the offsets count from the first fragment item
+  const int64_t first = position();
+  std::vector<fragment> fragments;
+  while (readElementHeader(mIO, explicitVR, item) && item.tag == item_tag) {
+    fragments.push_back({position(), item.length});
+    if (!skipValue(mIO, explicitVR, item))
+      break;
+  }
+  if (fragments.empty()) {
+    mError = "no pixel data found";
+    return false;
+  }
+  groupFragments(fragments, offsets, first, frames);
+  return !mFrameFragments.empty();
+}
+
+void FrameSource::groupFragments(const std::vector<fragment> &fragments,
+                                 const std::vector<uint64_t> &offsets,
+                                 int64_t first, uint32_t frames) {
+  if (!offsets.empty()) {
+    // a fragment belongs to the last frame starting at or before its item
+    for (const fragment &f : fragments) {
+      const uint64_t item = f.offset - 8 - first;
+      const size_t frame =
+          std::upper_bound(offsets.begin(), offsets.end(), item) -
+          offsets.begin();
+      if (frame == 0)
+        continue;
+      if (mFrameFragments.size() < frame)
+        mFrameFragments.resize(frame);
+      mFrameFragments[frame - 1].push_back(f);
+    }
+  } else if (frames == 1) {
+    mFrameFragments.push_back(fragments);
+  } else if (fragments.size() == frames) {
+    for (const fragment &f : fragments) {
+      mFrameFragments.push_back({f});
+    }
+  } else {
+    // no offsets to go by, a frame starts with a JPEG SOI or JPEG 2000 SOC
+    // marker
+    for (const fragment &f : fragments) {
+      unsigned char marker[2] = {0, 0};
+      if (f.length >= 2 && seek(f.offset))
+        readValue(reinterpret_cast<char *>(marker), 2);
+      const bool start =
+          marker[0] == 0xFF && (marker[1] == 0xD8 || marker[1] == 0x4F);
+      if (start || mFrameFragments.empty())
+        mFrameFragments.push_back({f});
+      else
+        mFrameFragments.back().push_back(f);
+    }
+  }
+  if (mFrameFragments.size() > frames)
+    mFrameFragments.resize(frames);
+}
+
+bool pixelLayout(const DcmDataSet *dataset, pixel_layout &layout) {
+  const int64_t rows = getNumber(dataset, 0x00280010);
+  const int64_t columns = getNumber(dataset, 0x00280011);
+  const int64_t spp = getNumber(dataset, 0x00280002, 1);
+  const std::string pi = getString(dataset, 0x00280004);
+  if (rows <= 0 || columns <= 0 || rows > 0xFFFF || columns > 0xFFFF)
+    return false;
+  layout.rows = rows;
+  layout.columns = columns;
+  layout.bitsAllocated = getNumber(dataset, 0x00280100);
+  layout.bitsStored = getNumber(dataset, 0x00280101, layout.bitsAllocated);
+  layout.highBit = getNumber(dataset, 0x00280102, layout.bitsStored - 1);
+  layout.sgnd = getNumber(dataset, 0x00280103, 0) == 1;
+  layout.planar = getNumber(dataset, 0x00280006, 0) == 1;
+  layout.monochrome1 = pi == "MONOCHROME1";
+  if (layout.bitsAllocated > 0 &&
+      (layout.bitsStored <= 0 || layout.bitsStored > layout.bitsAllocated ||
+      layout.highBit < layout.bitsStored - 1 ||
+       layout.highBit >= layout.bitsAllocated)) {
+    fprintf(stderr, "ignoring bits stored %d, high bit %d\n",
+            layout.bitsStored, layout.highBit);
+    layout.bitsStored = layout.bitsAllocated;
+    layout.highBit = layout.bitsAllocated - 1;
+  }
+  if ((pi == "MONOCHROME2" || pi == "MONOCHROME1") && spp == 1) {
+    layout.components = 1;
+  } else if (spp == 3 && (pi == "RGB" || pi == "YBR_ICT" || pi == "YBR_RCT")) {
+    // OpenJPEG undoes the component transform of YBR_ICT and YBR_RCT
+    layout.components = 3;
+  } else if (spp == 3 && pi == "YBR_FULL") {
+    layout.components = 3;
+    layout.colour = colour_space::ybr_full;
+  } else if (spp == 3 && pi == "YBR_FULL_422") {
+    layout.components = 3;
+    layout.colour = colour_space::ybr_full_422;
+  } else {
+    fprintf(stderr, "unsupported photometric interpretation %s\n",
+            pi.c_str());
+    return false;
+  }
+  return true;
+}
+
+static bool little_endian_host() {
+  const uint16_t probe = 1;
+  return *reinterpret_cast<const uint8_t *>(&probe) == 1;
+}
+
+// native samples are little endian and may start at any offset of the file
+static bool in_host_order(const char *data, sample_format format) {
+  const size_t size = sampleSize(format);
+  if (size == 1)
+    return true;
+  return little_endian_host() && reinterpret_cast<uintptr_t>(data) % size == 0;
+}
+
+static void copy_little_endian(const char *in, size_t count, size_t size,
+                               char *out) {
+  if (little_endian_host()) {
+    memcpy(out, in, count * size);
+    return;
+  }
+  for (size_t i = 0; i < count; i++) {
+    for (size_t b = 0; b < size; b++) {
+      out[i * size + b] = in[i * size + size - 1 - b];
+    }
+  }
+}
+
+image_data nativeImage(const DcmDataSet *dataset, Frame &&frame) {
+  pixel_layout layout;
+  if (!pixelLayout(dataset, layout))
+    return {};
+  const int64_t rows = layout.rows;
+  const int64_t columns = layout.columns;
+  const int64_t ba = layout.bitsAllocated;
+  const bool sgnd = layout.sgnd;
+  const bool planar = layout.planar;
+
+  image_data image;
+  image.width = columns;
+  image.height = rows;
+  image.bpp = layout.bitsStored;
+  image.components = layout.components;
+  image.invert = layout.monochrome1;
+  image.colour = layout.colour;
+
+  const size_t pixels = static_cast<size_t>(rows) * columns;
+  if (ba == 1) {
+    // bits are packed, least significant bit first
+    if (frame.size() * 8 < pixels * image.components)
+      return {};
+    PixelBuffer unpacked(sample_format::u8, pixels, image.components);
+    const uint8_t *in = reinterpret_cast<const uint8_t *>(frame.data());
+    uint8_t *out = unpacked.samples<uint8_t>();
+    for (size_t i = 0; i < pixels * image.components; i++) {
+      out[i] = (in[i / 8] >> (i % 8)) & 1;
+    }
+    image.pixels = unpacked;
+    return image;
+  }
+  if (ba != 8 && ba != 16 && ba != 32) {
+    fprintf(stderr, "unsupported bits allocated %lld\n",
+            static_cast<long long>(ba));
+    return {};
+  }
+  // pairs of pixels share their chroma samples, always interleaved
+  const bool subsampled = image.colour == colour_space::ybr_full_422;
+  const int perPixel = subsampled ? 2 : image.components;
+  if (subsampled && columns % 2) {
+    fprintf(stderr, "YBR_FULL_422 with odd columns\n");
+    return {};
+  }
+  if (frame.size() < pixels * perPixel * ba / 8) {
+    fprintf(stderr, "frame is too short\n");
+    return {};
+  }
+  const sample_format format = formatFor(ba, sgnd);
+  const size_t samples = pixels * perPixel;
+  // samples are read in place only if they are aligned and in host order
+  const char *data = frame.data();
+  PixelBuffer copied;
+  if (!in_host_order(data, format)) {
+    copied = PixelBuffer(format, pixels, perPixel, planar && !subsampled);
+    copy_little_endian(data, samples, sampleSize(format),
+                       static_cast<char *>(copied.data()));
+    data = static_cast<const char *>(copied.data());
+  }
+  if (needsExtraction(format, layout.bitsStored, layout.highBit, data,
+                      samples)) {
+    // the other bits hold e.g. overlays, the samples are copied without them
+    PixelBuffer extracted(format, pixels, perPixel, planar && !subsampled);
+    extractStoredBits(format, layout.bitsStored, layout.highBit, data, samples,
+                      extracted.data());
+    image.pixels = extracted;
+    return image;
+  }
+  if (!copied.empty()) {
+    image.pixels = copied;
+    return image;
+  }
+  std::shared_ptr<Frame> owner = std::make_shared<Frame>(std::move(frame));
+  image.pixels = PixelBuffer::wrap(owner->data(), format, pixels, perPixel,
+                                   planar && !subsampled, owner);
+  return image;
+}
+
+void readRescale(const DcmDataSet *dataset, image_data &image) {
+  const std::vector<std::string> slope = getStrings(dataset, 0x00281053);
+  const std::vector<std::string> intercept = getStrings(dataset, 0x00281052);
+  image.slope = slope.empty() ? 1.0 : atof(slope.front().c_str());
+  image.intercept = intercept.empty() ? 0.0 : atof(intercept.front().c_str());
+  if (image.slope == 0.0)
+    image.slope = 1.0;
+}
+
+decoded_frame decodeFrame(const DcmDataSet *dataset, const DcmDataSet *meta,
+                          FrameSource &frames, uint32_t index, int width,
+                          int height) {
+  const std::string sopUid = getString(dataset, 0x00080018);
+  const int reduction =
+      wantedReduction(getNumber(dataset, 0x00280011),
+                      getNumber(dataset, 0x00280010), width, height);
+  decoded_frame decoded;
+  if (frameCache().find(frames.file(), sopUid, index, reduction,
+                        decoded.image))
+    return decoded;
+  decoded = decodeFrame(dataset, meta, frames.frame(index), frames.count(),
+                        width, height);
+  // streamed frames are too large to be worth keeping
+  if (!decoded.image.pixels.empty())
+    frameCache().insert(frames.file(), sopUid, index, decoded.image);
+  return decoded;
+}
+
+decoded_frame decodeFrame(const DcmDataSet *dataset, const DcmDataSet *meta,
+                          Frame &&frame, uint32_t count, int width,
+                          int height) {
+  decoded_frame decoded;
+  if (frame.empty())
+    return decoded;
+
+  const std::string txSyntax = getString(meta, 0x00020010);
+  if (!dcm_is_encapsulated_transfer_syntax(txSyntax.c_str())) {
+    decoded.image = nativeImage(dataset, std::move(frame));
+    if (!decoded.image.pixels.empty())
+      readRescale(dataset, decoded.image);
+    return decoded;
+  }
+
+  codec c;
+  pixel_layout layout;
+  if (!findCodec(txSyntax, c)) {
+    fprintf(stderr, "no decoder for transfer syntax %s\n", txSyntax.c_str());
+    return decoded;
+  }
+  if (!pixelLayout(dataset, layout))
+    return decoded;
+  const int64_t pixels = static_cast<int64_t>(layout.rows) * layout.columns;
+  if (c.stream && count == 1 && pixels > streamed_pixels) {
+    decoded.streamed = c.stream(frame.data(), frame.size(), width, height);
+    display_data &streamed = decoded.streamed;
+    if (layout.monochrome1 && streamed.pixels && streamed.components == 1)
+      flip8(streamed.pixels.get(),
+            static_cast<size_t>(streamed.width) * streamed.height, 0xFF,
+            streamed.pixels.get());
+  } else {
+    decoded.image = c.decode(layout, frame.data(), frame.size(), width, height);
+    decoded.image.invert = layout.monochrome1;
+    // decoders return full chroma planes
+    decoded.image.colour = layout.colour == colour_space::ybr_full_422
+                               ? colour_space::ybr_full
+                               : layout.colour;
+  }
+  if (!decoded.image.pixels.empty())
+    readRescale(dataset, decoded.image);
+  return decoded;
+}
+
+image_data decodeFrameArea(const DcmDataSet *dataset, const DcmDataSet *meta,
+                           FrameSource &frames, uint32_t index,
+                           image_area &area, int width, int height) {
+  const std::string txSyntax = getString(meta, 0x00020010);
+  codec c;
+  if (!dcm_is_encapsulated_transfer_syntax(txSyntax.c_str()) ||
+      !findCodec(txSyntax, c) || !c.area)
+    return {};
+  return decodeFrameArea(dataset, meta, frames.frame(index), area, width,
+                         height);
+}
+
+image_data decodeFrameArea(const DcmDataSet *dataset, const DcmDataSet *meta,
+                           const Frame &frame, image_area &area, int width,
+                           int height) {
+  const std::string txSyntax = getString(meta, 0x00020010);
+  codec c;
+  pixel_layout layout;
+  if (frame.empty() || !dcm_is_encapsulated_transfer_syntax(txSyntax.c_str()) ||
+      !findCodec(txSyntax, c) || !c.area || !pixelLayout(dataset, layout))
+    return {};
+  image_data image =
+      c.area(layout, frame.data(), frame.size(), area, width, height);
+  if (image.pixels.empty())
+    return image;
+  image.invert = layout.monochrome1;
+  image.colour = layout.colour == colour_space::ybr_full_422
+                     ? colour_space::ybr_full
+                     : layout.colour;
+  readRescale(dataset, image);
+  return image;
+}
@@ -0,0 +1,154 @@
+#ifndef FRAMESOURCE_H
+#define FRAMESOURCE_H
+
+extern "C" {
+#include <dicom/dicom.h>
+}
+
+#include "codecs.h"
+#include "compression.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class MappedFile;
+
+// The bytes of a single frame. Owns a libdicom frame or a buffer, or is a
+// view into memory owned by the FrameSource it came from, e.g. its mapping
+// of the file.
+class Frame {
+public:
+  Frame() = default;
+  explicit Frame(DcmFrame *frame);
+  explicit Frame(std::vector<char> &&buffer);
+  Frame(const char *data, size_t size);
+  Frame(const Frame &) = delete;
+  Frame &operator=(const Frame &) = delete;
+  Frame(Frame &&other);
+  Frame &operator=(Frame &&other);
+
+  ~Frame();
+
+public:
+  const char *data() const { return mData; }
+  size_t size() const { return mSize; }
+  bool empty() const { return mSize == 0; }
+
+private:
+  DcmFrame *mFrame{nullptr};
+  std::vector<char> mBuffer;
+  const char *mData{nullptr};
+  size_t mSize{0};
+};
+
+// Gives access to the frames of a dataset. The number of frames is known up
+// front, a frame is only read when it is asked for.
+// Not thread safe: frames are read through the shared DcmIO.
+class FrameSource {
+public:
+  // file is the path io was opened from, it is mapped to read the frames in
+  // place; empty to read them through io. pixelDataOffset is a known
+  // pixelDataOffset() of the file, e.g. from the header index, it saves the
+  // scan for the pixel data
+  FrameSource(const DcmDataSet *dataset, const DcmDataSet *meta, DcmIO *io,
+              DcmFilehandle *filehandle, const std::string &file,
+              int64_t pixelDataOffset = -1);
+  FrameSource(const FrameSource &) = delete;
+  FrameSource &operator=(const FrameSource &) = delete;
+  FrameSource(FrameSource &&) = delete;
+  FrameSource &operator=(FrameSource &&) = delete;
+
+  ~FrameSource();
+
+public:
+  uint32_t count() const { return mCount; }
+  // the path it was created with, may be empty
+  const std::string &file() const { return mFile; }
+  const std::string &error() const { return mError; }
+  // of the first element of group 7FE0 (Extended Offset Table or Pixel
+  // Data), -1 if libdicom reads the frames
+  int64_t pixelDataOffset() const { return mPixelDataOffset; }
+
+  // index is 0 based, returns an empty frame on failure
+  Frame frame(uint32_t index);
+
+private:
+  // a fragment of encapsulated pixel data or the bytes of a native frame
+  struct fragment {
+    // of the value in the stream
+    int64_t offset;
+    uint32_t length;
+  };
+
+  bool seekToDataset();
+  bool indexPixelData(const DcmDataSet *dataset, uint32_t frames);
+  void groupFragments(const std::vector<fragment> &fragments,
+                      const std::vector<uint64_t> &offsets, int64_t first,
+                      uint32_t frames);
+  int64_t position();
+  bool seek(int64_t offset);
+  bool readValue(char *buf, uint32_t length);
+
+private:
+  const std::string mFile;
+  const DcmDataSet *mMeta;
+  DcmIO *mIO;
+  DcmFilehandle *mFilehandle;
+  uint32_t mCount;
+  bool mUseFilehandle;
+  // set if the frames are indexed in the mapped file
+  std::unique_ptr<MappedFile> mMapping;
+  const char *mMapped;
+  int64_t mMappedSize;
+  int64_t mPixelDataOffset;
+  // fallback path, where the fragments of each frame are in the stream
+  std::vector<std::vector<fragment>> mFrameFragments;
+  std::string mError;
+};
+
+// reads the layout from the Image Pixel module, false for photometric
+// interpretations that cannot be displayed
+bool pixelLayout(const DcmDataSet *dataset, pixel_layout &layout);
+
+// Wraps the native (uncompressed) samples of a frame without copying them,
+// the image keeps the frame alive. A view frame stays valid only as long as
+// its FrameSource.
+image_data nativeImage(const DcmDataSet *dataset, Frame &&frame);
+
+// Rescale Slope/Intercept of the dataset
+void readRescale(const DcmDataSet *dataset, image_data &image);
+
+// A decoded frame. Either image holds the samples, or, for images too large
+// to keep at full precision, streamed holds display samples only.
+struct decoded_frame {
+  image_data image;
+  display_data streamed;
+};
+
+// decodes frame index of the dataset, see decompressOpenJPEG() for width and
+// height; decoded frames are kept in frameCache()
+decoded_frame decodeFrame(const DcmDataSet *dataset, const DcmDataSet *meta,
+                          FrameSource &frames, uint32_t index, int width,
+                          int height);
+// decodes a frame that was already read, count is the number of frames of
+// the dataset; does not touch the FrameSource, so it can run on any thread
+decoded_frame decodeFrame(const DcmDataSet *dataset, const DcmDataSet *meta,
+                          Frame &&frame, uint32_t count, int width,
+                          int height);
+// decodes only the area of frame index (full resolution pixels) at the
+// smallest resolution still covering width x height for it, area is changed
+// to what was decoded; empty if the codec of the transfer syntax cannot
+// decode areas. Areas are not cached.
+image_data decodeFrameArea(const DcmDataSet *dataset, const DcmDataSet *meta,
+                           FrameSource &frames, uint32_t index,
+                           image_area &area, int width, int height);
+// decodes an area of a frame that was already read; does not touch the
+// FrameSource, so it can run on any thread
+image_data decodeFrameArea(const DcmDataSet *dataset, const DcmDataSet *meta,
+                           const Frame &frame, image_area &area, int width,
+                           int height);
+
+#endif // FRAMESOURCE_H
@@ -0,0 +1,278 @@
+#include "headerindex.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <unordered_set>
+#include <utility>
+
+// native byte order, bump the version whenever slice_info changes
+static const char index_magic[8] = {'P', 'D', 'V', 'I', 'D', 'X', 0, 0};
+static const uint32_t index_version = 1;
+
+namespace {
+struct file_closer {
+  void operator()(FILE *f) const { fclose(f); }
+};
+typedef std::unique_ptr<FILE, file_closer> file_ptr;
+
+class writer {
+public:
+  explicit writer(FILE *f) : mFile(f), mGood(true) {}
+  template <typename T> void value(T v) {
+    mGood = mGood && fwrite(&v, sizeof(v), 1, mFile) == 1;
+  }
+  void string(const std::string &s) {
+    value<uint32_t>(s.size());
+    mGood = mGood && fwrite(s.data(), 1, s.size(), mFile) == s.size();
+  }
+  void strings(const std::vector<std::string> &v) {
+    value<uint32_t>(v.size());
+    for (const std::string &s : v) {
+      string(s);
+    }
+  }
+  bool good() const { return mGood; }
+
+private:
+  FILE *mFile;
+  bool mGood;
+};
+
+class reader {
+public:
+  explicit reader(FILE *f) : mFile(f), mGood(true) {}
+  template <typename T> T value() {
+    T v{};
+    mGood = mGood && fread(&v, sizeof(v), 1, mFile) == 1;
+    return v;
+  }
+  std::string string() {
+    const uint32_t size = value<uint32_t>();
+    // a corrupt length must not allocate gigabytes
+    if (!mGood || size > 65536) {
+      mGood = false;
+      return {};
+    }
+    std::string s(size, '\0');
+    mGood = mGood && fread(&s[0], 1, size, mFile) == size;
+    return s;
+  }
+  std::vector<std::string> strings() {
+    const uint32_t count = value<uint32_t>();
+    std::vector<std::string> v;
+    for (uint32_t i = 0; mGood && i < count; i++) {
+      v.push_back(string());
+    }
+    return v;
+  }
+  bool good() const { return mGood; }
+
+private:
+  FILE *mFile;
+  bool mGood;
+};
+} // namespace
+
+static void write_slice(writer &w, const slice_info &slice) {
+  w.string(slice.studyUid);
+  w.string(slice.studyDescription);
+  w.string(slice.seriesUid);
+  w.string(slice.seriesDescription);
+  w.string(slice.sopUid);
+  w.string(slice.patientName);
+  w.string(slice.modality);
+  w.string(slice.transferSyntax);
+  w.value(slice.instance);
+  w.value(slice.frames);
+  w.value(slice.pixelDataOffset);
+  w.value<uint8_t>(slice.hasPosition);
+  for (double p : slice.position) {
+    w.value(p);
+  }
+  for (double o : slice.orientation) {
+    w.value(o);
+  }
+  w.value(slice.rows);
+  w.value(slice.columns);
+  w.strings(slice.windowCenters);
+  w.strings(slice.windowWidths);
+  w.strings(slice.windowExplanations);
+}
+
+static void read_slice(reader &r, slice_info &slice) {
+  slice.studyUid = r.string();
+  slice.studyDescription = r.string();
+  slice.seriesUid = r.string();
+  slice.seriesDescription = r.string();
+  slice.sopUid = r.string();
+  slice.patientName = r.string();
+  slice.modality = r.string();
+  slice.transferSyntax = r.string();
+  slice.instance = r.value<int64_t>();
+  slice.frames = r.value<int64_t>();
+  slice.pixelDataOffset = r.value<int64_t>();
+  slice.hasPosition = r.value<uint8_t>() != 0;
+  for (double &p : slice.position) {
+    p = r.value<double>();
+  }
+  for (double &o : slice.orientation) {
+    o = r.value<double>();
+  }
+  slice.rows = r.value<int64_t>();
+  slice.columns = r.value<int64_t>();
+  slice.windowCenters = r.strings();
+  slice.windowWidths = r.strings();
+  slice.windowExplanations = r.strings();
+}
+
+// mkdir -p of the directory part of path
+static void make_parents(const std::string &path) {
+  for (size_t slash = path.find('/', 1); slash != std::string::npos;
+       slash = path.find('/', slash + 1)) {
+    mkdir(path.substr(0, slash).c_str(), 0755);
+  }
+}
+
+HeaderIndex::HeaderIndex(std::string path)
+    : mPath(std::move(path)), mDirty(false), mHits(0), mMisses(0) {}
+
+std::string HeaderIndex::defaultPath() {
+  const char *cache = getenv("XDG_CACHE_HOME");
+  if (cache && *cache)
+    return std::string(cache) + "/pdv/headers.idx";
+  const char *home = getenv("HOME");
+  return std::string(home ? home : ".") + "/.cache/pdv/headers.idx";
+}
+
+bool HeaderIndex::load() {
+  file_ptr f(fopen(mPath.c_str(), "rb"));
+  if (!f)
+    return false;
+  reader r(f.get());
+  char magic[sizeof(index_magic)];
+  if (fread(magic, 1, sizeof(magic), f.get()) != sizeof(magic) ||
+      memcmp(magic, index_magic, sizeof(magic)) != 0 ||
+      r.value<uint32_t>() != index_version) {
+    fprintf(stderr, "ignoring header index %s of another version\n",
+            mPath.c_str());
+    return false;
+  }
+  const uint64_t count = r.value<uint64_t>();
+  std::unordered_map<std::string, entry> entries;
+  for (uint64_t i = 0; r.good() && i < count; i++) {
+    const std::string path = r.string();
+    entry e;
+    e.mtime = r.value<int64_t>();
+    e.size = r.value<int64_t>();
+    read_slice(r, e.slice);
+    e.slice.file = path;
+    entries[path] = std::move(e);
+  }
+  if (!r.good()) {
+    fprintf(stderr, "header index %s is corrupt\n", mPath.c_str());
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mMutex);
+  mEntries = std::move(entries);
+  mDirty = false;
+  return true;
+}
+
+bool HeaderIndex::save() {
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (!mDirty)
+    return true;
+  make_parents(mPath);
+  const std::string temporary = mPath + ".tmp";
+  {
+    file_ptr f(fopen(temporary.c_str(), "wb"));
+    if (!f) {
+      fprintf(stderr, "cannot write header index %s\n", temporary.c_str());
+      return false;
+    }
+    writer w(f.get());
+    fwrite(index_magic, 1, sizeof(index_magic), f.get());
+    w.value(index_version);
+    w.value<uint64_t>(mEntries.size());
+    for (const auto &e : mEntries) {
+      w.string(e.first);
+      w.value(e.second.mtime);
+      w.value(e.second.size);
+      write_slice(w, e.second.slice);
+    }
+    if (!w.good() || fflush(f.get()) != 0) {
+      fprintf(stderr, "cannot write header index %s\n", temporary.c_str());
+      return false;
+    }
+  }
+  // readers see either the old or the new index
+  if (rename(temporary.c_str(), mPath.c_str()) != 0) {
+    fprintf(stderr, "cannot replace header index %s\n", mPath.c_str());
+    return false;
+  }
+  mDirty = false;
+  return true;
+}
+
+bool HeaderIndex::lookup(const std::string &file, int64_t mtime, int64_t size,
+                         slice_info &slice) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  auto it = mEntries.find(file);
+  if (it == mEntries.end() || it->second.mtime != mtime ||
+      it->second.size != size) {
+    mMisses++;
+    return false;
+  }
+  mHits++;
+  slice = it->second.slice;
+  return true;
+}
+
+void HeaderIndex::update(const std::string &file, int64_t mtime, int64_t size,
+                         const slice_info &slice) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  entry &e = mEntries[file];
+  e.mtime = mtime;
+  e.size = size;
+  e.slice = slice;
+  mDirty = true;
+}
+
+void HeaderIndex::prune(const std::string &directory, bool recursive,
+                        const std::vector<std::string> &files) {
+  const std::string prefix = directory + "/";
+  const std::unordered_set<std::string> present(files.begin(), files.end());
+  std::lock_guard<std::mutex> lock(mMutex);
+  for (auto it = mEntries.begin(); it != mEntries.end();) {
+    const std::string &path = it->first;
+    const bool inside =
+        path.compare(0, prefix.size(), prefix) == 0 &&
+        (recursive || path.find('/', prefix.size()) == std::string::npos);
+    if (inside && !present.count(path)) {
+      it = mEntries.erase(it);
+      mDirty = true;
+    } else {
+      ++it;
+    }
+  }
+}
+
+size_t HeaderIndex::size() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mEntries.size();
+}
+
+size_t HeaderIndex::hits() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mHits;
+}
+
+size_t HeaderIndex::misses() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mMisses;
+}
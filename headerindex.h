@@ -0,0 +1,63 @@
+#ifndef HEADERINDEX_H
+#define HEADERINDEX_H
+
+#include "series.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// On-disk cache of the headers of scanned files, so that reopening an archive
+// only has to stat the files. Entries are keyed by path and are only used
+// while the modification time and size of the file match. Thread safe.
+class HeaderIndex {
+public:
+  explicit HeaderIndex(std::string path);
+  HeaderIndex(const HeaderIndex &) = delete;
+  HeaderIndex &operator=(const HeaderIndex &) = delete;
+  HeaderIndex(HeaderIndex &&) = delete;
+  HeaderIndex &operator=(HeaderIndex &&) = delete;
+
+public:
+  // $XDG_CACHE_HOME/pdv/headers.idx, ~/.cache/pdv/headers.idx without it
+  static std::string defaultPath();
+
+  // false if there is no index yet or it has another format version
+  bool load();
+  // writes a new file and renames it over the old one, only if anything
+  // changed since load()
+  bool save();
+
+  bool lookup(const std::string &file, int64_t mtime, int64_t size,
+              slice_info &slice);
+  void update(const std::string &file, int64_t mtime, int64_t size,
+              const slice_info &slice);
+  // forgets files of directory that are not in files any more
+  void prune(const std::string &directory, bool recursive,
+             const std::vector<std::string> &files);
+
+  size_t size() const;
+  // lookups since the index was created
+  size_t hits() const;
+  size_t misses() const;
+
+private:
+  struct entry {
+    int64_t mtime;
+    int64_t size;
+    slice_info slice;
+  };
+
+private:
+  const std::string mPath;
+  mutable std::mutex mMutex;
+  std::unordered_map<std::string, entry> mEntries;
+  bool mDirty;
+  size_t mHits;
+  size_t mMisses;
+};
+
+#endif // HEADERINDEX_H
@@ -6,27 +6,33 @@
 // for windows
 #undef max
 
-#include <cmath>
 #include <cstdint>
 #include <limits>
+#include <type_traits>
 #include <vector>
 
 class Fl_Image;
 
+// global histogram equalization in place, unsigned 8 and 16 bit samples
 template <typename T> void histeq(std::vector<T> &buf) {
-  const T maxval = std::numeric_limits<T>::max();
-  std::vector<uint32_t> hist(maxval);
-  std::vector<uint32_t> new_val(maxval);
-  for (auto &val : buf) {
-    hist[val]++;
+  static_assert(std::is_unsigned<T>::value && sizeof(T) <= 2,
+                "a bin for every value of T");
+  if (buf.empty())
+    return;
+  const uint64_t maxval = std::numeric_limits<T>::max();
+  // the histogram becomes the mapping in place, one bin per value
+  std::vector<uint32_t> map(maxval + 1);
+  for (const T val : buf) {
+    map[val]++;
   }
   uint64_t c = 0;
-  for (auto i = 0; i < maxval; i++) {
-    c += hist[i];
-    new_val[i] = std::ceil(static_cast<double>(c) * maxval / buf.size());
+  for (uint64_t i = 0; i <= maxval; i++) {
+    c += map[i];
+    // ceil(c * maxval / size) without floating point
+    map[i] = (c * maxval + buf.size() - 1) / buf.size();
   }
-  for (auto i = 0; i < buf.size(); i++) {
-    buf[i] = new_val[buf[i]];
+  for (size_t i = 0; i < buf.size(); i++) {
+    buf[i] = static_cast<T>(map[buf[i]]);
   }
 }
 
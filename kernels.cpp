@@ -0,0 +1,390 @@
+#include "kernels.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PDV_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(PDV_X86) && defined(__SSE2__)
+#define PDV_SSE2 1
+#endif
+
+bool hasAvx2() {
+#ifdef PDV_X86
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+#else
+  return false;
+#endif
+}
+
+static bool has_ssse3() {
+#ifdef PDV_X86
+  static const bool ssse3 = __builtin_cpu_supports("ssse3");
+  return ssse3;
+#else
+  return false;
+#endif
+}
+
+const char *simdLevel() {
+  if (hasAvx2())
+    return "avx2";
+#ifdef PDV_SSE2
+  return "sse2";
+#else
+  return "none";
+#endif
+}
+
+void histogram16(const uint16_t *in, size_t count, uint16_t flip,
+                 uint32_t *hist) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    hist[in[i] ^ flip]++;
+    hist[in[i + 1] ^ flip]++;
+    hist[in[i + 2] ^ flip]++;
+    hist[in[i + 3] ^ flip]++;
+  }
+  for (; i < count; i++) {
+    hist[in[i] ^ flip]++;
+  }
+}
+
+void equalizationLut(const uint32_t *hist, uint64_t count, uint8_t *lut) {
+  if (count == 0) {
+    memset(lut, 0, lut_entries);
+    return;
+  }
+  uint64_t c = 0;
+  for (size_t i = 0; i < lut_entries; i++) {
+    c += hist[i];
+    // ceil(c * 255 / count) without floating point
+    lut[i] = static_cast<uint8_t>((c * 255 + count - 1) / count);
+  }
+}
+
+static void applyLut16Scalar(const uint16_t *in, size_t count, uint16_t flip,
+                             const uint8_t *lut, uint8_t *out) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    out[i] = lut[in[i] ^ flip];
+    out[i + 1] = lut[in[i + 1] ^ flip];
+    out[i + 2] = lut[in[i + 2] ^ flip];
+    out[i + 3] = lut[in[i + 3] ^ flip];
+  }
+  for (; i < count; i++) {
+    out[i] = lut[in[i] ^ flip];
+  }
+}
+
+#ifdef PDV_X86
+__attribute__((target("avx2"))) static void
+applyLut16Avx2(const uint16_t *in, size_t count, uint16_t flip,
+               const uint8_t *lut, uint8_t *out) {
+  const __m256i vflip = _mm256_set1_epi16(static_cast<short>(flip));
+  const __m256i low_byte = _mm256_set1_epi32(0xFF);
+  const int *base = reinterpret_cast<const int *>(lut);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256i samples =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+    samples = _mm256_xor_si256(samples, vflip);
+    const __m256i lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(samples));
+    const __m256i hi =
+        _mm256_cvtepu16_epi32(_mm256_extracti128_si256(samples, 1));
+    // byte granular gathers, the upper 3 bytes belong to the next entries
+    const __m256i vlo =
+        _mm256_and_si256(_mm256_i32gather_epi32(base, lo, 1), low_byte);
+    const __m256i vhi =
+        _mm256_and_si256(_mm256_i32gather_epi32(base, hi, 1), low_byte);
+    // packs work per 128 bit lane, restore the order of the 64 bit blocks
+    __m256i words = _mm256_packus_epi32(vlo, vhi);
+    words = _mm256_permute4x64_epi64(words, _MM_SHUFFLE(3, 1, 2, 0));
+    const __m128i bytes = _mm_packus_epi16(_mm256_castsi256_si128(words),
+                                           _mm256_extracti128_si256(words, 1));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), bytes);
+  }
+  applyLut16Scalar(in + i, count - i, flip, lut, out + i);
+}
+#endif
+
+void applyLut16(const uint16_t *in, size_t count, uint16_t flip,
+                const uint8_t *lut, uint8_t *out) {
+#ifdef PDV_X86
+  if (hasAvx2()) {
+    applyLut16Avx2(in, count, flip, lut, out);
+    return;
+  }
+#endif
+  applyLut16Scalar(in, count, flip, lut, out);
+}
+
+void flip8(const uint8_t *in, size_t count, uint8_t flip, uint8_t *out) {
+  size_t i = 0;
+#ifdef PDV_SSE2
+  const __m128i vflip = _mm_set1_epi8(static_cast<char>(flip));
+  for (; i + 16 <= count; i += 16) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     _mm_xor_si128(v, vflip));
+  }
+#endif
+  for (; i < count; i++) {
+    out[i] = in[i] ^ flip;
+  }
+}
+
+void binarize8(const uint8_t *in, size_t count, uint8_t value, uint8_t *out) {
+  size_t i = 0;
+#ifdef PDV_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i vvalue = _mm_set1_epi8(static_cast<char>(value));
+  for (; i + 16 <= count; i += 16) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    const __m128i is_zero = _mm_cmpeq_epi8(v, zero);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     _mm_andnot_si128(is_zero, vvalue));
+  }
+#endif
+  for (; i < count; i++) {
+    out[i] = in[i] != 0 ? value : 0;
+  }
+}
+
+void mergeBytes16(const uint8_t *low, const uint8_t *high, size_t count,
+                  uint16_t *out) {
+  size_t i = 0;
+#ifdef PDV_SSE2
+  for (; i + 16 <= count; i += 16) {
+    const __m128i l =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(low + i));
+    const __m128i h =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(high + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     _mm_unpacklo_epi8(l, h));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i + 8),
+                     _mm_unpackhi_epi8(l, h));
+  }
+#endif
+  for (; i < count; i++) {
+    out[i] = static_cast<uint16_t>(high[i] << 8 | low[i]);
+  }
+}
+
+#ifdef PDV_X86
+namespace {
+// pshufb masks, 0x80 clears the byte
+struct shuffle_masks {
+  // rgb bytes of output vector o from plane p
+  uint8_t interleave[3][3][16];
+  // plane p from input vector v
+  uint8_t deinterleave[3][3][16];
+  // Y Y Cb Cr groups of pixels 0-7 (v = 0) and 8-15 (v = 1)
+  uint8_t luma[2][16];
+  uint8_t blue[2][16];
+  uint8_t red[2][16];
+
+  shuffle_masks() {
+    for (int o = 0; o < 3; o++) {
+      for (int p = 0; p < 3; p++) {
+        for (int j = 0; j < 16; j++) {
+          const int k = 16 * o + j;
+          interleave[o][p][j] = k % 3 == p ? k / 3 : 0x80;
+          const int source = 3 * j + p;
+          deinterleave[p][o][j] = source / 16 == o ? source % 16 : 0x80;
+        }
+      }
+    }
+    for (int v = 0; v < 2; v++) {
+      for (int j = 0; j < 16; j++) {
+        const bool inside = j / 8 == v;
+        const int group = 4 * ((j % 8) / 2);
+        luma[v][j] = inside ? group + j % 2 : 0x80;
+        blue[v][j] = inside ? group + 2 : 0x80;
+        red[v][j] = inside ? group + 3 : 0x80;
+      }
+    }
+  }
+};
+} // namespace
+
+static const shuffle_masks &masks() {
+  static const shuffle_masks m;
+  return m;
+}
+
+__attribute__((target("ssse3"))) static inline __m128i
+load(const uint8_t *p) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+}
+
+__attribute__((target("ssse3"))) static inline void
+store_rgb(__m128i r, __m128i g, __m128i b, const __m128i (&m)[3][3],
+          uint8_t *out) {
+  for (int o = 0; o < 3; o++) {
+    const __m128i rg = _mm_or_si128(_mm_shuffle_epi8(r, m[o][0]),
+                                    _mm_shuffle_epi8(g, m[o][1]));
+    const __m128i v = _mm_or_si128(rg, _mm_shuffle_epi8(b, m[o][2]));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 16 * o), v);
+  }
+}
+
+// 8 pixels in 16 bit lanes, see ybrToRgb()
+__attribute__((target("ssse3"))) static inline void
+ybr_lanes(__m128i y, __m128i cb, __m128i cr, __m128i &r, __m128i &g,
+          __m128i &b) {
+  const __m128i half = _mm_set1_epi16(128);
+  const __m128i round = _mm_set1_epi16(4);
+  const __m128i b7 = _mm_slli_epi16(_mm_sub_epi16(cb, half), 7);
+  const __m128i r7 = _mm_slli_epi16(_mm_sub_epi16(cr, half), 7);
+  const __m128i red = _mm_mulhi_epi16(r7, _mm_set1_epi16(5743));
+  const __m128i green =
+      _mm_add_epi16(_mm_mulhi_epi16(b7, _mm_set1_epi16(1410)),
+                    _mm_mulhi_epi16(r7, _mm_set1_epi16(2925)));
+  const __m128i blue = _mm_mulhi_epi16(b7, _mm_set1_epi16(7258));
+  r = _mm_add_epi16(y, _mm_srai_epi16(_mm_add_epi16(red, round), 3));
+  g = _mm_sub_epi16(y, _mm_srai_epi16(_mm_add_epi16(green, round), 3));
+  b = _mm_add_epi16(y, _mm_srai_epi16(_mm_add_epi16(blue, round), 3));
+}
+
+// 16 pixels, saturated to bytes
+__attribute__((target("ssse3"))) static inline void
+ybr_bytes(__m128i y, __m128i cb, __m128i cr, __m128i &r, __m128i &g,
+          __m128i &b) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i lo[3];
+  __m128i hi[3];
+  ybr_lanes(_mm_unpacklo_epi8(y, zero), _mm_unpacklo_epi8(cb, zero),
+            _mm_unpacklo_epi8(cr, zero), lo[0], lo[1], lo[2]);
+  ybr_lanes(_mm_unpackhi_epi8(y, zero), _mm_unpackhi_epi8(cb, zero),
+            _mm_unpackhi_epi8(cr, zero), hi[0], hi[1], hi[2]);
+  r = _mm_packus_epi16(lo[0], hi[0]);
+  g = _mm_packus_epi16(lo[1], hi[1]);
+  b = _mm_packus_epi16(lo[2], hi[2]);
+}
+
+__attribute__((target("ssse3"))) static size_t
+interleave8_ssse3(const uint8_t *r, const uint8_t *g, const uint8_t *b,
+                  size_t count, uint8_t *out) {
+  __m128i m[3][3];
+  for (int o = 0; o < 3; o++) {
+    for (int p = 0; p < 3; p++) {
+      m[o][p] = load(masks().interleave[o][p]);
+    }
+  }
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    store_rgb(load(r + i), load(g + i), load(b + i), m, out + 3 * i);
+  }
+  return i;
+}
+
+__attribute__((target("ssse3"))) static size_t
+ybr_ssse3(const uint8_t *y, const uint8_t *cb, const uint8_t *cr,
+          size_t count, int step, uint8_t *out) {
+  __m128i m[3][3];
+  __m128i d[3][3];
+  for (int o = 0; o < 3; o++) {
+    for (int p = 0; p < 3; p++) {
+      m[o][p] = load(masks().interleave[o][p]);
+      d[p][o] = load(masks().deinterleave[p][o]);
+    }
+  }
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i planes[3];
+    if (step == 1) {
+      planes[0] = load(y + i);
+      planes[1] = load(cb + i);
+      planes[2] = load(cr + i);
+    } else {
+      const __m128i in[3] = {load(y + 3 * i), load(y + 3 * i + 16),
+                             load(y + 3 * i + 32)};
+      for (int p = 0; p < 3; p++) {
+        planes[p] = _mm_or_si128(
+            _mm_or_si128(_mm_shuffle_epi8(in[0], d[p][0]),
+                         _mm_shuffle_epi8(in[1], d[p][1])),
+            _mm_shuffle_epi8(in[2], d[p][2]));
+      }
+    }
+    __m128i r, g, b;
+    ybr_bytes(planes[0], planes[1], planes[2], r, g, b);
+    store_rgb(r, g, b, m, out + 3 * i);
+  }
+  return i;
+}
+
+__attribute__((target("ssse3"))) static size_t
+ybr422_ssse3(const uint8_t *in, size_t count, uint8_t *out) {
+  __m128i m[3][3];
+  for (int o = 0; o < 3; o++) {
+    for (int p = 0; p < 3; p++) {
+      m[o][p] = load(masks().interleave[o][p]);
+    }
+  }
+  const __m128i luma[2] = {load(masks().luma[0]), load(masks().luma[1])};
+  const __m128i blue[2] = {load(masks().blue[0]), load(masks().blue[1])};
+  const __m128i red[2] = {load(masks().red[0]), load(masks().red[1])};
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m128i v0 = load(in + 2 * i);
+    const __m128i v1 = load(in + 2 * i + 16);
+    // the chroma of each pair is duplicated while it is gathered
+    const __m128i y = _mm_or_si128(_mm_shuffle_epi8(v0, luma[0]),
+                                   _mm_shuffle_epi8(v1, luma[1]));
+    const __m128i cb = _mm_or_si128(_mm_shuffle_epi8(v0, blue[0]),
+                                    _mm_shuffle_epi8(v1, blue[1]));
+    const __m128i cr = _mm_or_si128(_mm_shuffle_epi8(v0, red[0]),
+                                    _mm_shuffle_epi8(v1, red[1]));
+    __m128i r, g, b;
+    ybr_bytes(y, cb, cr, r, g, b);
+    store_rgb(r, g, b, m, out + 3 * i);
+  }
+  return i;
+}
+#endif
+
+void interleave8(const uint8_t *r, const uint8_t *g, const uint8_t *b,
+                 size_t count, uint8_t *out) {
+  size_t i = 0;
+#ifdef PDV_X86
+  if (has_ssse3())
+    i = interleave8_ssse3(r, g, b, count, out);
+#endif
+  for (; i < count; i++) {
+    out[3 * i] = r[i];
+    out[3 * i + 1] = g[i];
+    out[3 * i + 2] = b[i];
+  }
+}
+
+void ybrToRgb8(const uint8_t *y, const uint8_t *cb, const uint8_t *cr,
+               size_t count, int step, uint8_t *out) {
+  size_t i = 0;
+#ifdef PDV_X86
+  if (has_ssse3() && (step == 1 || (step == 3 && cb == y + 1 && cr == y + 2)))
+    i = ybr_ssse3(y, cb, cr, count, step, out);
+#endif
+  for (; i < count; i++) {
+    ybrToRgb(y[i * step], cb[i * step], cr[i * step], out + 3 * i);
+  }
+}
+
+void ybr422ToRgb8(const uint8_t *in, size_t count, uint8_t *out) {
+  size_t i = 0;
+#ifdef PDV_X86
+  if (has_ssse3())
+    i = ybr422_ssse3(in, count, out);
+#endif
+  for (; i + 2 <= count; i += 2) {
+    const uint8_t *group = in + 2 * i;
+    ybrToRgb(group[0], group[2], group[3], out + 3 * i);
+    ybrToRgb(group[1], group[2], group[3], out + 3 * i + 3);
+  }
+}
@@ -0,0 +1,64 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Inner loops of the display conversion. Every kernel picks the widest
+// implementation the cpu supports at runtime (AVX2, SSE2 or plain C++).
+
+// entries of a 16 bit lookup table
+const size_t lut_entries = 65536;
+// a lut has to be allocated with this many extra bytes at the end, the
+// AVX2 kernel gathers 4 bytes from the last entry
+const size_t lut_padding = 3;
+
+// hist has lut_entries bins, sample ^ flip is counted
+void histogram16(const uint16_t *in, size_t count, uint16_t flip,
+                 uint32_t *hist);
+// maps the histogram of count samples to evenly distributed 8 bit values
+void equalizationLut(const uint32_t *hist, uint64_t count, uint8_t *lut);
+// out[i] = lut[in[i] ^ flip]
+void applyLut16(const uint16_t *in, size_t count, uint16_t flip,
+                const uint8_t *lut, uint8_t *out);
+// out[i] = in[i] ^ flip
+void flip8(const uint8_t *in, size_t count, uint8_t flip, uint8_t *out);
+// out[i] = in[i] != 0 ? value : 0
+void binarize8(const uint8_t *in, size_t count, uint8_t value, uint8_t *out);
+// out[i] = high[i] << 8 | low[i], e.g. the byte planes of RLE segments
+void mergeBytes16(const uint8_t *low, const uint8_t *high, size_t count,
+                  uint16_t *out);
+
+// One YBR_FULL pixel to RGB (PS3.3 C.7.6.3.1.2). The chroma terms are
+// computed with 3 fractional bits like in the SIMD kernels, so every path
+// gives the same colours.
+inline void ybrToRgb(int y, int cb, int cr, uint8_t *rgb) {
+  const int b = (cb - 128) * 128;
+  const int r = (cr - 128) * 128;
+  const int red = y + ((((r * 5743) >> 16) + 4) >> 3);
+  const int green =
+      y - ((((b * 1410) >> 16) + ((r * 2925) >> 16) + 4) >> 3);
+  const int blue = y + ((((b * 7258) >> 16) + 4) >> 3);
+  rgb[0] = red < 0 ? 0 : red > 255 ? 255 : red;
+  rgb[1] = green < 0 ? 0 : green > 255 ? 255 : green;
+  rgb[2] = blue < 0 ? 0 : blue > 255 ? 255 : blue;
+}
+
+// The colour kernels write count interleaved RGB pixels. The SIMD versions
+// need SSSE3 for the byte shuffles.
+// planar RGB
+void interleave8(const uint8_t *r, const uint8_t *g, const uint8_t *b,
+                 size_t count, uint8_t *out);
+// YBR_FULL, planar if step is 1, interleaved with cb and cr following y if
+// step is 3
+void ybrToRgb8(const uint8_t *y, const uint8_t *cb, const uint8_t *cr,
+               size_t count, int step, uint8_t *out);
+// YBR_FULL_422: Y Y Cb Cr for every pair of pixels, count is even
+void ybr422ToRgb8(const uint8_t *in, size_t count, uint8_t *out);
+
+// name of the instruction set the kernels use
+const char *simdLevel();
+// true if the cpu runs AVX2 code
+bool hasAvx2();
+
+#endif // KERNELS_H
@@ -0,0 +1,324 @@
+#include "loader.h"
+
+#include "mappedio.h"
+
+#include <FL/Fl.H>
+
+#include <cstdio>
+#include <map>
+#include <utility>
+
+load_result::~load_result() {
+  frame = decoded_frame();
+  frames.reset();
+  if (dataset)
+    dcm_dataset_destroy(dataset);
+  // the filehandle owns the io
+  if (filehandle)
+    dcm_filehandle_destroy(filehandle);
+  else if (io)
+    dcm_io_close(io);
+}
+
+// progress or result of a load, handed to the main thread
+struct Loader::message {
+  // see live_loaders(), the loader may be gone when the message arrives
+  unsigned int loader;
+  unsigned int generation;
+  const char *stage;
+  float fraction;
+  // set when the load is done
+  std::unique_ptr<load_result> result;
+};
+
+// loaders by id, only used on the main thread
+static std::map<unsigned int, Loader *> &live_loaders() {
+  static std::map<unsigned int, Loader *> loaders;
+  return loaders;
+}
+
+Loader::Loader(progress_callback progress, done_callback done)
+    : mProgress(std::move(progress)), mDone(std::move(done)), mGeneration(0),
+      mBusy(false), mStop(false), mIndex(HeaderIndex::defaultPath()),
+      mIndexLoaded(false) {
+  static unsigned int next_id = 0;
+  mId = ++next_id;
+  live_loaders()[mId] = this;
+  mWorker = std::thread(&Loader::run, this);
+}
+
+Loader::~Loader() {
+  // messages still queued are dropped by onAwake()
+  live_loaders().erase(mId);
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStop = true;
+    mPending.reset();
+    ++mGeneration;
+  }
+  mWake.notify_one();
+  mWorker.join();
+}
+
+void Loader::submit(std::unique_ptr<job> request) {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    request->generation = ++mGeneration;
+    mPending = std::move(request);
+    mBusy = true;
+  }
+  mWake.notify_one();
+}
+
+void Loader::load(const std::string &file, int width, int height) {
+  std::unique_ptr<job> request(new job);
+  request->kind = job_kind::file;
+  request->file = file;
+  request->width = width;
+  request->height = height;
+  submit(std::move(request));
+}
+
+void Loader::loadSeries(const std::string &directory) {
+  std::unique_ptr<job> request(new job);
+  request->kind = job_kind::series;
+  request->file = directory;
+  request->width = 0;
+  request->height = 0;
+  submit(std::move(request));
+}
+
+void Loader::loadSeries(const std::vector<slice_info> &slices) {
+  std::unique_ptr<job> request(new job);
+  request->kind = job_kind::series;
+  request->width = 0;
+  request->height = 0;
+  request->slices = slices;
+  submit(std::move(request));
+}
+
+void Loader::loadCatalog(const std::string &directory) {
+  std::unique_ptr<job> request(new job);
+  request->kind = job_kind::catalog;
+  request->file = directory;
+  request->width = 0;
+  request->height = 0;
+  submit(std::move(request));
+}
+
+void Loader::cancel() {
+  std::lock_guard<std::mutex> lock(mMutex);
+  ++mGeneration;
+  mPending.reset();
+  mBusy = false;
+}
+
+bool Loader::cancelled(unsigned int generation) const {
+  return generation != mGeneration;
+}
+
+void Loader::run() {
+  for (;;) {
+    std::unique_ptr<job> request;
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mWake.wait(lock, [this] { return mStop || mPending; });
+      if (mStop)
+        return;
+      request = std::move(mPending);
+    }
+    switch (request->kind) {
+    case job_kind::file:
+      process(*request);
+      break;
+    case job_kind::series:
+      processSeries(*request);
+      break;
+    case job_kind::catalog:
+      processCatalog(*request);
+      break;
+    }
+  }
+}
+
+void Loader::post(message *msg) {
+  msg->loader = mId;
+  // fails if the message queue is full, only the result must not get lost
+  while (Fl::awake(&Loader::onAwake, msg) != 0) {
+    if (!msg->result) {
+      delete msg;
+      return;
+    }
+    if (cancelled(msg->generation)) {
+      delete msg;
+      return;
+    }
+    std::this_thread::yield();
+  }
+}
+
+void Loader::onAwake(void *data) {
+  std::unique_ptr<message> msg(static_cast<message *>(data));
+  const auto found = live_loaders().find(msg->loader);
+  if (found == live_loaders().end())
+    return;
+  Loader *loader = found->second;
+  if (loader->cancelled(msg->generation))
+    return;
+  if (!msg->result) {
+    if (loader->mProgress)
+      loader->mProgress(msg->stage, msg->fraction);
+    return;
+  }
+  loader->mBusy = false;
+  if (loader->mDone)
+    loader->mDone(std::move(msg->result));
+}
+
+void Loader::process(const job &request) {
+  const unsigned int generation = request.generation;
+  auto progress = [this, generation](const char *stage, float fraction) {
+    message *msg = new message;
+    msg->generation = generation;
+    msg->stage = stage;
+    msg->fraction = fraction;
+    post(msg);
+  };
+
+  std::unique_ptr<load_result> result(new load_result);
+  result->file = request.file;
+
+  progress("Opening", 0.0f);
+  DcmError *error = nullptr;
+  result->io = openMappedFile(&error, request.file.c_str());
+  if (result->io)
+    result->filehandle = dcm_filehandle_create(&error, result->io);
+  if (cancelled(generation))
+    return;
+
+  if (result->filehandle) {
+    progress("Reading header", 0.25f);
+    result->meta = dcm_filehandle_get_file_meta(&error, result->filehandle);
+    if (result->meta)
+      result->dataset =
+          dcm_filehandle_read_metadata(&error, result->filehandle, nullptr);
+  }
+  if (error) {
+    result->error = dcm_error_get_message(error);
+    printf("%s\n", result->error.c_str());
+    dcm_error_destroy(error);
+    error = nullptr;
+  }
+  if (cancelled(generation))
+    return;
+
+  if (result->dataset) {
+    progress("Reading frame", 0.5f);
+    result->frames.reset(new FrameSource(result->dataset, result->meta,
+                                         result->io, result->filehandle,
+                                         result->file));
+    if (cancelled(generation))
+      return;
+    progress("Decoding", 0.75f);
+    result->frame = decodeFrame(result->dataset, result->meta,
+                                *result->frames, 0, request.width,
+                                request.height);
+    if (!result->frames->error().empty())
+      result->error = result->frames->error();
+  } else if (result->error.empty()) {
+    result->error = "cannot open " + request.file;
+  }
+  if (cancelled(generation))
+    return;
+
+  message *msg = new message;
+  msg->generation = generation;
+  msg->stage = "Done";
+  msg->fraction = 1.0f;
+  msg->result = std::move(result);
+  post(msg);
+}
+
+std::vector<slice_info> Loader::scan(const job &request, bool recursive) {
+  const unsigned int generation = request.generation;
+  if (!mIndexLoaded) {
+    mIndex.load();
+    mIndexLoaded = true;
+  }
+  std::vector<slice_info> slices = scanDirectory(
+      request.file,
+      [this, generation](size_t done, size_t total) {
+        if (cancelled(generation))
+          return false;
+        message *msg = new message;
+        msg->generation = generation;
+        msg->stage = "Reading headers";
+        msg->fraction = total ? static_cast<float>(done) / total : 0.0f;
+        post(msg);
+        return true;
+      },
+      recursive, &mIndex);
+  // also keeps what was read before a cancel
+  mIndex.save();
+  return slices;
+}
+
+void Loader::processSeries(const job &request) {
+  const unsigned int generation = request.generation;
+  std::unique_ptr<load_result> result(new load_result);
+  result->file = request.file;
+  std::vector<std::vector<slice_info>> series;
+  if (request.slices.empty())
+    series = groupSeries(scan(request, false));
+  else
+    series.push_back(request.slices);
+  if (cancelled(generation))
+    return;
+  if (series.empty()) {
+    result->error = "no images in " + request.file;
+  } else {
+    result->slices = std::move(series.front());
+    if (result->file.empty())
+      result->file = result->slices.front().seriesDescription;
+    result->series = loadVolume(
+        result->slices, [this, generation](size_t done, size_t total) {
+          if (cancelled(generation))
+            return false;
+          message *msg = new message;
+          msg->generation = generation;
+          msg->stage = "Decoding slices";
+          msg->fraction = total ? static_cast<float>(done) / total : 0.0f;
+          post(msg);
+          return true;
+        });
+    if (result->series.pixels.empty())
+      result->error = "cannot decode the series";
+  }
+  if (cancelled(generation))
+    return;
+
+  message *msg = new message;
+  msg->generation = generation;
+  msg->stage = "Done";
+  msg->fraction = 1.0f;
+  msg->result = std::move(result);
+  post(msg);
+}
+
+void Loader::processCatalog(const job &request) {
+  const unsigned int generation = request.generation;
+  std::unique_ptr<load_result> result(new load_result);
+  result->file = request.file;
+  result->catalog = groupSeries(scan(request, true));
+  if (cancelled(generation))
+    return;
+  if (result->catalog.empty())
+    result->error = "no images in " + request.file;
+
+  message *msg = new message;
+  msg->generation = generation;
+  msg->stage = "Done";
+  msg->fraction = 1.0f;
+  msg->result = std::move(result);
+  post(msg);
+}
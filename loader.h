@@ -0,0 +1,118 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+extern "C" {
+#include <dicom/dicom.h>
+}
+
+#include "framesource.h"
+#include "headerindex.h"
+#include "series.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// An opened file with its first frame decoded, or a series decoded into a
+// volume. Releases everything it holds.
+struct load_result {
+  load_result() = default;
+  load_result(const load_result &) = delete;
+  load_result &operator=(const load_result &) = delete;
+  ~load_result();
+
+  std::string file;
+  DcmIO *io{nullptr};
+  // owns io once it is created
+  DcmFilehandle *filehandle{nullptr};
+  DcmDataSet *dataset{nullptr};
+  const DcmDataSet *meta{nullptr};
+  std::unique_ptr<FrameSource> frames;
+  // may point into the frames, so it is released first
+  decoded_frame frame;
+  // series loads only, the slices of the volume in order
+  std::vector<slice_info> slices;
+  volume series;
+  // catalog loads only, every series found, see groupSeries()
+  std::vector<std::vector<slice_info>> catalog;
+  std::string error;
+};
+
+// Opens and decodes files on a worker thread, so that the ui stays
+// responsive. The callbacks are called on the main thread through
+// Fl::awake(), so Fl::lock() has to be called before the first Loader is
+// created. Starting a new load cancels the current one, a cancelled load is
+// abandoned at the next stage and never reported. A Loader is created and
+// destroyed on the main thread, messages of a destroyed one are dropped.
+class Loader {
+public:
+  // stage name and fraction done in [0, 1]
+  typedef std::function<void(const char *, float)> progress_callback;
+  typedef std::function<void(std::unique_ptr<load_result>)> done_callback;
+
+  Loader(progress_callback progress, done_callback done);
+  Loader(const Loader &) = delete;
+  Loader &operator=(const Loader &) = delete;
+  Loader(Loader &&) = delete;
+  Loader &operator=(Loader &&) = delete;
+  ~Loader();
+
+public:
+  // see decodeFrame() for width and height
+  void load(const std::string &file, int width, int height);
+  // the largest series of the directory
+  void loadSeries(const std::string &directory);
+  // slices of a series found by loadCatalog()
+  void loadSeries(const std::vector<slice_info> &slices);
+  // lists the series of a directory tree, known headers come from the
+  // header index
+  void loadCatalog(const std::string &directory);
+  void cancel();
+  bool busy() const { return mBusy; }
+
+private:
+  enum class job_kind { file, series, catalog };
+  struct job {
+    job_kind kind;
+    std::string file;
+    int width;
+    int height;
+    std::vector<slice_info> slices;
+    unsigned int generation;
+  };
+  struct message;
+
+  void submit(std::unique_ptr<job> request);
+  void run();
+  void process(const job &request);
+  void processSeries(const job &request);
+  void processCatalog(const job &request);
+  std::vector<slice_info> scan(const job &request, bool recursive);
+  bool cancelled(unsigned int generation) const;
+  void post(message *msg);
+  static void onAwake(void *data);
+
+private:
+  // identifies the loader in its messages
+  unsigned int mId;
+  progress_callback mProgress;
+  done_callback mDone;
+  // bumped by every load and cancel, work of older generations is dropped
+  std::atomic<unsigned int> mGeneration;
+  std::atomic<bool> mBusy;
+  std::mutex mMutex;
+  std::condition_variable mWake;
+  // only the latest request is kept
+  std::unique_ptr<job> mPending;
+  bool mStop;
+  // only used by the worker
+  HeaderIndex mIndex;
+  bool mIndexLoaded;
+  std::thread mWorker;
+};
+
+#endif // LOADER_H
@@ -2,6 +2,9 @@
 #include <FL/Fl.H>
 
 int main(int, char **) {
+  // files are loaded on worker threads, see Loader, which start with the
+  // window
+  Fl::lock();
   MainWindow w(0, 0, 800, 600);
   w.show();
   return Fl::run();
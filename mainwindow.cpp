@@ -1,28 +1,60 @@
 #include "mainwindow.h"
 
+#include "cine.h"
 #include "compression.h"
 #include "dicomhelpers.h"
-#include "imagehelpers.h"
+#include "display.h"
+#include "framecache.h"
+#include "framesource.h"
+#include "loader.h"
+#include "seriesbrowser.h"
+#include "viewport.h"
 
 #include <FL/Enumerations.H>
+#include <FL/Fl.H>
+#include <FL/fl_ask.H>
 #include <FL/Fl_Box.H>
 #include <FL/Fl_Menu_Bar.H>
 #include <FL/Fl_Multiline_Output.H>
 #include <FL/Fl_Native_File_Chooser.H>
-#include <FL/Fl_RGB_Image.H>
+#include <FL/Fl_Progress.H>
 
 #include <algorithm>
+#include <cmath>
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <iostream>
-#include <list>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
+// onWindow() arguments besides the index of a DICOM preset
+static const int equalize_preset = -1;
+static const int full_range_preset = -2;
+static const int clahe_preset = -3;
+
 MainWindow::MainWindow(int x, int y, int w, int h, const char *l)
     : Fl_Double_Window(x, y, w, h, l), mDataSet(nullptr), mMeta(nullptr),
-      mIO(nullptr), mFilehandle(nullptr) {
+      mIO(nullptr), mFilehandle(nullptr), mFitToWindow(true), mFrameIndex(0),
+      mSlice(0), mFullWidth(0), mFullHeight(0), mDetailPending(false),
+      mDetailZoom(0.0),
+      mWindowMode(false), mClahe(false),
+      mWindowStep(1.0),
+      mLutFormat(sample_format::u8), mLutSlope(1.0), mLutIntercept(0.0),
+      mLutInvert(false),
+      mDragging(false), mDragX(0), mDragY(0),
+      mLoader(
+          [this](const char *stage, float fraction) {
+            onProgress(stage, fraction);
+          },
+          [this](std::unique_ptr<load_result> result) {
+            onLoaded(std::move(result));
+          }),
+      mAreaDecoder([this](image_data detail, const image_area &area) {
+        onDetailDecoded(std::move(detail), area);
+      }) {
   begin();
   mMenu = new Fl_Menu_Bar(x, y, w, 30, "menu");
   mMenu->add(
@@ -31,101 +63,847 @@ MainWindow::MainWindow(int x, int y, int w, int h, const char *l)
         reinterpret_cast<MainWindow *>(data)->onOpenDICOM();
       },
       this);
-  mImageInfo = new Fl_Multiline_Output(x, y + 30, w, 90);
-  mImageDisplay = new Fl_Box(x, y + 120, w, h - 120);
-  mImageDisplay->align(FL_ALIGN_CENTER | FL_ALIGN_INSIDE | FL_ALIGN_CLIP);
-  mImageDisplay->box(FL_FLAT_BOX);
+  mMenu->add(
+      "&File/Open &series", 0,
+      [](Fl_Widget *, void *data) {
+        reinterpret_cast<MainWindow *>(data)->onOpenSeries();
+      },
+      this);
+  mMenu->add(
+      "&File/&Browse archive...", 0,
+      [](Fl_Widget *, void *data) {
+        reinterpret_cast<MainWindow *>(data)->onBrowseArchive();
+      },
+      this);
+  mMenu->add(
+      "&View/&Fit to window", 0,
+      [](Fl_Widget *, void *data) {
+        reinterpret_cast<MainWindow *>(data)->onFitToWindow(true);
+      },
+      this, FL_MENU_RADIO | FL_MENU_VALUE);
+  mMenu->add(
+      "&View/&Actual pixels", 0,
+      [](Fl_Widget *, void *data) {
+        reinterpret_cast<MainWindow *>(data)->onFitToWindow(false);
+      },
+      this, FL_MENU_RADIO);
+  mMenu->add(
+      "&View/Zoom &in", FL_COMMAND + '=',
+      [](Fl_Widget *, void *data) {
+        reinterpret_cast<MainWindow *>(data)->onZoom(1.25);
+      },
+      this);
+  mMenu->add(
+      "&View/Zoom &out", FL_COMMAND + '-',
+      [](Fl_Widget *, void *data) {
+        reinterpret_cast<MainWindow *>(data)->onZoom(0.8);
+      },
+      this, FL_MENU_DIVIDER);
+  mMenu->add(
+      "&View/Scaling: &nearest", 0,
+      [](Fl_Widget *, void *data) {
+        reinterpret_cast<MainWindow *>(data)->onResampleFilter(
+            resample_filter::nearest);
+      },
+      this, FL_MENU_RADIO);
+  mMenu->add(
+      "&View/Scaling: &bilinear", 0,
+      [](Fl_Widget *, void *data) {
+        reinterpret_cast<MainWindow *>(data)->onResampleFilter(
+            resample_filter::bilinear);
+      },
+      this, FL_MENU_RADIO | FL_MENU_VALUE);
+  mMenu->add(
+      "&View/Scaling: &Lanczos", 0,
+      [](Fl_Widget *, void *data) {
+        reinterpret_cast<MainWindow *>(data)->onResampleFilter(
+            resample_filter::lanczos);
+      },
+      this, FL_MENU_RADIO | FL_MENU_DIVIDER);
+  mMenu->add(
+      "&View/&Play cine", 0,
+      [](Fl_Widget *w, void *data) {
+        const Fl_Menu_Item *item = static_cast<Fl_Menu_Bar *>(w)->mvalue();
+        reinterpret_cast<MainWindow *>(data)->onCine(item && item->value());
+      },
+      this, FL_MENU_TOGGLE);
+  mMenu->add(
+      "&Window/&Equalize histogram", 0,
+      [](Fl_Widget *, void *data) {
+        reinterpret_cast<MainWindow *>(data)->onWindow(equalize_preset);
+      },
+      this);
+  mMenu->add(
+      "&Window/&Adaptive equalization (CLAHE)", 0,
+      [](Fl_Widget *, void *data) {
+        reinterpret_cast<MainWindow *>(data)->onWindow(clahe_preset);
+      },
+      this);
+  mMenu->add(
+      "&Window/&Full range", 0,
+      [](Fl_Widget *, void *data) {
+        reinterpret_cast<MainWindow *>(data)->onWindow(full_range_preset);
+      },
+      this, FL_MENU_DIVIDER);
+  mMenu->add(
+      "&Settings/&Decoder threads...", 0,
+      [](Fl_Widget *, void *data) {
+        reinterpret_cast<MainWindow *>(data)->onDecoderThreads();
+      },
+      this);
+  mMenu->add(
+      "&Settings/&Adaptive equalization...", 0,
+      [](Fl_Widget *, void *data) {
+        reinterpret_cast<MainWindow *>(data)->onClaheSettings();
+      },
+      this);
+  mMenu->add(
+      "&Settings/Frame &cache size...", 0,
+      [](Fl_Widget *, void *data) {
+        reinterpret_cast<MainWindow *>(data)->onCacheSize();
+      },
+      this);
+  mMenu->add(
+      "&Settings/Frame cache &statistics", 0,
+      [](Fl_Widget *, void *data) {
+        reinterpret_cast<MainWindow *>(data)->onCacheStatistics();
+      },
+      this);
+  mMenu->add(
+      "&Settings/Decoder s&tatistics", 0,
+      [](Fl_Widget *, void *data) {
+        reinterpret_cast<MainWindow *>(data)->onDecoderStatistics();
+      },
+      this);
+  mImageInfo = new Fl_Multiline_Output(x, y + 30, w - 200, 90);
+  mProgress = new Fl_Progress(x + w - 195, y + 65, 190, 20);
+  mProgress->minimum(0.0f);
+  mProgress->maximum(1.0f);
+  mProgress->value(0.0f);
+  mCineStatus = new Fl_Box(x + w - 195, y + 90, 190, 25);
+  mCineStatus->align(FL_ALIGN_LEFT | FL_ALIGN_INSIDE);
+  mViewport = new Viewport(x, y + 120, w, h - 120);
+  // zoom and pan may need a more detailed decode of what is in view
+  mViewport->callback(
+      [](Fl_Widget *, void *data) {
+        reinterpret_cast<MainWindow *>(data)->updateDetail();
+      },
+      this);
   end();
 }
 
+MainWindow::~MainWindow() { close(); }
+
 void MainWindow::onOpenDICOM() {
   Fl_Native_File_Chooser chooser;
   if (chooser.show() != 0)
     return;
   if (chooser.count() == 0)
     return;
-  if (!read(chooser.filename(0))) {
+
+  // only decode as much resolution as the display needs, unless the user
+  // wants to see the actual pixels
+  mLoader.load(chooser.filename(0), mFitToWindow ? mViewport->w() : 0,
+               mFitToWindow ? mViewport->h() : 0);
+  onProgress("Loading", 0.0f);
+}
+
+void MainWindow::onOpenSeries() {
+  Fl_Native_File_Chooser chooser;
+  chooser.type(Fl_Native_File_Chooser::BROWSE_DIRECTORY);
+  if (chooser.show() != 0)
+    return;
+  if (chooser.count() == 0)
+    return;
+  mLoader.loadSeries(chooser.filename(0));
+  onProgress("Loading", 0.0f);
+}
+
+void MainWindow::onBrowseArchive() {
+  Fl_Native_File_Chooser chooser;
+  chooser.type(Fl_Native_File_Chooser::BROWSE_DIRECTORY);
+  if (chooser.show() != 0)
+    return;
+  if (chooser.count() == 0)
+    return;
+  mLoader.loadCatalog(chooser.filename(0));
+  onProgress("Loading", 0.0f);
+}
+
+void MainWindow::onProgress(const char *stage, float fraction) {
+  mProgress->label(stage);
+  mProgress->value(fraction);
+  mProgress->redraw();
+}
+
+void MainWindow::onLoaded(std::unique_ptr<load_result> result) {
+  onProgress(result->error.empty() ? "" : "Failed", 1.0f);
+  if (!result->catalog.empty()) {
+    if (!mBrowser) {
+      mBrowser.reset(new SeriesBrowser(
+          640, 400, [this](const std::vector<slice_info> &slices) {
+            mLoader.loadSeries(slices);
+            onProgress("Loading", 0.0f);
+          }));
+    }
+    mBrowser->setCatalog(std::move(result->catalog));
+    mBrowser->show();
     return;
   }
+  if (!result->series.pixels.empty()) {
+    close();
+    mVolume = std::move(result->series);
+    const slice_info &first = result->slices.front();
+    std::string imageInfoText =
+        std::string("Series: ") + result->file + std::string("\n") +
+        std::string("Patient name: ") + first.patientName +
+        std::string("\n") + std::string("Series description: ") +
+        first.seriesDescription + std::string("\n") +
+        std::string("Modality: ") + first.modality + std::string("\n") +
+        std::string("Slices: ") + std::to_string(mVolume.depth);
+    mImageInfo->value(imageInfoText.c_str());
+    mWindowMode = false;
+    setPresets(first.windowCenters, first.windowWidths,
+               first.windowExplanations);
+    showSlice(mVolume.depth / 2);
+    return;
+  }
+  if (!result->dataset) {
+    fl_alert("%s", result->error.c_str());
+    return;
+  }
+
+  close();
+  mIO = result->io;
+  mFilehandle = result->filehandle;
+  mDataSet = result->dataset;
+  mMeta = result->meta;
+  mFrames = std::move(result->frames);
+  result->io = nullptr;
+  result->filehandle = nullptr;
+  result->dataset = nullptr;
+  result->meta = nullptr;
 
-  std::string error;
-  std::list<std::vector<char>> frames =
-      getFrames(mDataSet, mMeta, mIO, mFilehandle, error);
-  const std::string txSyntax = getString(mMeta, 0x00020010);
+  std::string txSyntax = getString(mMeta, 0x00020010);
+  switch (jpeg2000Kind(txSyntax)) {
+  case jpeg2000_kind::classic:
+    txSyntax += " (JPEG 2000)";
+    break;
+  case jpeg2000_kind::high_throughput:
+    txSyntax += " (HTJ2K)";
+    break;
+  case jpeg2000_kind::none:
+    break;
+  }
   std::string patientName = getString(mDataSet, 0x00100010);
   std::string seriesDescription = getString(mDataSet, 0x0008103E);
   std::string modality = getString(mDataSet, 0x00080060);
   std::string imageInfoText =
-      std::string("File: ") + std::string(chooser.filename(0)) +
-      std::string("\n") + std::string("Patient name: ") + patientName +
-      std::string("\n") + std::string("Series description: ") +
-      seriesDescription + std::string("\n") + std::string("Modality: ") +
-      modality + std::string("\n") + std::string("TX Sytnax: ") + txSyntax;
+      std::string("File: ") + result->file + std::string("\n") +
+      std::string("Patient name: ") + patientName + std::string("\n") +
+      std::string("Series description: ") + seriesDescription +
+      std::string("\n") + std::string("Modality: ") + modality +
+      std::string("\n") + std::string("TX Sytnax: ") + txSyntax;
   // std::string("Status: ") + (error.empty() ? "OK" : error);
   mImageInfo->value(imageInfoText.c_str());
 
-  Fl_Image *img = nullptr;
-  if (!frames.empty()) {
-
-    if (dcm_is_encapsulated_transfer_syntax(txSyntax.c_str())) {
-      img = convert(decompressOpenJPEG(frames.front()));
-    } else {
-      unsigned int rows = getNumber(mDataSet, 0x00280010);
-      unsigned int columns = getNumber(mDataSet, 0x00280011);
-      unsigned int ba = getNumber(mDataSet, 0x00280100);
-      std::string pi = getString(mDataSet, 0x00280004);
-      image_data image;
-      image.width = columns;
-      image.height = rows;
-      image.bpp = ba;
-      if (pi == "MONOCHROME2" || pi == "MONOCHROME1") {
-        image.components = 1;
-        image.component0.resize(rows * columns * (ba + 7) / 8);
-      }
+  mWindowMode = false;
+  mFrameIndex = 0;
+  readPresets();
+  showDecoded(result->frame);
+}
 
-      switch (ba) {
-      case 8: {
-        const unsigned int size = columns * rows;
-        char *in = frames.front().data();
-        int *out = image.component0.data();
-        std::copy(in, in + size, out);
-      } break;
-      case 16: {
-        const unsigned int size = columns * rows;
-        short *in = (short *)(frames.front().data());
-        int *out = image.component0.data();
-        std::copy(in, in + size, out);
-      } break;
-      }
+void MainWindow::onFitToWindow(bool fit) {
+  const bool changed = mFitToWindow != fit;
+  mFitToWindow = fit;
+  // frames are decoded at the display size when fitted, so the frame and the
+  // player are decoded again at the new size
+  if (changed && mFrames) {
+    const bool playing = mCine != nullptr;
+    stopCine();
+    showFrame(mFrameIndex);
+    if (playing)
+      startCine();
+  }
+  if (fit)
+    mViewport->fit();
+  else
+    mViewport->zoomAt(1.0, mViewport->w() / 2, mViewport->h() / 2);
+}
 
-      img = convert(image);
+void MainWindow::onZoom(double factor) {
+  mViewport->zoomAt(mViewport->zoom() * factor, mViewport->w() / 2,
+                    mViewport->h() / 2);
+}
+
+void MainWindow::onResampleFilter(resample_filter filter) {
+  mResample.filter = filter;
+  if (!mPyramid.empty())
+    render();
+}
+
+void MainWindow::resize(int x, int y, int w, int h) {
+  Fl_Double_Window::resize(x, y, w, h);
+  // the frame is not decoded again, the pyramid keeps this cheap
+  if (!mPyramid.empty())
+    render();
+}
+
+void MainWindow::showSlice(int z) {
+  if (mVolume.pixels.empty())
+    return;
+  mSlice = std::max(0, std::min(z, mVolume.depth - 1));
+  // the whole series is in memory, nothing to wait for
+  mImage = volumeSlice(mVolume, mSlice);
+  mPyramid = ImagePyramid(mImage);
+  render();
+  const std::string status = std::string("slice ") +
+                             std::to_string(mSlice + 1) + "/" +
+                             std::to_string(mVolume.depth);
+  mCineStatus->copy_label(status.c_str());
+}
+
+void MainWindow::onCine(bool play) {
+  if (play) {
+    startCine();
+  } else {
+    stopCine();
+    updateDetail();
+  }
+}
+
+void MainWindow::startCine() {
+  stopCine();
+  if (!mFrames || mFrames->count() < 2) {
+    mCineStatus->copy_label("single frame");
+    Fl_Menu_Item *item =
+        const_cast<Fl_Menu_Item *>(mMenu->find_item("&View/&Play cine"));
+    if (item)
+      item->clear();
+    return;
+  }
+  const int width = mFitToWindow ? mViewport->w() : 0;
+  const int height = mFitToWindow ? mViewport->h() : 0;
+  mCine.reset(new CinePlayer(mDataSet, mMeta, *mFrames, width, height));
+  Fl::add_timeout(mCine->interval(), &MainWindow::onCineTick, this);
+}
+
+void MainWindow::stopCine() {
+  Fl::remove_timeout(&MainWindow::onCineTick, this);
+  mCine.reset();
+}
+
+void MainWindow::onCineTick(void *data) {
+  static_cast<MainWindow *>(data)->cineTick();
+}
+
+void MainWindow::cineTick() {
+  if (!mCine)
+    return;
+  // a frame that is not decoded yet is waited for until the next one is due
+  const uint64_t sequence = mCine->due();
+  decoded_frame decoded;
+  if (mCine->take(sequence, decoded)) {
+    mFrameIndex = mCine->index(sequence);
+    showDecoded(decoded);
+  }
+  const cine_stats stats = mCine->stats();
+  char status[64];
+  snprintf(status, sizeof(status), "%u/%u  %.1f fps  %llu dropped",
+           mFrameIndex + 1, mFrames->count(), stats.fps,
+           static_cast<unsigned long long>(stats.dropped));
+  mCineStatus->copy_label(status);
+  Fl::repeat_timeout(mCine->interval(), &MainWindow::onCineTick, this);
+}
+
+void MainWindow::onDecoderThreads() {
+  const std::string current = std::to_string(decoderThreads());
+  const char *value = fl_input("Number of JPEG 2000 decoder threads "
+                               "(0 = hardware concurrency):",
+                               current.c_str());
+  if (!value)
+    return;
+  const long threads = atol(value);
+  if (threads < 0)
+    return;
+  setDecoderThreads(threads);
+}
+
+void MainWindow::onCacheSize() {
+  const std::string current = std::to_string(frameCache().budget() >> 20);
+  const char *value =
+      fl_input("Memory for decoded frames in MB (0 = no cache):",
+               current.c_str());
+  if (!value)
+    return;
+  const long megabytes = atol(value);
+  if (megabytes < 0)
+    return;
+  frameCache().setBudget(static_cast<size_t>(megabytes) << 20);
+}
+
+void MainWindow::onClaheSettings() {
+  char current[64];
+  snprintf(current, sizeof(current), "%dx%d %g", mClaheOptions.tilesX,
+           mClaheOptions.tilesY, mClaheOptions.clipLimit);
+  const char *value =
+      fl_input("Tiles across x down and clip limit (0 = no limit):", current);
+  if (!value)
+    return;
+  clahe_options options = mClaheOptions;
+  if (sscanf(value, "%dx%d %lf", &options.tilesX, &options.tilesY,
+             &options.clipLimit) != 3 ||
+      options.tilesX < 1 || options.tilesY < 1 || options.clipLimit < 0)
+    return;
+  mClaheOptions = options;
+  if (mClahe && !mWindowMode && !mImage.pixels.empty())
+    render();
+}
+
+void MainWindow::onCacheStatistics() {
+  const frame_cache_stats stats = frameCache().stats();
+  const uint64_t lookups = stats.hits + stats.misses;
+  fl_message("Frames: %zu, %zu of %zu MB\n"
+             "Hits: %llu, misses: %llu (%.1f%% hit rate)\n"
+             "Evictions: %llu",
+             stats.entries, stats.bytes >> 20, stats.budget >> 20,
+             static_cast<unsigned long long>(stats.hits),
+             static_cast<unsigned long long>(stats.misses),
+             lookups ? 100.0 * stats.hits / lookups : 0.0,
+             static_cast<unsigned long long>(stats.evictions));
+}
+
+void MainWindow::onDecoderStatistics() {
+  const decoder_stats classic = decoderStats(false);
+  const decoder_stats ht = decoderStats(true);
+  auto rate = [](const decoder_stats &s) {
+    return s.seconds > 0 ? s.samples / s.seconds / 1e6 : 0.0;
+  };
+  std::string text;
+  char line[160];
+  snprintf(line, sizeof(line),
+           "JPEG 2000: %llu codestreams, %.1f MB, %.1f Msamples/s\n",
+           static_cast<unsigned long long>(classic.codestreams),
+           classic.bytes / 1048576.0, rate(classic));
+  text += line;
+  snprintf(line, sizeof(line),
+           "HTJ2K: %llu codestreams, %.1f MB, %.1f Msamples/s",
+           static_cast<unsigned long long>(ht.codestreams),
+           ht.bytes / 1048576.0, rate(ht));
+  text += line;
+  if (rate(classic) > 0 && rate(ht) > 0) {
+    snprintf(line, sizeof(line), "\nHTJ2K decodes %.1fx as fast",
+             rate(ht) / rate(classic));
+    text += line;
+  }
+  fl_message("%s", text.c_str());
+}
+
+void MainWindow::showFrame(uint32_t index) {
+  // only decode as much resolution as the display needs, unless the user
+  // wants to see the actual pixels
+  const int width = mFitToWindow ? mViewport->w() : 0;
+  const int height = mFitToWindow ? mViewport->h() : 0;
+
+  mImage = image_data();
+  mSamples = image_data();
+  mPyramid = ImagePyramid();
+  clearDetail();
+  decoded_frame decoded =
+      decodeFrame(mDataSet, mMeta, *mFrames, index, width, height);
+  showDecoded(decoded);
+}
+
+// 8 bit samples of a streamed frame as an image, toDisplay() passes them
+// through unchanged
+static image_data streamed_image(display_data &streamed) {
+  image_data image;
+  if (!streamed.pixels)
+    return image;
+  image.components = streamed.components;
+  image.width = streamed.width;
+  image.height = streamed.height;
+  image.bpp = 8;
+  image.reduction = streamed.reduction;
+  std::shared_ptr<unsigned char> owner(streamed.pixels.release(),
+                                       std::default_delete<unsigned char[]>());
+  image.pixels = PixelBuffer::wrap(
+      owner.get(), sample_format::u8,
+      static_cast<size_t>(streamed.width) * streamed.height,
+      streamed.components, false, owner);
+  return image;
+}
+
+void MainWindow::showDecoded(decoded_frame &decoded) {
+  mImage = std::move(decoded.image);
+  mSamples = image_data();
+  // nothing of a streamed frame is kept at full precision, so there is no
+  // windowing, but it is scaled the same way
+  mPyramid = ImagePyramid(mImage.pixels.empty()
+                              ? streamed_image(decoded.streamed)
+                              : mImage);
+  clearDetail();
+  render();
+  updateDetail();
+}
+
+void MainWindow::render() {
+  mEqualization.clear();
+  mClaheImage = image_data();
+  if (mPyramid.empty()) {
+    mViewport->clear();
+    return;
+  }
+  const image_data &base = mPyramid.base();
+  mFullWidth = base.width;
+  mFullHeight = base.height;
+  if (base.reduction > 0 && mDataSet) {
+    mFullWidth = static_cast<int>(
+        getNumber(mDataSet, 0x00280011, base.width << base.reduction));
+    mFullHeight = static_cast<int>(
+        getNumber(mDataSet, 0x00280010, base.height << base.reduction));
+  }
+  // windowing and equalization take their statistics from the image at the
+  // fitted size, the tiles of any zoom share them
+  int width;
+  int height;
+  fitSize(mFullWidth, mFullHeight, mViewport->w(), mViewport->h(), width,
+          height);
+  mSamples = mPyramid.scaled(width, height, mResample);
+  const bool windowed = !mImage.pixels.empty();
+  const int components = displayComponents(mSamples);
+  if (components == 0) {
+    mViewport->clear();
+    return;
+  }
+  mWindowStep = std::max(fullRange(mSamples).width / 512.0, 0.01);
+
+  if (windowed && !mWindowMode && components == 1) {
+    if (mClahe) {
+      mClaheImage.components = 1;
+      mClaheImage.width = mSamples.width;
+      mClaheImage.height = mSamples.height;
+      mClaheImage.bpp = 8;
+      mClaheImage.pixels = PixelBuffer(
+          sample_format::u8,
+          static_cast<size_t>(mSamples.width) * mSamples.height, 1);
+      claheToDisplay(mSamples, mClaheOptions,
+                     mClaheImage.pixels.samples<uint8_t>());
+    } else if (sampleSize(mSamples.pixels.format()) > 1) {
+      mEqualizationBins = sampleBins(mSamples);
+      mEqualization = equalizationLut(mSamples, mEqualizationBins);
     }
   }
+  mViewport->setImage(
+      mFullWidth, mFullHeight,
+      [this](int scaledWidth, int scaledHeight, int x, int y, int width,
+             int height) {
+        return viewSamples(scaledWidth, scaledHeight, x, y, width, height);
+      },
+      [this](const image_data &samples, uint8_t *out) {
+        mapSamples(samples, out);
+      });
+  if (!mFitToWindow && mViewport->fitted())
+    mViewport->zoomAt(1.0, mViewport->w() / 2, mViewport->h() / 2);
+}
 
-  if (img) {
-    if (img->w() != mImageDisplay->w() || img->h() != mImageDisplay->h()) {
-      std::unique_ptr<Fl_Image> oldImage(img);
-      img = img->copy(mImageDisplay->w(), mImageDisplay->h());
+image_data MainWindow::viewSamples(int scaledWidth, int scaledHeight, int x,
+                                   int y, int width, int height) {
+  if (!mClaheImage.pixels.empty())
+    return resampleRegion(mClaheImage, scaledWidth, scaledHeight, x, y,
+                          width, height, mResample);
+  if (!mDetail.pixels.empty()) {
+    // where the detail is in the zoomed image
+    const double scaleX = static_cast<double>(scaledWidth) / mFullWidth;
+    const double scaleY = static_cast<double>(scaledHeight) / mFullHeight;
+    const double left = mDetailArea.x0 * scaleX;
+    const double top = mDetailArea.y0 * scaleY;
+    const double right = mDetailArea.x1 * scaleX;
+    const double bottom = mDetailArea.y1 * scaleY;
+    if (x >= left && y >= top && x + width <= right && y + height <= bottom)
+      return resampleRegion(mDetail, right - left, bottom - top, x - left,
+                            y - top, width, height, mResample);
+  }
+  // fitted, the tiles are cut from the samples
+  if (scaledWidth == mSamples.width && scaledHeight == mSamples.height)
+    return resampleRegion(mSamples, scaledWidth, scaledHeight, x, y, width,
+                          height, mResample);
+  return mPyramid.scaledRegion(scaledWidth, scaledHeight, x, y, width, height,
+                               mResample);
+}
+
+// the linear mapping of the precision that streamed frames get, for their
+// full precision details
+static window_level bits_window(const image_data &image) {
+  const double range = std::ldexp(1.0, image.bpp);
+  const double low = isSigned(image.pixels.format()) ? -range / 2 : 0.0;
+  window_level window;
+  window.center = (low + range / 2) * image.slope + image.intercept;
+  window.width = range * std::fabs(image.slope);
+  return window;
+}
+
+void MainWindow::mapSamples(const image_data &samples, uint8_t *out) {
+  const bool grey = displayComponents(samples) == 1;
+  const bool windowed = !mImage.pixels.empty();
+  if (grey && windowed && mWindowMode)
+    applyLut(samples, windowTable(), out);
+  else if (grey && !mEqualization.empty() &&
+           samples.pixels.format() == mSamples.pixels.format())
+    applyLut(samples, mEqualization, out, mEqualizationBins);
+  else if (grey && !windowed && samples.bpp > 8)
+    toDisplay(samples, bits_window(samples), out);
+  else
+    toDisplay(samples, out);
+}
+
+void MainWindow::updateDetail() {
+  // the player would wait for every area
+  if (!mFrames || mCine || mPyramid.empty() || mViewport->empty())
+    return;
+  const int reduction = mPyramid.base().reduction;
+  const double zoom = mViewport->zoom();
+  if (reduction == 0 || zoom * (1 << reduction) <= 1.0) {
+    const bool shown = !mDetail.pixels.empty();
+    clearDetail();
+    if (shown)
+      mViewport->reload();
+    return;
+  }
+  const image_area visible = mViewport->visibleArea();
+  if (!mDetail.pixels.empty() && mDetailArea.x0 <= visible.x0 &&
+      mDetailArea.y0 <= visible.y0 && mDetailArea.x1 >= visible.x1 &&
+      mDetailArea.y1 >= visible.y1 &&
+      (mDetail.reduction == 0 || zoom * (1 << mDetail.reduction) <= 1.0))
+    return;
+  // already being decoded
+  if (mDetailPending && mDetailZoom == zoom &&
+      mDetailRequest.x0 <= visible.x0 && mDetailRequest.y0 <= visible.y0 &&
+      mDetailRequest.x1 >= visible.x1 && mDetailRequest.y1 >= visible.y1)
+    return;
+  // half the visible size around it, so that panning a little needs no
+  // new decode
+  const int marginX = (visible.x1 - visible.x0) / 2;
+  const int marginY = (visible.y1 - visible.y0) / 2;
+  image_area area;
+  area.x0 = std::max(0, visible.x0 - marginX);
+  area.y0 = std::max(0, visible.y0 - marginY);
+  area.x1 = std::min(mFullWidth, visible.x1 + marginX);
+  area.y1 = std::min(mFullHeight, visible.y1 + marginY);
+  const int width = static_cast<int>(std::ceil((area.x1 - area.x0) * zoom));
+  const int height = static_cast<int>(std::ceil((area.y1 - area.y0) * zoom));
+  // the frame is read here, FrameSource is not thread safe
+  mDetailPending = true;
+  mDetailRequest = area;
+  mDetailZoom = zoom;
+  mAreaDecoder.decode(mDataSet, mMeta, mFrames->frame(mFrameIndex), area,
+                      width, height);
+}
+
+void MainWindow::onDetailDecoded(image_data detail, const image_area &area) {
+  mDetailPending = false;
+  if (detail.pixels.empty())
+    return;
+  mDetail = std::move(detail);
+  mDetailArea = area;
+  mViewport->reload();
+}
+
+void MainWindow::clearDetail() {
+  // a result still on its way belongs to what was shown before
+  mAreaDecoder.cancel();
+  mDetailPending = false;
+  mDetail = image_data();
+}
+
+const std::vector<uint8_t> &MainWindow::windowTable() {
+  // the lut only depends on the sample format, the rescale, the inversion
+  // and the window
+  if (mLut.empty() || mLutFormat != mSamples.pixels.format() ||
+      mLutSlope != mSamples.slope || mLutIntercept != mSamples.intercept ||
+      mLutInvert != mSamples.invert ||
+      mLutWindow.center != mWindow.center ||
+      mLutWindow.width != mWindow.width) {
+    mLut = windowLut(mSamples, mWindow);
+    mLutFormat = mSamples.pixels.format();
+    mLutSlope = mSamples.slope;
+    mLutIntercept = mSamples.intercept;
+    mLutInvert = mSamples.invert;
+    mLutWindow = mWindow;
+  }
+  return mLut;
+}
+
+void MainWindow::applyWindow() {
+  if (mImage.pixels.empty() || displayComponents(mSamples) != 1)
+    return;
+  // tiles of CLAHE hold display samples, the others only need mapping again
+  if (!mClaheImage.pixels.empty()) {
+    mClaheImage = image_data();
+    mViewport->reload();
+    return;
+  }
+  mViewport->remap();
+}
+
+void MainWindow::onWindow(int preset) {
+  if (mImage.pixels.empty())
+    return;
+  if (preset == equalize_preset || preset == clahe_preset) {
+    mWindowMode = false;
+    mClahe = preset == clahe_preset;
+    render();
+    return;
+  }
+  if (preset == full_range_preset)
+    mWindow = fullRange(mImage);
+  else if (preset >= 0 && preset < static_cast<int>(mPresets.size()))
+    mWindow = mPresets[preset];
+  else
+    return;
+  mWindowMode = true;
+  applyWindow();
+}
+
+int MainWindow::handle(int event) {
+  switch (event) {
+  case FL_PUSH:
+    if (Fl::event_button() == FL_LEFT_MOUSE && !mImage.pixels.empty() &&
+        displayComponents(mSamples) == 1 && Fl::event_inside(mViewport)) {
+      if (!mWindowMode) {
+        mWindow = mPresets.empty() ? fullRange(mImage) : mPresets.front();
+        mWindowMode = true;
+      }
+      mDragX = Fl::event_x();
+      mDragY = Fl::event_y();
+      mDragging = true;
+      return 1;
+    }
+    break;
+  case FL_DRAG:
+    if (mDragging) {
+      // horizontal movement changes the width, vertical the level
+      mWindow.width =
+          std::max(1.0, mWindow.width + (Fl::event_x() - mDragX) * mWindowStep);
+      mWindow.center += (Fl::event_y() - mDragY) * mWindowStep;
+      mDragX = Fl::event_x();
+      mDragY = Fl::event_y();
+      applyWindow();
+      return 1;
+    }
+    break;
+  case FL_RELEASE:
+    if (mDragging) {
+      mDragging = false;
+      return 1;
+    }
+    break;
+  case FL_MOUSEWHEEL:
+    // with ctrl the viewport zooms
+    if (!mVolume.pixels.empty() && !(Fl::event_state() & FL_CTRL) &&
+        Fl::event_inside(mViewport)) {
+      showSlice(mSlice + Fl::event_dy());
+      return 1;
+    }
+    break;
+  // the info output takes the arrow keys while it has the focus
+  case FL_KEYDOWN:
+  case FL_SHORTCUT:
+    if (!mVolume.pixels.empty()) {
+      switch (Fl::event_key()) {
+      case FL_Up:
+        showSlice(mSlice - 1);
+        return 1;
+      case FL_Down:
+        showSlice(mSlice + 1);
+        return 1;
+      case FL_Page_Up:
+        showSlice(mSlice - 10);
+        return 1;
+      case FL_Page_Down:
+        showSlice(mSlice + 10);
+        return 1;
+      default:
+        break;
+      }
     }
+    break;
+  default:
+    break;
   }
-  mImageDisplay->image(img);
-  redraw();
-  dcm_io_close(mIO);
+  return Fl_Double_Window::handle(event);
+}
+
+void MainWindow::readPresets() {
+  setPresets(getStrings(mDataSet, 0x00281050),
+             getStrings(mDataSet, 0x00281051),
+             getStrings(mDataSet, 0x00281055));
 }
 
-bool MainWindow::read(const char *file) {
-  DcmError *error = nullptr;
-  mIO = dcm_io_create_from_file(&error, file);
+void MainWindow::setPresets(const std::vector<std::string> &centers,
+                            const std::vector<std::string> &widths,
+                            const std::vector<std::string> &explanations) {
+  for (const std::string &item : mPresetItems) {
+    const int index = mMenu->find_index(item.c_str());
+    if (index >= 0)
+      mMenu->remove(index);
+  }
+  mPresetItems.clear();
+  mPresets.clear();
 
-  mFilehandle = dcm_filehandle_create(&error, mIO);
-  if (mFilehandle == nullptr)
-    return false;
+  for (size_t i = 0; i < std::min(centers.size(), widths.size()); i++) {
+    window_level window;
+    window.center = atof(centers[i].c_str());
+    window.width = atof(widths[i].c_str());
+    mPresets.push_back(window);
 
-  mMeta = dcm_filehandle_get_file_meta(&error, mFilehandle);
-  mDataSet = dcm_filehandle_read_metadata(&error, mFilehandle, nullptr);
-  if (error) {
-    printf("%s\n", dcm_error_get_message(error));
-    return false;
+    std::string name = i < explanations.size() ? explanations[i] : "";
+    // these would be taken as submenus and shortcuts
+    std::replace(name.begin(), name.end(), '/', '-');
+    std::replace(name.begin(), name.end(), '\\', '-');
+    std::replace(name.begin(), name.end(), '&', '+');
+    std::string item = std::string("&Window/Preset ") + std::to_string(i + 1) +
+                       ": " + (name.empty() ? "" : name + " ") + "C " +
+                       centers[i] + " W " + widths[i];
+    mMenu->add(
+        item.c_str(), 0,
+        [](Fl_Widget *w, void *data) {
+          static_cast<MainWindow *>(w->window())
+              ->onWindow(static_cast<int>(reinterpret_cast<intptr_t>(data)));
+        },
+        reinterpret_cast<void *>(static_cast<intptr_t>(i)));
+    mPresetItems.push_back(item);
   }
-  return true;
+}
+
+void MainWindow::close() {
+  stopCine();
+  Fl_Menu_Item *item =
+      const_cast<Fl_Menu_Item *>(mMenu->find_item("&View/&Play cine"));
+  if (item)
+    item->clear();
+  mCineStatus->copy_label("");
+  // may point into the frames
+  mImage = image_data();
+  mSamples = image_data();
+  mPyramid = ImagePyramid();
+  clearDetail();
+  // the area being decoded may point into the frames
+  mAreaDecoder.wait();
+  mEqualization.clear();
+  mClaheImage = image_data();
+  mViewport->clear();
+  mVolume = volume();
+  mFrames.reset();
+  if (mDataSet)
+    dcm_dataset_destroy(mDataSet);
+  // the filehandle owns the io
+  if (mFilehandle)
+    dcm_filehandle_destroy(mFilehandle);
+  else if (mIO)
+    dcm_io_close(mIO);
+  mDataSet = nullptr;
+  mMeta = nullptr;
+  mFilehandle = nullptr;
+  mIO = nullptr;
 }
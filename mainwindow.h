@@ -7,9 +7,26 @@ extern "C" {
 #include <dicom/dicom.h>
 }
 
+#include "areadecoder.h"
+#include "compression.h"
+#include "cine.h"
+#include "clahe.h"
+#include "display.h"
+#include "loader.h"
+#include "resample.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class FrameSource;
 class Fl_Box;
 class Fl_Menu_Bar;
 class Fl_Multiline_Output;
+class Fl_Progress;
+class SeriesBrowser;
+class Viewport;
 
 class MainWindow : public Fl_Double_Window {
 
@@ -20,21 +37,117 @@ public:
   MainWindow(MainWindow &&) = delete;
   MainWindow &operator=(MainWindow &&) = delete;
 
-  ~MainWindow() override = default;
+  ~MainWindow() override;
+
+  int handle(int event) override;
+  void resize(int x, int y, int w, int h) override;
 
 public:
   void onOpenDICOM();
+  void onFitToWindow(bool fit);
+  void onZoom(double factor);
+  void onResampleFilter(resample_filter filter);
+  void onWindow(int preset);
+  void onDecoderThreads();
+  void onCacheSize();
+  void onClaheSettings();
+  void onCacheStatistics();
+  void onDecoderStatistics();
+  void onCine(bool play);
+  void onOpenSeries();
+  void onBrowseArchive();
 
 private:
-  bool read(const char *file);
+  void onProgress(const char *stage, float fraction);
+  void onLoaded(std::unique_ptr<load_result> result);
+  void close();
+  void showFrame(uint32_t index);
+  void showDecoded(decoded_frame &decoded);
+  void render();
+  void applyWindow();
+  // the viewport calls these for its tiles
+  image_data viewSamples(int scaledWidth, int scaledHeight, int x, int y,
+                         int width, int height);
+  void mapSamples(const image_data &samples, uint8_t *out);
+  void updateDetail();
+  void onDetailDecoded(image_data detail, const image_area &area);
+  void clearDetail();
+  const std::vector<uint8_t> &windowTable();
+  void readPresets();
+  void setPresets(const std::vector<std::string> &centers,
+                  const std::vector<std::string> &widths,
+                  const std::vector<std::string> &explanations);
+  void showSlice(int z);
+  void startCine();
+  void stopCine();
+  void cineTick();
+  static void onCineTick(void *data);
 
 private:
   Fl_Menu_Bar *mMenu;
-  Fl_Box *mImageDisplay;
+  Viewport *mViewport;
   Fl_Multiline_Output* mImageInfo;
+  Fl_Progress *mProgress;
+  Fl_Box *mCineStatus;
   DcmDataSet *mDataSet;
   const DcmDataSet *mMeta;
   DcmIO *mIO;
   DcmFilehandle *mFilehandle;
+  std::unique_ptr<FrameSource> mFrames;
+  bool mFitToWindow;
+  // index of the displayed frame
+  uint32_t mFrameIndex;
+  // set while cine playback runs, reads from mFrames
+  std::unique_ptr<CinePlayer> mCine;
+  // set when a series is open instead of a file
+  volume mVolume;
+  int mSlice;
+  std::unique_ptr<SeriesBrowser> mBrowser;
+
+  // the decoded frame and its samples at the fitted size, kept for windowing
+  image_data mImage;
+  image_data mSamples;
+  // full resolution size of the frame, mImage may be decoded smaller
+  int mFullWidth;
+  int mFullHeight;
+  // the visible part of a reduced frame decoded at the zoomed resolution
+  image_data mDetail;
+  image_area mDetailArea;
+  // set while mAreaDecoder works on mDetailRequest for mDetailZoom
+  bool mDetailPending;
+  image_area mDetailRequest;
+  double mDetailZoom;
+  // mImage, or the display samples of a streamed frame, and its halved
+  // copies that fitting to the display starts from
+  ImagePyramid mPyramid;
+  resample_options mResample;
+  bool mWindowMode;
+  // adaptive instead of global equalization, unless in window mode
+  bool mClahe;
+  clahe_options mClaheOptions;
+  // of mSamples, for the tiles of grey images with more than 8 bits
+  std::vector<uint8_t> mEqualization;
+  lut_bins mEqualizationBins;
+  // 8 bit display samples of CLAHE at the fitted size, which the tiles are
+  // scaled from, as the tiles of the image must share one equalization
+  image_data mClaheImage;
+  window_level mWindow;
+  // window change per pixel of mouse movement
+  double mWindowStep;
+  std::vector<window_level> mPresets;
+  std::vector<std::string> mPresetItems;
+  std::vector<uint8_t> mLut;
+  sample_format mLutFormat;
+  double mLutSlope;
+  double mLutIntercept;
+  bool mLutInvert;
+  window_level mLutWindow;
+  bool mDragging;
+  int mDragX;
+  int mDragY;
+  // declared last, so that they are stopped before the members they report
+  // to
+  Loader mLoader;
+  AreaDecoder mAreaDecoder;
 };
 #endif // MAINWINDOW_H
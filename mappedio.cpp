@@ -0,0 +1,160 @@
+#include "mappedio.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+// nullptr and the reason in error if file cannot be mapped
+static const char *map_file(const char *file, int64_t &size,
+                            std::string &error) {
+  const int fd = open(file, O_RDONLY);
+  if (fd < 0) {
+    error = std::string("unable to open ") + file + " - " + strerror(errno);
+    return nullptr;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    error = std::string("unable to map ") + file;
+    ::close(fd);
+    return nullptr;
+  }
+  void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps the file alive
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    error = std::string("unable to map ") + file + " - " + strerror(errno);
+    return nullptr;
+  }
+  size = info.st_size;
+  return static_cast<const char *>(data);
+}
+
+// libdicom sets methods, it has to be the first member
+struct mapped_io {
+  const DcmIOMethods *methods;
+  const char *data;
+  int64_t size;
+  int64_t position;
+};
+
+static DcmIO *mapped_open(DcmError **error, void *client) {
+  const char *file = static_cast<const char *>(client);
+  int64_t size = 0;
+  std::string reason;
+  const char *data = map_file(file, size, reason);
+  if (!data) {
+    dcm_error_set(error, DCM_ERROR_CODE_IO, "unable to map file", "%s",
+                  reason.c_str());
+    return nullptr;
+  }
+  mapped_io *io = new mapped_io;
+  io->methods = nullptr;
+  io->data = data;
+  io->size = size;
+  io->position = 0;
+  return reinterpret_cast<DcmIO *>(io);
+}
+
+static void mapped_close(DcmIO *io) {
+  mapped_io *mapped = reinterpret_cast<mapped_io *>(io);
+  munmap(const_cast<char *>(mapped->data), mapped->size);
+  delete mapped;
+}
+
+static int64_t mapped_read(DcmError **, DcmIO *io, char *buffer,
+                           int64_t length) {
+  mapped_io *mapped = reinterpret_cast<mapped_io *>(io);
+  if (length > mapped->size - mapped->position)
+    length = mapped->size - mapped->position;
+  if (length <= 0)
+    return 0;
+  memcpy(buffer, mapped->data + mapped->position, length);
+  mapped->position += length;
+  return length;
+}
+
+static int64_t mapped_seek(DcmError **error, DcmIO *io, int64_t offset,
+                           int whence) {
+  mapped_io *mapped = reinterpret_cast<mapped_io *>(io);
+  int64_t position = offset;
+  if (whence == SEEK_CUR)
+    position += mapped->position;
+  else if (whence == SEEK_END)
+    position += mapped->size;
+  if (position < 0 || position > mapped->size) {
+    dcm_error_set(error, DCM_ERROR_CODE_IO, "seek out of range",
+                  "offset %lld is outside of the file",
+                  static_cast<long long>(position));
+    return -1;
+  }
+  mapped->position = position;
+  return position;
+}
+
+static const DcmIOMethods mapped_methods = {mapped_open, mapped_close,
+                                            mapped_read, mapped_seek};
+#endif
+
+DcmIO *openMappedFile(DcmError **error, const char *file) {
+#ifndef _WIN32
+  DcmError *mapError = nullptr;
+  DcmIO *io = dcm_io_create(&mapError, &mapped_methods,
+                            const_cast<char *>(file));
+  if (io)
+    return io;
+  if (mapError) {
+    printf("%s\n", dcm_error_get_message(mapError));
+    dcm_error_destroy(mapError);
+  }
+#endif
+  return dcm_io_create_from_file(error, file);
+}
+
+MappedFile::MappedFile(const std::string &file) {
+#ifndef _WIN32
+  std::string error;
+  mData = map_file(file.c_str(), mSize, error);
+  if (!mData)
+    mSize = 0;
+#else
+  (void)file;
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifndef _WIN32
+  if (mData)
+    munmap(const_cast<char *>(mData), mSize);
+#endif
+}
+
+dicom_file::dicom_file(const std::string &file) : path(file) {
+  DcmError *error = nullptr;
+  io = openMappedFile(&error, file.c_str());
+  if (io)
+    filehandle = dcm_filehandle_create(&error, io);
+  if (filehandle)
+    meta = dcm_filehandle_get_file_meta(&error, filehandle);
+  if (meta)
+    dataset = dcm_filehandle_read_metadata(&error, filehandle, nullptr);
+  if (error)
+    dcm_error_destroy(error);
+}
+
+dicom_file::~dicom_file() {
+  if (dataset)
+    dcm_dataset_destroy(dataset);
+  // the filehandle owns the io
+  if (filehandle)
+    dcm_filehandle_destroy(filehandle);
+  else if (io)
+    dcm_io_close(io);
+}
@@ -0,0 +1,50 @@
+#ifndef MAPPEDIO_H
+#define MAPPEDIO_H
+
+extern "C" {
+#include <dicom/dicom.h>
+}
+
+#include <cstdint>
+#include <string>
+
+// Opens file as a read only memory mapping behind libdicom's custom IO
+// hooks, so repeated opens are served by the page cache.
+// Falls back to dcm_io_create_from_file() if the file cannot be mapped.
+DcmIO *openMappedFile(DcmError **error, const char *file);
+
+// A read only mapping of a whole file, empty if it cannot be mapped. The
+// offsets in the mapping are those of a DcmIO opened from the same file.
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &file);
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile();
+
+public:
+  const char *data() const { return mData; }
+  int64_t size() const { return mSize; }
+  bool empty() const { return mData == nullptr; }
+
+private:
+  const char *mData{nullptr};
+  int64_t mSize{0};
+};
+
+// A file opened through openMappedFile() with its metadata read, released on
+// destruction. dataset is nullptr if anything failed.
+struct dicom_file {
+  explicit dicom_file(const std::string &file);
+  dicom_file(const dicom_file &) = delete;
+  dicom_file &operator=(const dicom_file &) = delete;
+  ~dicom_file();
+
+  std::string path;
+  DcmIO *io{nullptr};
+  DcmFilehandle *filehandle{nullptr};
+  const DcmDataSet *meta{nullptr};
+  DcmDataSet *dataset{nullptr};
+};
+
+#endif // MAPPEDIO_H
@@ -0,0 +1,56 @@
+#include "pixelbuffer.h"
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+size_t sampleSize(sample_format format) {
+  switch (format) {
+  case sample_format::u8:
+  case sample_format::s8:
+    return 1;
+  case sample_format::u16:
+  case sample_format::s16:
+    return 2;
+  case sample_format::u32:
+  case sample_format::s32:
+    return 4;
+  }
+  return 0;
+}
+
+bool isSigned(sample_format format) {
+  return format == sample_format::s8 || format == sample_format::s16 ||
+         format == sample_format::s32;
+}
+
+sample_format formatFor(unsigned int bits, bool sgnd) {
+  if (bits <= 8)
+    return sgnd ? sample_format::s8 : sample_format::u8;
+  if (bits <= 16)
+    return sgnd ? sample_format::s16 : sample_format::u16;
+  return sgnd ? sample_format::s32 : sample_format::u32;
+}
+
+PixelBuffer::PixelBuffer(sample_format format, size_t pixels, int components,
+                         bool planar)
+    : mFormat(format), mPixels(pixels), mComponents(components),
+      mPlanar(planar) {
+  std::shared_ptr<uint8_t> storage(new uint8_t[bytes()],
+                                   std::default_delete<uint8_t[]>());
+  mData = mWritable = storage.get();
+  mOwner = std::move(storage);
+}
+
+PixelBuffer PixelBuffer::wrap(const void *data, sample_format format,
+                              size_t pixels, int components, bool planar,
+                              std::shared_ptr<const void> owner) {
+  PixelBuffer buffer;
+  buffer.mOwner = std::move(owner);
+  buffer.mData = data;
+  buffer.mFormat = format;
+  buffer.mPixels = pixels;
+  buffer.mComponents = components;
+  buffer.mPlanar = planar;
+  return buffer;
+}
@@ -0,0 +1,78 @@
+#ifndef PIXELBUFFER_H
+#define PIXELBUFFER_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+enum class sample_format { u8, s8, u16, s16, u32, s32 };
+
+size_t sampleSize(sample_format format);
+bool isSigned(sample_format format);
+// smallest format holding bits wide samples
+sample_format formatFor(unsigned int bits, bool sgnd);
+
+// Samples of an image in their native width and signedness. The components
+// are either planar (one plane after the other) or interleaved. The buffer
+// either owns its memory or wraps memory kept alive by an owner object.
+// Copies share the samples.
+class PixelBuffer {
+public:
+  PixelBuffer() = default;
+  // allocates writable, uninitialized storage
+  PixelBuffer(sample_format format, size_t pixels, int components = 1,
+              bool planar = false);
+
+  // no copy, owner keeps data alive
+  static PixelBuffer wrap(const void *data, sample_format format,
+                          size_t pixels, int components, bool planar,
+                          std::shared_ptr<const void> owner);
+
+public:
+  sample_format format() const { return mFormat; }
+  size_t pixels() const { return mPixels; }
+  int components() const { return mComponents; }
+  bool planar() const { return mPlanar; }
+  bool empty() const { return mData == nullptr; }
+  size_t bytes() const {
+    return mPixels * mComponents * sampleSize(mFormat);
+  }
+
+  // wrapped memory is read only, it is accessed through a const buffer
+  bool writable() const { return mWritable == mData; }
+
+  const void *data() const { return mData; }
+  void *data() {
+    assert(writable());
+    return mWritable;
+  }
+
+  template <typename T> const T *samples() const {
+    return static_cast<const T *>(mData);
+  }
+  template <typename T> T *samples() {
+    assert(writable());
+    return static_cast<T *>(mWritable);
+  }
+
+  // first sample of a component, step() apart from the next one
+  template <typename T> const T *component(int c) const {
+    return samples<T>() + (mPlanar ? c * mPixels : c);
+  }
+  template <typename T> T *component(int c) {
+    return samples<T>() + (mPlanar ? c * mPixels : c);
+  }
+  int step() const { return mPlanar ? 1 : mComponents; }
+
+private:
+  std::shared_ptr<const void> mOwner;
+  const void *mData{nullptr};
+  void *mWritable{nullptr};
+  sample_format mFormat{sample_format::u8};
+  size_t mPixels{0};
+  int mComponents{0};
+  bool mPlanar{false};
+};
+
+#endif // PIXELBUFFER_H
@@ -0,0 +1,478 @@
+#include "resample.h"
+#include "display.h"
+#include "kernels.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PDV_X86 1
+#endif
+
+// the loops are inlined into a plain and an AVX2 instance of every kernel,
+// the compiler vectorises each for its instruction set
+#ifdef __GNUC__
+#define PDV_INLINE inline __attribute__((always_inline))
+#else
+#define PDV_INLINE inline
+#endif
+
+// 32 bit samples do not fit into the mantissa of a float
+template <typename T>
+using real_t =
+    typename std::conditional<sizeof(T) == 4, double, float>::type;
+
+namespace {
+// the part of the scaled image to compute
+struct region {
+  double scaledWidth;
+  double scaledHeight;
+  double x;
+  double y;
+  int width;
+  int height;
+};
+
+// output sample i of an axis is the sum of input samples first[i] ..
+// first[i] + taps - 1 times weights[i * taps ..], the same number of taps
+// for every output keeps the loops free of branches
+template <typename R> struct axis_weights {
+  int taps;
+  std::vector<int> first;
+  std::vector<R> weights;
+};
+} // namespace
+
+static double triangle(double x) {
+  x = std::fabs(x);
+  return x < 1.0 ? 1.0 - x : 0.0;
+}
+
+static double sinc(double x) {
+  if (x == 0.0)
+    return 1.0;
+  x *= 3.14159265358979323846;
+  return std::sin(x) / x;
+}
+
+static double lanczos3(double x) {
+  return std::fabs(x) < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+}
+
+// Output samples begin .. begin + count - 1 of an axis of in samples
+// scaled to scaled samples, begin and scaled may be fractional. When
+// reducing, the filter is stretched to cover all input samples.
+template <typename R>
+static axis_weights<R> weights_for(int in, double scaled, double begin,
+                                   int count, resample_filter filter) {
+  const double scale = in / scaled;
+  axis_weights<R> result;
+  result.first.resize(count);
+  if (filter == resample_filter::nearest) {
+    result.taps = 1;
+    result.weights.assign(count, R(1));
+    for (int i = 0; i < count; i++) {
+      const int nearest =
+          static_cast<int>(std::floor((begin + i + 0.5) * scale));
+      result.first[i] = std::min(std::max(nearest, 0), in - 1);
+    }
+    return result;
+  }
+  double (*kernel)(double) =
+      filter == resample_filter::lanczos ? lanczos3 : triangle;
+  const double radius = filter == resample_filter::lanczos ? 3.0 : 1.0;
+  const double stretch = std::max(scale, 1.0);
+  const double support = radius * stretch;
+
+  result.taps = std::min(static_cast<int>(std::ceil(support)) * 2 + 1, in);
+  result.weights.assign(static_cast<size_t>(count) * result.taps, R(0));
+  std::vector<double> w(result.taps);
+  for (int i = 0; i < count; i++) {
+    const double center = (begin + i + 0.5) * scale - 0.5;
+    int left = std::max(static_cast<int>(std::ceil(center - support)), 0);
+    int right =
+        std::min(static_cast<int>(std::floor(center + support)), in - 1);
+    right = std::min(right, left + result.taps - 1);
+    double sum = 0.0;
+    for (int j = left; j <= right; j++) {
+      w[j - left] = kernel((j - center) / stretch);
+      sum += w[j - left];
+    }
+    if (right < left || sum == 0.0) {
+      // nothing under the filter, the nearest sample
+      left = std::min(std::max(static_cast<int>(center + 0.5), 0), in - 1);
+      right = left;
+      w[0] = 1.0;
+      sum = 1.0;
+    }
+    // samples past the edges are dropped, the window moves inside
+    const int first = std::min(left, in - result.taps);
+    result.first[i] = first;
+    R *dst = &result.weights[static_cast<size_t>(i) * result.taps];
+    for (int j = left; j <= right; j++) {
+      dst[j - first] = static_cast<R>(w[j - left] / sum);
+    }
+  }
+  return result;
+}
+
+// acc[i] = sum of weights[t] * in[t * pitch + i]
+template <typename T, typename R>
+static PDV_INLINE void vertical_loop(const T *in, size_t pitch, size_t count,
+                                     const R *weights, int taps, R *acc) {
+  const R w0 = weights[0];
+  for (size_t i = 0; i < count; i++) {
+    acc[i] = static_cast<R>(in[i]) * w0;
+  }
+  for (int t = 1; t < taps; t++) {
+    const T *row = in + t * pitch;
+    const R w = weights[t];
+    for (size_t i = 0; i < count; i++) {
+      acc[i] += static_cast<R>(row[i]) * w;
+    }
+  }
+}
+
+// one row of step samples per pixel through the horizontal weights, rounded
+// and clamped to low .. high
+template <typename T, typename R>
+static PDV_INLINE void horizontal_loop(const R *acc, int width, int step,
+                                       const int *first, const R *weights,
+                                       int taps, R low, R high, T *out) {
+  for (int x = 0; x < width; x++) {
+    const R *src = acc + static_cast<size_t>(first[x]) * step;
+    const R *w = weights + static_cast<size_t>(x) * taps;
+    for (int c = 0; c < step; c++) {
+      R sum = 0;
+      for (int t = 0; t < taps; t++) {
+        sum += src[t * step + c] * w[t];
+      }
+      const R v = std::min(std::max(sum, low), high);
+      out[x * step + c] = static_cast<T>(v < 0 ? v - R(0.5) : v + R(0.5));
+    }
+  }
+}
+
+template <typename T, typename R>
+static void vertical_kernel(const T *in, size_t pitch, size_t count,
+                            const R *weights, int taps, R *acc) {
+  vertical_loop(in, pitch, count, weights, taps, acc);
+}
+
+template <typename T, typename R>
+static void horizontal_kernel(const R *acc, int width, int step,
+                              const int *first, const R *weights, int taps,
+                              R low, R high, T *out) {
+  horizontal_loop(acc, width, step, first, weights, taps, low, high, out);
+}
+
+#ifdef PDV_X86
+template <typename T, typename R>
+__attribute__((target("avx2"))) static void
+vertical_avx2(const T *in, size_t pitch, size_t count, const R *weights,
+              int taps, R *acc) {
+  vertical_loop(in, pitch, count, weights, taps, acc);
+}
+
+template <typename T, typename R>
+__attribute__((target("avx2"))) static void
+horizontal_avx2(const R *acc, int width, int step, const int *first,
+                const R *weights, int taps, R low, R high, T *out) {
+  horizontal_loop(acc, width, step, first, weights, taps, low, high, out);
+}
+#endif
+
+// range of bpp bits, all of T if bpp is not set
+template <typename T, typename R>
+static void sample_range(int bpp, R &low, R &high) {
+  const int bits = bpp > 0 ? std::min<int>(bpp, sizeof(T) * 8) : sizeof(T) * 8;
+  if (std::is_signed<T>::value) {
+    low = -std::ldexp(R(1), bits - 1);
+    high = std::ldexp(R(1), bits - 1) - 1;
+  } else {
+    low = 0;
+    high = std::ldexp(R(1), bits) - 1;
+  }
+}
+
+// Every output row first combines the input rows under the vertical filter
+// into one row of reals, then filters that row horizontally. Both passes
+// run in the same worker, there is no intermediate image. Only the input
+// columns under the horizontal filter are combined, so a small region of a
+// large image is cheap.
+template <typename T>
+static void resample_samples(const image_data &image, PixelBuffer &out,
+                             const region &r, resample_filter filter,
+                             unsigned int threads) {
+  typedef real_t<T> R;
+  axis_weights<R> h =
+      weights_for<R>(image.width, r.scaledWidth, r.x, r.width, filter);
+  const axis_weights<R> v =
+      weights_for<R>(image.height, r.scaledHeight, r.y, r.height, filter);
+  // the first columns are ascending
+  const int columns = h.first.front();
+  const size_t span = h.first.back() + h.taps - columns;
+  for (int &first : h.first) {
+    first -= columns;
+  }
+  R low;
+  R high;
+  sample_range<T>(image.bpp, low, high);
+
+  void (*vertical)(const T *, size_t, size_t, const R *, int, R *) =
+      vertical_kernel<T, R>;
+  void (*horizontal)(const R *, int, int, const int *, const R *, int, R, R,
+                     T *) = horizontal_kernel<T, R>;
+#ifdef PDV_X86
+  if (hasAvx2()) {
+    vertical = vertical_avx2<T, R>;
+    horizontal = horizontal_avx2<T, R>;
+  }
+#endif
+
+  const PixelBuffer &pixels = image.pixels;
+  const int planes = pixels.planar() ? pixels.components() : 1;
+  const int step = pixels.step();
+  const size_t pitch = static_cast<size_t>(image.width) * step;
+  const size_t outPitch = static_cast<size_t>(r.width) * step;
+  for (int p = 0; p < planes; p++) {
+    const T *in = pixels.component<T>(pixels.planar() ? p : 0) +
+                  static_cast<size_t>(columns) * step;
+    T *dst = out.component<T>(pixels.planar() ? p : 0);
+    parallelFor(r.height, threads, [&](size_t begin, size_t end) {
+      std::vector<R> acc(span * step);
+      for (size_t y = begin; y < end; y++) {
+        vertical(in + v.first[y] * pitch, pitch, acc.size(),
+                 &v.weights[y * v.taps], v.taps, acc.data());
+        horizontal(acc.data(), r.width, step, h.first.data(),
+                   h.weights.data(), h.taps, low, high, dst + y * outPitch);
+      }
+    });
+  }
+}
+
+// the samples of width x height pixels from x, y on
+static image_data crop(const image_data &image, int x, int y, int width,
+                       int height) {
+  image_data cropped = image;
+  cropped.width = width;
+  cropped.height = height;
+  cropped.pixels =
+      PixelBuffer(image.pixels.format(), static_cast<size_t>(width) * height,
+                  image.pixels.components(), image.pixels.planar());
+  const PixelBuffer &pixels = image.pixels;
+  const int planes = pixels.planar() ? pixels.components() : 1;
+  const size_t bytes = sampleSize(pixels.format()) * pixels.step();
+  const size_t planeBytes = pixels.planar() ? pixels.pixels() * bytes : 0;
+  const size_t croppedPlaneBytes =
+      pixels.planar() ? cropped.pixels.pixels() * bytes : 0;
+  const uint8_t *in = static_cast<const uint8_t *>(pixels.data());
+  uint8_t *out = static_cast<uint8_t *>(cropped.pixels.data());
+  for (int p = 0; p < planes; p++) {
+    for (int row = 0; row < height; row++) {
+      std::copy_n(in + p * planeBytes +
+                      ((static_cast<size_t>(y) + row) * image.width + x) *
+                          bytes,
+                  width * bytes,
+                  out + p * croppedPlaneBytes +
+                      static_cast<size_t>(row) * width * bytes);
+    }
+  }
+  return cropped;
+}
+
+image_data resample(const image_data &image, int width, int height,
+                    const resample_options &options) {
+  if (options.filter == resample_filter::nearest || width <= 0 ||
+      height <= 0 || image.pixels.empty())
+    return resampleNearest(image, width, height);
+  if (image.colour != colour_space::ybr_full_422 && width == image.width &&
+      height == image.height)
+    return image;
+  return resampleRegion(image, width, height, 0, 0, width, height, options);
+}
+
+image_data resampleRegion(const image_data &image, double scaledWidth,
+                          double scaledHeight, double x, double y, int width,
+                          int height, const resample_options &options) {
+  if (width <= 0 || height <= 0 || scaledWidth <= 0 || scaledHeight <= 0 ||
+      image.pixels.empty())
+    return image_data();
+  if (image.colour == colour_space::ybr_full_422)
+    return resampleRegion(resampleNearest(image, image.width, image.height),
+                          scaledWidth, scaledHeight, x, y, width, height,
+                          options);
+  // at the size of the image the region is a copy, e.g. a tile of a view
+  // that fits the image
+  if (scaledWidth == image.width && scaledHeight == image.height &&
+      x == std::floor(x) && y == std::floor(y) && x >= 0 && y >= 0 &&
+      x + width <= image.width && y + height <= image.height)
+    return crop(image, static_cast<int>(x), static_cast<int>(y), width,
+                height);
+  image_data resampled = image;
+  resampled.width = width;
+  resampled.height = height;
+  resampled.pixels =
+      PixelBuffer(image.pixels.format(), static_cast<size_t>(width) * height,
+                  image.pixels.components(), image.pixels.planar());
+  const region r{scaledWidth, scaledHeight, x, y, width, height};
+  switch (image.pixels.format()) {
+  case sample_format::u8:
+    resample_samples<uint8_t>(image, resampled.pixels, r, options.filter,
+                              options.threads);
+    break;
+  case sample_format::s8:
+    resample_samples<int8_t>(image, resampled.pixels, r, options.filter,
+                             options.threads);
+    break;
+  case sample_format::u16:
+    resample_samples<uint16_t>(image, resampled.pixels, r, options.filter,
+                               options.threads);
+    break;
+  case sample_format::s16:
+    resample_samples<int16_t>(image, resampled.pixels, r, options.filter,
+                              options.threads);
+    break;
+  case sample_format::u32:
+    resample_samples<uint32_t>(image, resampled.pixels, r, options.filter,
+                               options.threads);
+    break;
+  case sample_format::s32:
+    resample_samples<int32_t>(image, resampled.pixels, r, options.filter,
+                              options.threads);
+    break;
+  }
+  return resampled;
+}
+
+void fitSize(int width, int height, int boxWidth, int boxHeight,
+             int &fitWidth, int &fitHeight) {
+  if (width <= 0 || height <= 0 || boxWidth <= 0 || boxHeight <= 0) {
+    fitWidth = std::max(boxWidth, 1);
+    fitHeight = std::max(boxHeight, 1);
+    return;
+  }
+  // compare boxWidth / width with boxHeight / height without rounding
+  if (static_cast<int64_t>(boxWidth) * height <=
+      static_cast<int64_t>(boxHeight) * width) {
+    fitWidth = boxWidth;
+    fitHeight = static_cast<int>(
+        (static_cast<int64_t>(height) * boxWidth + width / 2) / width);
+  } else {
+    fitHeight = boxHeight;
+    fitWidth = static_cast<int>(
+        (static_cast<int64_t>(width) * boxHeight + height / 2) / height);
+  }
+  fitWidth = std::max(fitWidth, 1);
+  fitHeight = std::max(fitHeight, 1);
+}
+
+// the mean of 2x2 samples, the last row and column are repeated for odd
+// sizes
+template <typename T>
+static void halve(const image_data &image, PixelBuffer &out, int width,
+                  int height) {
+  const PixelBuffer &pixels = image.pixels;
+  const int planes = pixels.planar() ? pixels.components() : 1;
+  const int step = pixels.step();
+  const size_t pitch = static_cast<size_t>(image.width) * step;
+  for (int p = 0; p < planes; p++) {
+    const T *in = pixels.component<T>(pixels.planar() ? p : 0);
+    T *dst = out.component<T>(pixels.planar() ? p : 0);
+    parallelFor(height, 0, [&](size_t begin, size_t end) {
+      for (size_t y = begin; y < end; y++) {
+        const T *top = in + 2 * y * pitch;
+        const T *bottom =
+            2 * y + 1 < static_cast<size_t>(image.height) ? top + pitch : top;
+        T *row = dst + y * width * step;
+        for (int x = 0; x < width; x++) {
+          const int left = 2 * x * step;
+          const int right =
+              2 * x + 1 < image.width ? left + step : left;
+          for (int c = 0; c < step; c++) {
+            const int64_t sum = static_cast<int64_t>(top[left + c]) +
+                                top[right + c] + bottom[left + c] +
+                                bottom[right + c];
+            row[x * step + c] = static_cast<T>((sum + 2) >> 2);
+          }
+        }
+      }
+    });
+  }
+}
+
+static image_data halved(const image_data &image) {
+  image_data result = image;
+  result.width = (image.width + 1) / 2;
+  result.height = (image.height + 1) / 2;
+  result.pixels = PixelBuffer(
+      image.pixels.format(), static_cast<size_t>(result.width) * result.height,
+      image.pixels.components(), image.pixels.planar());
+  switch (sampleSize(image.pixels.format())) {
+  case 1:
+    if (isSigned(image.pixels.format()))
+      halve<int8_t>(image, result.pixels, result.width, result.height);
+    else
+      halve<uint8_t>(image, result.pixels, result.width, result.height);
+    break;
+  case 2:
+    if (isSigned(image.pixels.format()))
+      halve<int16_t>(image, result.pixels, result.width, result.height);
+    else
+      halve<uint16_t>(image, result.pixels, result.width, result.height);
+    break;
+  case 4:
+    if (isSigned(image.pixels.format()))
+      halve<int32_t>(image, result.pixels, result.width, result.height);
+    else
+      halve<uint32_t>(image, result.pixels, result.width, result.height);
+    break;
+  }
+  return result;
+}
+
+ImagePyramid::ImagePyramid(const image_data &image) {
+  if (image.pixels.empty())
+    return;
+  // the levels are averaged per sample, which needs full chroma
+  mLevels.push_back(image.colour == colour_space::ybr_full_422
+                        ? resampleNearest(image, image.width, image.height)
+                        : image);
+}
+
+const image_data &ImagePyramid::level(int width, int height) {
+  size_t index = 0;
+  if (width <= 0 || height <= 0)
+    return mLevels[index];
+  for (;;) {
+    const image_data &current = mLevels[index];
+    if ((current.width + 1) / 2 < width || (current.height + 1) / 2 < height ||
+        (current.width == 1 && current.height == 1))
+      return current;
+    if (index + 1 == mLevels.size()) {
+      image_data next = halved(current);
+      mLevels.push_back(std::move(next));
+    }
+    index++;
+  }
+}
+
+image_data ImagePyramid::scaled(int width, int height,
+                                const resample_options &options) {
+  if (mLevels.empty())
+    return image_data();
+  return resample(level(width, height), width, height, options);
+}
+
+image_data ImagePyramid::scaledRegion(int scaledWidth, int scaledHeight, int x,
+                                      int y, int width, int height,
+                                      const resample_options &options) {
+  if (mLevels.empty())
+    return image_data();
+  return resampleRegion(level(scaledWidth, scaledHeight), scaledWidth,
+                        scaledHeight, x, y, width, height, options);
+}
@@ -0,0 +1,62 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include "compression.h"
+
+#include <vector>
+
+enum class resample_filter { nearest, bilinear, lanczos };
+
+struct resample_options {
+  resample_filter filter{resample_filter::bilinear};
+  // 0 uses every hardware thread
+  unsigned int threads{0};
+};
+
+// the largest size with the aspect ratio of width x height that fits into
+// boxWidth x boxHeight, at least 1 x 1
+void fitSize(int width, int height, int boxWidth, int boxHeight,
+             int &fitWidth, int &fitHeight);
+
+// Scales the samples to width x height with a separable filter, the rows of
+// the result are computed in parallel. Filtered samples are rounded and
+// clamped to bpp bits, so overshoot of the Lanczos filter cannot wrap
+// around. YBR_FULL_422 comes out as ybr_full.
+image_data resample(const image_data &image, int width, int height,
+                    const resample_options &options);
+// the part x, y, width x height of the image scaled to scaledWidth x
+// scaledHeight, e.g. one tile of a zoomed view; the scaled size and the
+// position are fractional when the image only covers a part of the view
+image_data resampleRegion(const image_data &image, double scaledWidth,
+                          double scaledHeight, double x, double y, int width,
+                          int height, const resample_options &options);
+
+// Halved copies of a decoded frame, each level averages 2x2 samples of the
+// one before. Levels are built when a size first needs them and kept, so
+// rescaling for a new display size starts from the smallest level that is
+// at least as large, and no filter ever reduces by more than 2.
+class ImagePyramid {
+public:
+  ImagePyramid() = default;
+  // shares the samples of image
+  explicit ImagePyramid(const image_data &image);
+
+  bool empty() const { return mLevels.empty(); }
+  // the full resolution image, YBR_FULL_422 expanded to ybr_full
+  const image_data &base() const { return mLevels.front(); }
+  size_t levels() const { return mLevels.size(); }
+
+  // the smallest level at least width x height
+  const image_data &level(int width, int height);
+  // the image at width x height, resampled from level(width, height)
+  image_data scaled(int width, int height, const resample_options &options);
+  // the part x, y, width x height of scaled(scaledWidth, scaledHeight)
+  image_data scaledRegion(int scaledWidth, int scaledHeight, int x, int y,
+                          int width, int height,
+                          const resample_options &options);
+
+private:
+  std::vector<image_data> mLevels;
+};
+
+#endif // RESAMPLE_H
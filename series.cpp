@@ -0,0 +1,294 @@
+#include "series.h"
+
+#include "dicomhelpers.h"
+#include "framesource.h"
+#include "headerindex.h"
+#include "mappedio.h"
+#include "threadpool.h"
+
+extern "C" {
+#include <dicom/dicom.h>
+}
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <map>
+#include <memory>
+#include <utility>
+
+void listFiles(const std::string &directory, bool recursive,
+               std::vector<file_stat> &files) {
+  DIR *dir = opendir(directory.c_str());
+  if (!dir) {
+    fprintf(stderr, "cannot open directory %s\n", directory.c_str());
+    return;
+  }
+  while (dirent *entry = readdir(dir)) {
+    const std::string name = entry->d_name;
+    if (name == "." || name == "..")
+      continue;
+    const std::string path = directory + "/" + name;
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+      continue;
+    if (S_ISREG(info.st_mode))
+      files.push_back({path, static_cast<int64_t>(info.st_mtime),
+                       static_cast<int64_t>(info.st_size)});
+    else if (recursive && S_ISDIR(info.st_mode))
+      listFiles(path, recursive, files);
+  }
+  closedir(dir);
+}
+
+static void read_doubles(const DcmDataSet *dataset, uint32_t tag,
+                         double *values, size_t count, bool &complete) {
+  const std::vector<std::string> strings = getStrings(dataset, tag);
+  complete = strings.size() >= count;
+  for (size_t i = 0; i < count && i < strings.size(); i++) {
+    values[i] = atof(strings[i].c_str());
+  }
+}
+
+static void read_slice(const std::string &file, slice_info &slice) {
+  slice.file = file;
+  dicom_file dicom(file);
+  if (!dicom.dataset)
+    return;
+  const DcmDataSet *dataset = dicom.dataset;
+  slice.studyUid = getString(dataset, 0x0020000D);
+  slice.studyDescription = getString(dataset, 0x00081030);
+  slice.seriesUid = getString(dataset, 0x0020000E);
+  slice.seriesDescription = getString(dataset, 0x0008103E);
+  slice.sopUid = getString(dataset, 0x00080018);
+  slice.patientName = getString(dataset, 0x00100010);
+  slice.modality = getString(dataset, 0x00080060);
+  slice.transferSyntax = getString(dicom.meta, 0x00020010);
+  slice.instance = getNumber(dataset, 0x00200013, 0);
+  slice.rows = getNumber(dataset, 0x00280010, 0);
+  slice.columns = getNumber(dataset, 0x00280011, 0);
+  slice.windowCenters = getStrings(dataset, 0x00281050);
+  slice.windowWidths = getStrings(dataset, 0x00281051);
+  slice.windowExplanations = getStrings(dataset, 0x00281055);
+  bool position = false;
+  bool orientation = false;
+  read_doubles(dataset, 0x00200032, slice.position, 3, position);
+  read_doubles(dataset, 0x00200037, slice.orientation, 6, orientation);
+  slice.hasPosition = position && orientation;
+  if (slice.rows > 0 && slice.columns > 0) {
+    // only scans up to the pixel data of a mapped file
+    FrameSource frames(dicom.dataset, dicom.meta, dicom.io, dicom.filehandle,
+                       dicom.path);
+    slice.frames = frames.count();
+    slice.pixelDataOffset = frames.pixelDataOffset();
+  }
+}
+
+std::vector<slice_info> scanDirectory(const std::string &directory,
+                                      const series_progress &progress,
+                                      bool recursive, HeaderIndex *index) {
+  std::vector<file_stat> files;
+  listFiles(directory, recursive, files);
+  std::sort(files.begin(), files.end(),
+            [](const file_stat &a, const file_stat &b) {
+              return a.path < b.path;
+            });
+  std::vector<slice_info> slices(files.size());
+  std::atomic<bool> cancelled(false);
+
+  ThreadPool pool(hardwareThreads());
+  std::vector<std::future<void>> done;
+  for (size_t i = 0; i < files.size(); i++) {
+    done.push_back(pool.submit([&, i] {
+      if (cancelled)
+        return;
+      const file_stat &f = files[i];
+      // unchanged files are not opened at all
+      if (index && index->lookup(f.path, f.mtime, f.size, slices[i]))
+        return;
+      read_slice(f.path, slices[i]);
+      if (index)
+        index->update(f.path, f.mtime, f.size, slices[i]);
+    }));
+  }
+  for (size_t i = 0; i < done.size(); i++) {
+    done[i].wait();
+    if (progress && !progress(i + 1, done.size()))
+      cancelled = true;
+  }
+  if (cancelled)
+    return {};
+
+  if (index) {
+    std::vector<std::string> paths;
+    for (const file_stat &f : files) {
+      paths.push_back(f.path);
+    }
+    index->prune(directory, recursive, paths);
+  }
+  std::vector<slice_info> result;
+  for (slice_info &slice : slices) {
+    if (slice.rows > 0 && slice.columns > 0)
+      result.push_back(std::move(slice));
+  }
+  return result;
+}
+
+// distance of the slice along the normal of its orientation
+static double slice_location(const slice_info &slice) {
+  const double *o = slice.orientation;
+  const double normal[3] = {o[1] * o[5] - o[2] * o[4],
+                            o[2] * o[3] - o[0] * o[5],
+                            o[0] * o[4] - o[1] * o[3]};
+  return slice.position[0] * normal[0] + slice.position[1] * normal[1] +
+         slice.position[2] * normal[2];
+}
+
+std::vector<std::vector<slice_info>>
+groupSeries(std::vector<slice_info> slices) {
+  std::map<std::string, std::vector<slice_info>> byUid;
+  for (slice_info &slice : slices) {
+    byUid[slice.seriesUid].push_back(std::move(slice));
+  }
+
+  std::vector<std::vector<slice_info>> series;
+  for (auto &entry : byUid) {
+    std::vector<slice_info> &group = entry.second;
+    const bool positions =
+        std::all_of(group.begin(), group.end(),
+                    [](const slice_info &s) { return s.hasPosition; });
+    std::stable_sort(group.begin(), group.end(),
+                     [positions](const slice_info &a, const slice_info &b) {
+                       if (positions) {
+                         const double la = slice_location(a);
+                         const double lb = slice_location(b);
+                         if (la != lb)
+                           return la < lb;
+                       }
+                       return a.instance < b.instance;
+                     });
+    series.push_back(std::move(group));
+  }
+  std::stable_sort(series.begin(), series.end(),
+                   [](const std::vector<slice_info> &a,
+                      const std::vector<slice_info> &b) {
+                     return a.size() > b.size();
+                   });
+  return series;
+}
+
+static image_data decode_slice(const slice_info &slice, double &slope,
+                               double &intercept) {
+  dicom_file dicom(slice.file);
+  if (!dicom.dataset)
+    return {};
+  FrameSource frames(dicom.dataset, dicom.meta, dicom.io, dicom.filehandle,
+                     dicom.path, slice.pixelDataOffset);
+  // the volume holds the slices, they would only push frames out of the cache
+  decoded_frame decoded = decodeFrame(dicom.dataset, dicom.meta,
+                                      frames.frame(0), frames.count(), 0, 0);
+  slope = decoded.image.slope;
+  intercept = decoded.image.intercept;
+  // the samples may point into the file, which is closed on return
+  image_data image = decoded.image;
+  if (!image.pixels.empty() && !image.pixels.writable()) {
+    const PixelBuffer &wrapped = image.pixels;
+    PixelBuffer copy(wrapped.format(), wrapped.pixels(), wrapped.components(),
+                     wrapped.planar());
+    memcpy(copy.data(), wrapped.data(), wrapped.bytes());
+    image.pixels = copy;
+  }
+  return image;
+}
+
+static bool same_layout(const image_data &a, const image_data &b) {
+  return a.width == b.width && a.height == b.height &&
+         a.components == b.components && a.colour == b.colour &&
+         a.pixels.format() == b.pixels.format() &&
+         a.pixels.components() == b.pixels.components() &&
+         a.pixels.planar() == b.pixels.planar();
+}
+
+volume loadVolume(const std::vector<slice_info> &slices,
+                  const series_progress &progress) {
+  if (slices.empty())
+    return {};
+  // the first slice decides size and sample format
+  double slope = 1.0;
+  double intercept = 0.0;
+  const image_data first = decode_slice(slices.front(), slope, intercept);
+  if (first.pixels.empty())
+    return {};
+
+  volume v;
+  v.components = first.components;
+  v.width = first.width;
+  v.height = first.height;
+  v.depth = slices.size();
+  v.bpp = first.bpp;
+  v.slopes.assign(slices.size(), slope);
+  v.intercepts.assign(slices.size(), intercept);
+  v.planar = first.pixels.planar();
+  v.invert = first.invert;
+  v.colour = first.colour;
+  const size_t sliceBytes = first.pixels.bytes();
+  v.pixels = PixelBuffer(first.pixels.format(),
+                         first.pixels.pixels() * slices.size(),
+                         first.pixels.components());
+  char *out = static_cast<char *>(v.pixels.data());
+  memcpy(out, first.pixels.data(), sliceBytes);
+
+  std::atomic<bool> cancelled(false);
+  ThreadPool pool(hardwareThreads());
+  std::vector<std::future<void>> done;
+  for (size_t z = 1; z < slices.size(); z++) {
+    done.push_back(pool.submit([&, z] {
+      if (cancelled)
+        return;
+      const image_data image =
+          decode_slice(slices[z], v.slopes[z], v.intercepts[z]);
+      if (image.pixels.empty() || !same_layout(image, first)) {
+        fprintf(stderr, "slice %s does not fit the series\n",
+                slices[z].file.c_str());
+        memset(out + z * sliceBytes, 0, sliceBytes);
+        return;
+      }
+      memcpy(out + z * sliceBytes, image.pixels.data(), sliceBytes);
+    }));
+  }
+  for (size_t i = 0; i < done.size(); i++) {
+    done[i].wait();
+    if (progress && !progress(i + 2, slices.size()))
+      cancelled = true;
+  }
+  if (cancelled)
+    return {};
+  return v;
+}
+
+image_data volumeSlice(const volume &v, int z) {
+  if (z < 0 || z >= v.depth || v.pixels.empty())
+    return {};
+  const size_t pixels = static_cast<size_t>(v.width) * v.height;
+  const size_t sliceBytes =
+      pixels * v.pixels.components() * sampleSize(v.pixels.format());
+  image_data image;
+  image.components = v.components;
+  image.width = v.width;
+  image.height = v.height;
+  image.bpp = v.bpp;
+  image.slope = v.slopes[z];
+  image.intercept = v.intercepts[z];
+  image.invert = v.invert;
+  image.colour = v.colour;
+  image.pixels = PixelBuffer::wrap(
+      static_cast<const char *>(v.pixels.data()) + z * sliceBytes,
+      v.pixels.format(), pixels, v.pixels.components(), v.planar,
+      std::make_shared<PixelBuffer>(v.pixels));
+  return image;
+}
@@ -0,0 +1,96 @@
+#ifndef SERIES_H
+#define SERIES_H
+
+#include "compression.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+class HeaderIndex;
+
+// header fields of a file, enough to sort it into its study and series;
+// rows and columns are 0 if the file is not an image
+struct slice_info {
+  std::string file;
+  std::string studyUid;
+  std::string studyDescription;
+  std::string seriesUid;
+  std::string seriesDescription;
+  std::string sopUid;
+  std::string patientName;
+  std::string modality;
+  std::string transferSyntax;
+  int64_t instance{0};
+  int64_t frames{1};
+  // see FrameSource::pixelDataOffset()
+  int64_t pixelDataOffset{-1};
+  // Image Position (Patient) and Image Orientation (Patient)
+  bool hasPosition{false};
+  double position[3]{};
+  double orientation[6]{};
+  int64_t rows{0};
+  int64_t columns{0};
+  // Window Center, Width and Explanation
+  std::vector<std::string> windowCenters;
+  std::vector<std::string> windowWidths;
+  std::vector<std::string> windowExplanations;
+};
+
+// The slices of a series decoded into one contiguous buffer, slice after
+// slice, each at full resolution.
+struct volume {
+  int components{};
+  int width{};
+  int height{};
+  int depth{};
+  int bpp{};
+  // layout of the components within each slice
+  bool planar{false};
+  // MONOCHROME1
+  bool invert{false};
+  colour_space colour{colour_space::rgb};
+  // modality lut of each slice
+  std::vector<double> slopes;
+  std::vector<double> intercepts;
+  PixelBuffer pixels;
+};
+
+// a regular file with its modification time
+struct file_stat {
+  std::string path;
+  int64_t mtime;
+  int64_t size;
+};
+
+// appends the regular files of directory, in directory order
+void listFiles(const std::string &directory, bool recursive,
+               std::vector<file_stat> &files);
+
+// called with the work done so far, returns false to cancel
+typedef std::function<bool(size_t done, size_t total)> series_progress;
+
+// reads the headers of every file of the directory in parallel, files that
+// are not DICOM images are left out; with an index only new or changed files
+// are parsed and the index is updated
+std::vector<slice_info> scanDirectory(const std::string &directory,
+                                      const series_progress &progress,
+                                      bool recursive = false,
+                                      HeaderIndex *index = nullptr);
+
+// groups the slices by Series Instance UID, largest series first, each
+// sorted along the slice normal, or by Instance Number without a position
+std::vector<std::vector<slice_info>>
+groupSeries(std::vector<slice_info> slices);
+
+// decodes the slices in parallel, slices of another size or sample format
+// than the first one are left black
+volume loadVolume(const std::vector<slice_info> &slices,
+                  const series_progress &progress);
+
+// slice z of the volume, shares its samples
+image_data volumeSlice(const volume &v, int z);
+
+#endif // SERIES_H
@@ -0,0 +1,59 @@
+#include "seriesbrowser.h"
+
+#include <FL/Fl.H>
+#include <FL/Fl_Hold_Browser.H>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+SeriesBrowser::SeriesBrowser(int w, int h, open_callback open)
+    : Fl_Double_Window(w, h, "Series"), mOpen(std::move(open)) {
+  begin();
+  mBrowser = new Fl_Hold_Browser(0, 0, w, h);
+  static const int widths[] = {180, 180, 200, 60, 0};
+  mBrowser->column_widths(widths);
+  mBrowser->column_char('\t');
+  mBrowser->callback(
+      [](Fl_Widget *, void *data) {
+        static_cast<SeriesBrowser *>(data)->onSelect();
+      },
+      this);
+  end();
+  resizable(mBrowser);
+}
+
+void SeriesBrowser::setCatalog(std::vector<std::vector<slice_info>> catalog) {
+  mCatalog = std::move(catalog);
+  std::sort(mCatalog.begin(), mCatalog.end(),
+            [](const std::vector<slice_info> &a,
+               const std::vector<slice_info> &b) {
+              const slice_info &sa = a.front();
+              const slice_info &sb = b.front();
+              if (sa.patientName != sb.patientName)
+                return sa.patientName < sb.patientName;
+              if (sa.studyUid != sb.studyUid)
+                return sa.studyUid < sb.studyUid;
+              return sa.seriesDescription < sb.seriesDescription;
+            });
+  mBrowser->clear();
+  for (size_t i = 0; i < mCatalog.size(); i++) {
+    const slice_info &first = mCatalog[i].front();
+    const std::string line =
+        first.patientName + "\t" + first.studyDescription + "\t" +
+        first.seriesDescription + "\t" + first.modality + "\t" +
+        std::to_string(mCatalog[i].size()) + " images";
+    mBrowser->add(line.c_str(),
+                  reinterpret_cast<void *>(static_cast<intptr_t>(i)));
+  }
+}
+
+void SeriesBrowser::onSelect() {
+  const int line = mBrowser->value();
+  if (line <= 0 || Fl::event_clicks() == 0 || !mOpen)
+    return;
+  const size_t index = reinterpret_cast<intptr_t>(mBrowser->data(line));
+  if (index < mCatalog.size())
+    mOpen(mCatalog[index]);
+}
@@ -0,0 +1,37 @@
+#ifndef SERIESBROWSER_H
+#define SERIESBROWSER_H
+
+#include <FL/Fl_Double_Window.H>
+
+#include "series.h"
+
+#include <functional>
+#include <vector>
+
+class Fl_Hold_Browser;
+
+// Lists the series of an archive, one line per series sorted by patient and
+// study. A double click opens the series.
+class SeriesBrowser : public Fl_Double_Window {
+public:
+  typedef std::function<void(const std::vector<slice_info> &)> open_callback;
+
+  SeriesBrowser(int w, int h, open_callback open);
+  SeriesBrowser(const SeriesBrowser &) = delete;
+  SeriesBrowser &operator=(const SeriesBrowser &) = delete;
+  SeriesBrowser(SeriesBrowser &&) = delete;
+  SeriesBrowser &operator=(SeriesBrowser &&) = delete;
+
+public:
+  void setCatalog(std::vector<std::vector<slice_info>> catalog);
+
+private:
+  void onSelect();
+
+private:
+  Fl_Hold_Browser *mBrowser;
+  std::vector<std::vector<slice_info>> mCatalog;
+  open_callback mOpen;
+};
+
+#endif // SERIESBROWSER_H
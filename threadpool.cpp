@@ -0,0 +1,79 @@
+#include "threadpool.h"
+
+#include <algorithm>
+#include <utility>
+
+ThreadPool::ThreadPool(unsigned int threads) : mStop(false) {
+  if (threads == 0)
+    threads = 1;
+  for (unsigned int i = 0; i < threads; i++) {
+    mThreads.emplace_back(&ThreadPool::work, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStop = true;
+  }
+  mCondition.notify_all();
+  for (auto &thread : mThreads) {
+    thread.join();
+  }
+}
+
+std::future<void> ThreadPool::submit(std::function<void()> task) {
+  std::packaged_task<void()> packaged(std::move(task));
+  std::future<void> result = packaged.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mTasks.push_back(std::move(packaged));
+  }
+  mCondition.notify_one();
+  return result;
+}
+
+void ThreadPool::work() {
+  for (;;) {
+    std::packaged_task<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mCondition.wait(lock, [this] { return mStop || !mTasks.empty(); });
+      if (mTasks.empty())
+        return;
+      task = std::move(mTasks.front());
+      mTasks.pop_front();
+    }
+    task();
+  }
+}
+
+unsigned int hardwareThreads() {
+  const unsigned int threads = std::thread::hardware_concurrency();
+  return threads == 0 ? 1 : threads;
+}
+
+void parallelFor(size_t count, unsigned int threads,
+                 const std::function<void(size_t begin, size_t end)> &task) {
+  if (count == 0)
+    return;
+  if (threads == 0)
+    threads = hardwareThreads();
+  const size_t ranges = std::min<size_t>(threads, count);
+  if (ranges == 1) {
+    task(0, count);
+    return;
+  }
+  // the caller works too, the pool only needs the other threads
+  static ThreadPool pool(hardwareThreads() - 1);
+  std::vector<std::future<void>> done;
+  for (size_t r = 1; r < ranges; r++) {
+    const size_t begin = count * r / ranges;
+    const size_t end = count * (r + 1) / ranges;
+    done.push_back(pool.submit([&task, begin, end] { task(begin, end); }));
+  }
+  task(0, count / ranges);
+  for (std::future<void> &d : done) {
+    d.get();
+  }
+}
@@ -0,0 +1,49 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed size pool of worker threads executing tasks in submission order.
+// Tasks must not wait for other tasks of the same pool.
+class ThreadPool {
+public:
+  explicit ThreadPool(unsigned int threads);
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ThreadPool(ThreadPool &&) = delete;
+  ThreadPool &operator=(ThreadPool &&) = delete;
+
+  ~ThreadPool();
+
+public:
+  std::future<void> submit(std::function<void()> task);
+  unsigned int size() const { return mThreads.size(); }
+
+private:
+  void work();
+
+private:
+  std::vector<std::thread> mThreads;
+  std::deque<std::packaged_task<void()>> mTasks;
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  bool mStop;
+};
+
+// number of threads available, at least 1
+unsigned int hardwareThreads();
+
+// Splits [0, count) into at most threads ranges (0 is hardwareThreads()) and
+// runs task(begin, end) on each, the calling thread takes the first range and
+// returns when all are done. The ranges run on a pool shared by the image
+// processing, so the tasks must not call parallelFor() themselves.
+void parallelFor(size_t count, unsigned int threads,
+                 const std::function<void(size_t begin, size_t end)> &task);
+
+#endif // THREADPOOL_H
@@ -0,0 +1,230 @@
+#include "transform.h"
+#include "kernels.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PDV_X86 1
+#endif
+
+// the loops are inlined into a plain and an AVX2 instance of every kernel,
+// the compiler vectorises each for its instruction set
+#ifdef __GNUC__
+#define PDV_INLINE inline __attribute__((always_inline))
+#else
+#define PDV_INLINE inline
+#endif
+
+// 32 bit samples do not fit into the mantissa of a float
+template <typename T>
+using real_t =
+    typename std::conditional<sizeof(T) == 4, double, float>::type;
+
+template <typename T>
+static PDV_INLINE void range_loop(const T *in, size_t count, T &low,
+                                  T &high) {
+  T min = low;
+  T max = high;
+  for (size_t i = 0; i < count; i++) {
+    min = std::min(min, in[i]);
+    max = std::max(max, in[i]);
+  }
+  low = min;
+  high = max;
+}
+
+template <typename T>
+static PDV_INLINE void extract_loop(const T *in, size_t count, int left,
+                                    int right, T *out) {
+  typedef typename std::make_unsigned<T>::type U;
+  for (size_t i = 0; i < count; i++) {
+    // the high bit to the top and back down to bit bitsStored - 1, the
+    // shift of a signed value extends its sign
+    const T top = static_cast<T>(static_cast<U>(in[i]) << left);
+    out[i] = static_cast<T>(top >> right);
+  }
+}
+
+// y = v * scale + offset, clamped and truncated like windowLut()
+template <typename T, bool Invert>
+static PDV_INLINE void window_loop(const T *in, size_t count,
+                                   real_t<T> scale, real_t<T> offset,
+                                   uint8_t *out) {
+  typedef real_t<T> R;
+  for (size_t i = 0; i < count; i++) {
+    const R y = std::min(
+        std::max(static_cast<R>(in[i]) * scale + offset, R(0)), R(255));
+    const uint8_t value = static_cast<uint8_t>(y);
+    out[i] = Invert ? static_cast<uint8_t>(255 - value) : value;
+  }
+}
+
+template <typename T>
+static void range_kernel(const T *in, size_t count, T &low, T &high) {
+  range_loop(in, count, low, high);
+}
+
+template <typename T>
+static void extract_kernel(const T *in, size_t count, int left, int right,
+                           T *out) {
+  extract_loop(in, count, left, right, out);
+}
+
+template <typename T, bool Invert>
+static void window_kernel(const T *in, size_t count, real_t<T> scale,
+                          real_t<T> offset, uint8_t *out) {
+  window_loop<T, Invert>(in, count, scale, offset, out);
+}
+
+#ifdef PDV_X86
+template <typename T>
+__attribute__((target("avx2"))) static void
+range_avx2(const T *in, size_t count, T &low, T &high) {
+  range_loop(in, count, low, high);
+}
+
+template <typename T>
+__attribute__((target("avx2"))) static void
+extract_avx2(const T *in, size_t count, int left, int right, T *out) {
+  extract_loop(in, count, left, right, out);
+}
+
+template <typename T, bool Invert>
+__attribute__((target("avx2"))) static void
+window_avx2(const T *in, size_t count, real_t<T> scale, real_t<T> offset,
+            uint8_t *out) {
+  window_loop<T, Invert>(in, count, scale, offset, out);
+}
+#endif
+
+// true if a sample is outside the range of bitsStored bits
+template <typename T>
+static bool out_of_range(const void *in, size_t count, int bitsStored) {
+  const T *samples = static_cast<const T *>(in);
+  const int64_t limit = std::is_signed<T>::value
+                            ? int64_t(1) << (bitsStored - 1)
+                            : int64_t(1) << bitsStored;
+  T low = 0;
+  T high = 0;
+#ifdef PDV_X86
+  if (hasAvx2())
+    range_avx2(samples, count, low, high);
+  else
+#endif
+    range_kernel(samples, count, low, high);
+  if (std::is_signed<T>::value)
+    return low < -limit || high >= limit;
+  return static_cast<int64_t>(high) >= limit;
+}
+
+template <typename T>
+static void extract(int bitsStored, int highBit, const void *in,
+                    size_t count, void *out) {
+  const int bits = sizeof(T) * 8;
+  const int left = bits - 1 - highBit;
+  const int right = bits - bitsStored;
+  const T *src = static_cast<const T *>(in);
+  T *dst = static_cast<T *>(out);
+#ifdef PDV_X86
+  if (hasAvx2()) {
+    extract_avx2(src, count, left, right, dst);
+    return;
+  }
+#endif
+  extract_kernel(src, count, left, right, dst);
+}
+
+template <typename T>
+static void window_samples(const image_data &image,
+                           const window_level &window, uint8_t *out) {
+  // PS3.3 C.11.2.1.2.1 gives y = (x - low) * 255 / (width - 1) + 0.5 inside
+  // the window, the modality lut x = v * slope + intercept is folded in
+  const double width = std::max(window.width, 1.0);
+  const double low = window.center - 0.5 - (width - 1) / 2;
+  const double step = 255.0 / std::max(width - 1, 1.0);
+  const real_t<T> scale = image.slope * step;
+  const real_t<T> offset = (image.intercept - low) * step + 0.5;
+
+  void (*kernel)(const T *, size_t, real_t<T>, real_t<T>, uint8_t *) =
+      image.invert ? window_kernel<T, true> : window_kernel<T, false>;
+#ifdef PDV_X86
+  if (hasAvx2())
+    kernel = image.invert ? window_avx2<T, true> : window_avx2<T, false>;
+#endif
+  kernel(image.pixels.samples<T>(), image.pixels.pixels(), scale, offset,
+         out);
+}
+
+bool needsExtraction(sample_format format, int bitsStored, int highBit,
+                     const void *in, size_t count) {
+  const int bits = sampleSize(format) * 8;
+  if (highBit != bitsStored - 1)
+    return true;
+  if (bitsStored >= bits)
+    return false;
+  switch (format) {
+  case sample_format::u8:
+    return out_of_range<uint8_t>(in, count, bitsStored);
+  case sample_format::s8:
+    return out_of_range<int8_t>(in, count, bitsStored);
+  case sample_format::u16:
+    return out_of_range<uint16_t>(in, count, bitsStored);
+  case sample_format::s16:
+    return out_of_range<int16_t>(in, count, bitsStored);
+  case sample_format::u32:
+    return out_of_range<uint32_t>(in, count, bitsStored);
+  case sample_format::s32:
+    return out_of_range<int32_t>(in, count, bitsStored);
+  }
+  return true;
+}
+
+void extractStoredBits(sample_format format, int bitsStored, int highBit,
+                       const void *in, size_t count, void *out) {
+  switch (format) {
+  case sample_format::u8:
+    extract<uint8_t>(bitsStored, highBit, in, count, out);
+    break;
+  case sample_format::s8:
+    extract<int8_t>(bitsStored, highBit, in, count, out);
+    break;
+  case sample_format::u16:
+    extract<uint16_t>(bitsStored, highBit, in, count, out);
+    break;
+  case sample_format::s16:
+    extract<int16_t>(bitsStored, highBit, in, count, out);
+    break;
+  case sample_format::u32:
+    extract<uint32_t>(bitsStored, highBit, in, count, out);
+    break;
+  case sample_format::s32:
+    extract<int32_t>(bitsStored, highBit, in, count, out);
+    break;
+  }
+}
+
+void windowToDisplay(const image_data &image, const window_level &window,
+                     uint8_t *out) {
+  switch (image.pixels.format()) {
+  case sample_format::u8:
+    window_samples<uint8_t>(image, window, out);
+    break;
+  case sample_format::s8:
+    window_samples<int8_t>(image, window, out);
+    break;
+  case sample_format::u16:
+    window_samples<uint16_t>(image, window, out);
+    break;
+  case sample_format::s16:
+    window_samples<int16_t>(image, window, out);
+    break;
+  case sample_format::u32:
+    window_samples<uint32_t>(image, window, out);
+    break;
+  case sample_format::s32:
+    window_samples<int32_t>(image, window, out);
+    break;
+  }
+}
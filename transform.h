@@ -0,0 +1,33 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "compression.h"
+#include "display.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Transforms of stored samples. The kernels are instantiated for every
+// sample format and every combination of steps at compile time, each call
+// picks one of them, so the loops over the samples have no branches and are
+// vectorised.
+
+// true if the count samples of the format have to go through
+// extractStoredBits(): their stored bits do not end at bit bitsStored - 1 or
+// a sample has other bits set (PS3.5 8.1.1), bitsStored and highBit have to
+// be valid for the format
+bool needsExtraction(sample_format format, int bitsStored, int highBit,
+                     const void *in, size_t count);
+// out[i] = the stored bits of in[i], sign extended for signed formats; in
+// and out hold count samples of the format and may be the same
+void extractStoredBits(sample_format format, int bitsStored, int highBit,
+                       const void *in, size_t count, void *out);
+
+// grey samples through the modality lut, the window (PS3.3 C.11.2.1.2.1)
+// and the MONOCHROME1 inversion to 8 bits; the mapping of
+// applyLut(image, windowLut(image, window)) without building the lut, and
+// without dropping the low bits of 32 bit samples
+void windowToDisplay(const image_data &image, const window_level &window,
+                     uint8_t *out);
+
+#endif // TRANSFORM_H
@@ -0,0 +1,261 @@
+#include "viewport.h"
+#include "display.h"
+#include "resample.h"
+
+#include <FL/Enumerations.H>
+#include <FL/Fl.H>
+#include <FL/fl_draw.H>
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+// edge of a tile in screen pixels
+static const int tile_size = 256;
+// screen pixels per image pixel
+static const double max_zoom = 32.0;
+// of the fitted zoom
+static const double min_zoom = 0.25;
+// per step of the mouse wheel
+static const double zoom_step = 1.25;
+
+Viewport::Viewport(int x, int y, int w, int h)
+    : Fl_Widget(x, y, w, h), mImageWidth(0), mImageHeight(0),
+      mScaledWidth(0), mScaledHeight(0), mLeft(0), mTop(0), mFitted(true),
+      mPanning(false), mPanX(0), mPanY(0) {}
+
+void Viewport::setImage(int width, int height, sample_source samples,
+                        display_mapping mapping) {
+  mSamples = std::move(samples);
+  mMapping = std::move(mapping);
+  if (width <= 0 || height <= 0) {
+    clear();
+    return;
+  }
+  if (width == mImageWidth && height == mImageHeight) {
+    reload();
+    return;
+  }
+  mImageWidth = width;
+  mImageHeight = height;
+  fit();
+}
+
+void Viewport::clear() {
+  mSamples = nullptr;
+  mMapping = nullptr;
+  mImageWidth = 0;
+  mImageHeight = 0;
+  mScaledWidth = 0;
+  mScaledHeight = 0;
+  mFitted = true;
+  mPanning = false;
+  mTiles.clear();
+  redraw();
+}
+
+double Viewport::zoom() const {
+  return empty() ? 0.0 : static_cast<double>(mScaledWidth) / mImageWidth;
+}
+
+double Viewport::fitZoom() const {
+  int width;
+  int height;
+  fitSize(mImageWidth, mImageHeight, w(), h(), width, height);
+  return static_cast<double>(width) / mImageWidth;
+}
+
+void Viewport::fit() {
+  if (empty())
+    return;
+  mFitted = true;
+  fitSize(mImageWidth, mImageHeight, w(), h(), mScaledWidth, mScaledHeight);
+  place();
+  mTiles.clear();
+  changed();
+}
+
+void Viewport::zoomAt(double zoom, int x, int y) {
+  if (empty())
+    return;
+  const double fitted = fitZoom();
+  zoom = std::min(std::max(zoom, fitted * min_zoom),
+                  std::max(max_zoom, fitted));
+  // the image point under x, y
+  const double imageX =
+      (x - mLeft) * static_cast<double>(mImageWidth) / mScaledWidth;
+  const double imageY =
+      (y - mTop) * static_cast<double>(mImageHeight) / mScaledHeight;
+  mScaledWidth = std::max(1, static_cast<int>(std::lround(mImageWidth * zoom)));
+  mScaledHeight =
+      std::max(1, static_cast<int>(std::lround(mImageHeight * zoom)));
+  mLeft = static_cast<int>(
+      std::lround(x - imageX * mScaledWidth / mImageWidth));
+  mTop = static_cast<int>(
+      std::lround(y - imageY * mScaledHeight / mImageHeight));
+  mFitted = false;
+  place();
+  mTiles.clear();
+  changed();
+}
+
+void Viewport::pan(int dx, int dy) {
+  if (empty())
+    return;
+  const int left = mLeft;
+  const int top = mTop;
+  mLeft += dx;
+  mTop += dy;
+  place();
+  // the tiles are in zoomed image coordinates, they all stay valid
+  if (mLeft != left || mTop != top)
+    changed();
+}
+
+void Viewport::place() {
+  if (mScaledWidth <= w())
+    mLeft = (w() - mScaledWidth) / 2;
+  else
+    mLeft = std::min(0, std::max(mLeft, w() - mScaledWidth));
+  if (mScaledHeight <= h())
+    mTop = (h() - mScaledHeight) / 2;
+  else
+    mTop = std::min(0, std::max(mTop, h() - mScaledHeight));
+}
+
+void Viewport::changed() {
+  redraw();
+  do_callback();
+}
+
+image_area Viewport::visibleArea() const {
+  image_area area;
+  if (empty())
+    return area;
+  const double scaleX = static_cast<double>(mImageWidth) / mScaledWidth;
+  const double scaleY = static_cast<double>(mImageHeight) / mScaledHeight;
+  area.x0 = static_cast<int>(std::floor(std::max(0, -mLeft) * scaleX));
+  area.y0 = static_cast<int>(std::floor(std::max(0, -mTop) * scaleY));
+  const int right = std::min(mScaledWidth, w() - mLeft);
+  const int bottom = std::min(mScaledHeight, h() - mTop);
+  area.x1 =
+      std::min(mImageWidth, static_cast<int>(std::ceil(right * scaleX)));
+  area.y1 =
+      std::min(mImageHeight, static_cast<int>(std::ceil(bottom * scaleY)));
+  return area;
+}
+
+void Viewport::remap() {
+  for (auto &entry : mTiles) {
+    entry.second.mapped = false;
+  }
+  redraw();
+}
+
+void Viewport::reload() {
+  mTiles.clear();
+  redraw();
+}
+
+void Viewport::drawTile(int column, int row) {
+  tile &t = mTiles[std::make_pair(column, row)];
+  const int x0 = column * tile_size;
+  const int y0 = row * tile_size;
+  const int width = std::min(tile_size, mScaledWidth - x0);
+  const int height = std::min(tile_size, mScaledHeight - y0);
+  if (!t.made) {
+    t.samples = mSamples(mScaledWidth, mScaledHeight, x0, y0, width, height);
+    t.made = true;
+    t.mapped = false;
+  }
+  if (!t.mapped) {
+    t.mapped = true;
+    t.components = t.samples.width == width && t.samples.height == height
+                       ? displayComponents(t.samples)
+                       : 0;
+    t.pixels.resize(static_cast<size_t>(width) * height * t.components);
+    if (t.components > 0)
+      mMapping(t.samples, t.pixels.data());
+  }
+  if (t.components > 0)
+    fl_draw_image(t.pixels.data(), x() + mLeft + x0, y() + mTop + y0, width,
+                  height, t.components);
+}
+
+void Viewport::draw() {
+  fl_push_clip(x(), y(), w(), h());
+  fl_rectf(x(), y(), w(), h(), color());
+  if (!empty() && mSamples && mMapping) {
+    const int columns = (mScaledWidth + tile_size - 1) / tile_size;
+    const int rows = (mScaledHeight + tile_size - 1) / tile_size;
+    const int firstColumn = std::max(0, -mLeft / tile_size);
+    const int lastColumn = std::min(columns - 1, (w() - 1 - mLeft) / tile_size);
+    const int firstRow = std::max(0, -mTop / tile_size);
+    const int lastRow = std::min(rows - 1, (h() - 1 - mTop) / tile_size);
+    for (int row = firstRow; row <= lastRow; row++) {
+      for (int column = firstColumn; column <= lastColumn; column++) {
+        drawTile(column, row);
+      }
+    }
+    // one ring of tiles around the view is kept for panning back and forth
+    for (auto it = mTiles.begin(); it != mTiles.end();) {
+      if (it->first.first < firstColumn - 1 ||
+          it->first.first > lastColumn + 1 || it->first.second < firstRow - 1 ||
+          it->first.second > lastRow + 1)
+        it = mTiles.erase(it);
+      else
+        ++it;
+    }
+  }
+  fl_pop_clip();
+}
+
+int Viewport::handle(int event) {
+  switch (event) {
+  case FL_PUSH:
+    if (!empty() && (Fl::event_button() == FL_MIDDLE_MOUSE ||
+                     Fl::event_button() == FL_RIGHT_MOUSE)) {
+      mPanning = true;
+      mPanX = Fl::event_x();
+      mPanY = Fl::event_y();
+      return 1;
+    }
+    break;
+  case FL_DRAG:
+    if (mPanning) {
+      pan(Fl::event_x() - mPanX, Fl::event_y() - mPanY);
+      mPanX = Fl::event_x();
+      mPanY = Fl::event_y();
+      return 1;
+    }
+    break;
+  case FL_RELEASE:
+    if (mPanning) {
+      mPanning = false;
+      return 1;
+    }
+    break;
+  case FL_MOUSEWHEEL:
+    if (!empty() && Fl::event_dy() != 0) {
+      zoomAt(zoom() * std::pow(zoom_step, -Fl::event_dy()),
+             Fl::event_x() - x(), Fl::event_y() - y());
+      return 1;
+    }
+    break;
+  default:
+    break;
+  }
+  return Fl_Widget::handle(event);
+}
+
+void Viewport::resize(int x, int y, int w, int h) {
+  Fl_Widget::resize(x, y, w, h);
+  if (empty())
+    return;
+  if (mFitted) {
+    fit();
+    return;
+  }
+  place();
+  changed();
+}
@@ -0,0 +1,92 @@
+#ifndef VIEWPORT_H
+#define VIEWPORT_H
+
+#include "compression.h"
+
+#include <FL/Fl_Widget.H>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <utility>
+#include <vector>
+
+// Shows an image at any zoom, the mouse wheel zooms around the pointer and
+// dragging with the middle or right button pans. The view is cut into tiles
+// of display samples that are made when they first come into view and kept
+// while they stay near it: panning only makes the tiles that appear, and a
+// new window only maps the samples the visible tiles keep again. The widget
+// callback runs whenever zoom or pan changed the visible area.
+class Viewport : public Fl_Widget {
+public:
+  // samples of the part x, y, width x height of the image scaled to
+  // scaledWidth x scaledHeight
+  typedef std::function<image_data(int scaledWidth, int scaledHeight, int x,
+                                   int y, int width, int height)>
+      sample_source;
+  // samples of a tile to displayComponents() 8 bit samples per pixel
+  typedef std::function<void(const image_data &samples, uint8_t *out)>
+      display_mapping;
+
+  Viewport(int x, int y, int w, int h);
+
+  // width x height is the full resolution size of the image; a new size is
+  // fitted into the view, the same size keeps zoom and pan
+  void setImage(int width, int height, sample_source samples,
+                display_mapping mapping);
+  void clear();
+  bool empty() const { return mImageWidth == 0; }
+
+  // screen pixels per image pixel
+  double zoom() const;
+  bool fitted() const { return mFitted; }
+  void fit();
+  // keeps the image point under x, y (relative to the widget) in place
+  void zoomAt(double zoom, int x, int y);
+  void pan(int dx, int dy);
+  // the part of the image in view, in full resolution pixels, x1 and y1
+  // excluded
+  image_area visibleArea() const;
+
+  // the mapping changed, e.g. the window; the tiles keep their samples
+  void remap();
+  // the samples changed, e.g. a more detailed decode
+  void reload();
+
+  void draw() override;
+  int handle(int event) override;
+  void resize(int x, int y, int w, int h) override;
+
+private:
+  struct tile {
+    bool made{false};
+    bool mapped{false};
+    int components{0};
+    image_data samples;
+    std::vector<uint8_t> pixels;
+  };
+
+  double fitZoom() const;
+  // centres what is smaller than the view, keeps the rest covering it
+  void place();
+  void changed();
+  void drawTile(int column, int row);
+
+  sample_source mSamples;
+  display_mapping mMapping;
+  int mImageWidth;
+  int mImageHeight;
+  // size of the zoomed image and where its top left corner is, relative to
+  // the widget
+  int mScaledWidth;
+  int mScaledHeight;
+  int mLeft;
+  int mTop;
+  bool mFitted;
+  std::map<std::pair<int, int>, tile> mTiles;
+  bool mPanning;
+  int mPanX;
+  int mPanY;
+};
+
+#endif // VIEWPORT_H